@@ -27,6 +27,7 @@ namespace gerber_3d
 
         void set_gerber(gerber_lib::gerber *g) override;
         void fill_elements(gerber_lib::gerber_draw_element const *elements, size_t num_elements, gerber_lib::gerber_polarity polarity, int entity_id) override;
+        void begin_layer(size_t num_shapes, size_t num_elements) override;
 
         std::string current_filename() const;
 
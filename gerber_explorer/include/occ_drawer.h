@@ -8,6 +8,8 @@
 #include "gerber_lib.h"
 #include "gerber_draw.h"
 
+#include <vector>
+
 #include <TopoDS_Shape.hxx>
 
 //////////////////////////////////////////////////////////////////////
@@ -21,17 +23,31 @@ namespace gerber_3d
         void set_gerber(gerber_lib::gerber *g) override;
         void fill_elements(gerber_lib::gerber_draw_element const *elements, size_t num_elements, gerber_lib::gerber_polarity polarity, int entity_id) override;
 
+        void begin_polarity_run(gerber_lib::gerber_polarity polarity, size_t num_shapes, size_t num_elements) override;
+        void end_polarity_run() override;
+        void end_layer() override;
+
         void on_gerber_finished();
 
         void create_window(int x, int y, int w, int h);
 
+        // fuse/cut the current run into main_face
+        void flush_run();
+
+        void add_prism(TopoDS_Shape const &face);
+
         occ_viewer vout{};
 
+        // true: keep real arcs and fuse each polarity run in OCC (on all the threads),
+        // false: flatten the layer with gerber_lib first, which is the default because
+        // it's much quicker. The explorer makes the 3D view with '3' for flattened and '4' for exact
+        bool exact_arcs{ false };
+
         TopoDS_Shape main_face{};
-        TopoDS_Shape current_face{};
 
-        bool previous_fill{ false };
-        bool current_fill{ false };
+        // faces of the current polarity run, fused in one go when the run ends
+        std::vector<TopoDS_Shape> run_faces;
+        bool run_dark{ true };
 
         gerber_lib::gerber *gerber_file{ nullptr };
     };
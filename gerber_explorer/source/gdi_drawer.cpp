@@ -1,6 +1,7 @@
 
 #include "gdi_drawer.h"
 #include <thread>
+#include <filesystem>
 #include <algorithm>
 #include <windowsx.h>
 #include "gerber_lib.h"
@@ -239,7 +240,8 @@ namespace gerber_3d
             std::thread(
                 [this](std::string filename) {
                     std::unique_ptr<gerber> new_gerber{ std::make_unique<gerber>() };
-                    CHECK(new_gerber->parse_file(filename.c_str()));
+                    std::string cache_folder = (std::filesystem::temp_directory_path() / "gerber_explorer_cache").string();
+                    CHECK(new_gerber->parse_file_cached(filename.c_str(), cache_folder.c_str()));
                     PostMessage(hwnd, WM_USER, 0, (LPARAM)new_gerber.release());
                     return ok;
                 },
@@ -274,7 +276,7 @@ namespace gerber_3d
             cleanup();
             zoom_to_rect(gerber_file->image.info.extent);
 
-            gerber_file->draw(*this);
+            gerber_file->draw_list().replay(*this);
         }
         redraw();
     }
@@ -514,7 +516,7 @@ namespace gerber_3d
                 if(gerber_file != nullptr && highlight_entity) {
                     log_drawer logger;
                     logger.set_gerber(gerber_file);
-                    gerber_file->draw(logger);
+                    gerber_file->draw_list().replay(logger);
                 }
                 break;
 
@@ -608,10 +610,12 @@ namespace gerber_3d
                 break;
 
             case '3':
+            case '4':
                 if(occ.vout.hwnd == nullptr) {
                     occ.show_progress = true;
                     occ.create_window(100, 100, 700, 700);
                 }
+                occ.exact_arcs = LOWORD(wParam) == '4';
                 std::thread([&]() {
                     occ.set_gerber(gerber_file);
                     PostMessageA(occ.vout.hwnd, WM_USER, 0, 0);
@@ -870,6 +874,16 @@ namespace gerber_3d
     //////////////////////////////////////////////////////////////////////
     // entity_id is guaranteed to increase monotonically
 
+    void gdi_drawer::begin_layer(size_t num_shapes, size_t num_elements)
+    {
+        (void)num_elements;
+
+        // one path per shape
+        gdi_paths.reserve(gdi_paths.size() + num_shapes);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     void gdi_drawer::fill_elements(gerber_draw_element const *elements, size_t num_elements, gerber_polarity polarity, int entity_id)
     {
         GraphicsPath *p = new GraphicsPath();
@@ -1187,63 +1201,68 @@ namespace gerber_3d
             graphics->ResetTransform();
 #endif
 
+            int line_number_begin = gerber_file->reader.line_number_at(entity.offset_begin);
+            int line_number_end = gerber_file->reader.line_number_at(entity.offset_end - 1);
+
             std::string line;
-            if(entity.line_number_begin != entity.line_number_end) {
-                line = std::format("Lines {} to {}", entity.line_number_begin, entity.line_number_end);
+            if(line_number_begin != line_number_end) {
+                line = std::format("Lines {} to {}", line_number_begin, line_number_end);
             } else {
-                line = std::format("Line {}", entity.line_number_begin);
+                line = std::format("Line {}", line_number_begin);
             }
 
-            gerber_net const *net = gerber_file->image.nets[entity.net_index];
+            gerber_net_store const &nets = gerber_file->image.net_store;
+            size_t net_index = entity.net_index;
+            vec2d const &start = nets.start[net_index];
+            vec2d const &end = nets.end[net_index];
 
             std::string net_info;
 
             std::string aperture_info;
-            auto f = gerber_file->image.apertures.find(net->aperture);
-            if(f == gerber_file->image.apertures.end()) {
+            gerber_aperture *aperture = gerber_file->image.apertures.find(nets.aperture[net_index]);
+            if(aperture == nullptr) {
                 aperture_info = "None";
             } else {
-                gerber_aperture *aperture = f->second;
                 aperture_info = std::format("D{} - {}", aperture->aperture_number, aperture->get_description(get_units(), units_string()));
-                net_info = std::format("At {:9.5f},{:9.5f}{}", convert_units(net->end.x), convert_units(net->end.y), units_string());
+                net_info = std::format("At {:9.5f},{:9.5f}{}", convert_units(end.x), convert_units(end.y), units_string());
 
-                // net->aperture_state should be aperture_state_flash at this point...
+                // aperture_state should be aperture_state_flash at this point...
             }
 
             std::string draw;
-            if(net->aperture_state == aperture_state_flash) {
+            if(nets.get_aperture_state(net_index) == aperture_state_flash) {
                 draw = "Flash";
             } else {
-                switch(net->interpolation_method) {
+                switch(nets.get_interpolation(net_index)) {
                 case interpolation_linear:
                     draw = "Linear";
-                    net_info = std::format("From {:9.5f},{:9.5f}{}\n  To {:9.5f},{:9.5f}{}", convert_units(net->start.x), convert_units(net->start.y),
-                                           units_string(), convert_units(net->end.x), convert_units(net->end.y), units_string());
+                    net_info = std::format("From {:9.5f},{:9.5f}{}\n  To {:9.5f},{:9.5f}{}", convert_units(start.x), convert_units(start.y),
+                                           units_string(), convert_units(end.x), convert_units(end.y), units_string());
                     break;
                 case interpolation_clockwise_circular:
-                    draw = "Clockwise";
-                    net_info = std::format("At {:9.5f},{:9.5f}{}\nRadius {:6.4f}{}\nFrom {:5.1f}\n  To {:5.1f}", convert_units(net->circle_segment.pos.x),
-                                           convert_units(net->circle_segment.pos.y), units_string(), convert_units(net->circle_segment.size.x), units_string(),
-                                           net->circle_segment.start_angle, net->circle_segment.end_angle);
-                    break;
-                case interpolation_counterclockwise_circular:
-                    draw = "Counter clockwise";
-                    net_info = std::format("At {:9.5f},{:9.5f}{}\nRadius {:6.4f}{}\nFrom {:5.1f}\n  To {:5.1f}", convert_units(net->circle_segment.pos.x),
-                                           convert_units(net->circle_segment.pos.y), units_string(), convert_units(net->circle_segment.size.x), units_string(),
-                                           net->circle_segment.start_angle, net->circle_segment.end_angle);
-                    break;
+                case interpolation_counterclockwise_circular: {
+                    gerber_arc const &arc = nets.arc(net_index);
+                    draw = nets.get_interpolation(net_index) == interpolation_clockwise_circular ? "Clockwise" : "Counter clockwise";
+                    net_info = std::format("At {:9.5f},{:9.5f}{}\nRadius {:6.4f}{}\nFrom {:5.1f}\n  To {:5.1f}", convert_units(arc.pos.x),
+                                           convert_units(arc.pos.y), units_string(), convert_units(arc.size.x), units_string(), arc.start_angle,
+                                           arc.end_angle);
+                } break;
                 case interpolation_region_start:
                     draw = "Region";
-                    net_info = std::format("{} points", net->num_region_points);
+                    net_info = std::format("{} points", nets.num_region_points(net_index));
+                    break;
+                default:
                     break;
                 }
             }
 
             std::string attributes;
             char const *sep = "";
-            for(auto const &kvp : entity.attributes) {
-                attributes = std::format("{}{}{}={}", attributes, sep, kvp.first, kvp.second);
-                sep = "\n";
+            if(entity.attributes != nullptr) {
+                for(auto const &attribute : *entity.attributes) {
+                    attributes = std::format("{}{}{}={}", attributes, sep, *attribute.name, *attribute.value);
+                    sep = "\n";
+                }
             }
 
             std::string text = std::format("Entity {:4d} {}\n"    //
@@ -1257,7 +1276,7 @@ namespace gerber_3d
                                            aperture_info,                //
                                            draw,                         //
                                            net_info,                     //
-                                           net->level->polarity,         //
+                                           gerber_file->net_polarity(net_index),    //
                                            attributes);
 
             std::wstring wide_text = utf16_from_utf8(text);
@@ -12,7 +12,7 @@ namespace gerber_3d
     void log_drawer::set_gerber(gerber_lib::gerber *g)
     {
         gerber_file = g;
-        LOG_DEBUG("LOGGER IS READY, {} nets in total", g->image.nets.size());
+        LOG_DEBUG("LOGGER IS READY, {} nets in total", g->image.net_store.size());
     }
 
     //////////////////////////////////////////////////////////////////////
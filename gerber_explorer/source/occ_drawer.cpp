@@ -2,6 +2,10 @@
 
 #include "gerber_lib.h"
 
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
 #include <AIS_Shape.hxx>
 #include <gp.hxx>
 #include <gp_Ax3.hxx>
@@ -17,7 +21,12 @@
 #include <BRepBuilderAPI_MakeEdge.hxx>
 #include <BRepBuilderAPI_MakeWire.hxx>
 #include <BRepAlgoAPI_Fuse.hxx>
+#include <BRepAlgoAPI_Cut.hxx>
+#include <TopTools_ListOfShape.hxx>
 #include <ShapeFix_Shape.hxx>
+#include <BRepBuilderAPI_MakePolygon.hxx>
+#include <BRep_Builder.hxx>
+#include <TopoDS_Compound.hxx>
 
 LOG_CONTEXT("OCC", debug);
 
@@ -25,10 +34,10 @@ namespace
 {
     //////////////////////////////////////////////////////////////////////
 
-    void dump_alerts(char const *banner, BOPAlgo_Options const &builder)
+    void dump_alerts(char const *banner, Handle(Message_Report) const &report)
     {
         auto dump = [&](int x, char const *severity) {
-            Message_ListOfAlert const &alerts = builder.GetReport()->GetAlerts(static_cast<Message_Gravity>(x));
+            Message_ListOfAlert const &alerts = report->GetAlerts(static_cast<Message_Gravity>(x));
             if(alerts.Size() != 0) {
                 LOG_DEBUG(" {:10s}: {} alerts for {}", severity, alerts.Size(), banner);
                 for(Message_ListOfAlert::Iterator anIt(alerts); anIt.More(); anIt.Next()) {
@@ -61,46 +70,202 @@ namespace
     }
 
     //////////////////////////////////////////////////////////////////////
+    // how many faces go into each fuse at each level of fuse_faces
 
-    void boolean_face(TopoDS_Shape const &tool_face, TopoDS_Shape &final_face, BOPAlgo_Operation operation)
-    {
-        ShapeFix_Shape fixer(tool_face);
-        fixer.Perform();
+    constexpr size_t fuse_group_size = 8;
 
-        BOPAlgo_BOP builder;
-        builder.SetOperation(operation);
-        builder.AddArgument(final_face);
-        builder.AddTool(fixer.Shape());
-        builder.Perform();
+    //////////////////////////////////////////////////////////////////////
 
+    TopoDS_Shape unify(TopoDS_Shape const &shape)
+    {
         ShapeUpgrade_UnifySameDomain unify_final;
-        unify_final.Initialize(builder.Shape());
+        unify_final.Initialize(shape);
         unify_final.Build();
-        final_face = unify_final.Shape();
-        // dump_shape(final_face, 0);
+        return unify_final.Shape();
     }
 
     //////////////////////////////////////////////////////////////////////
-    // Merge a face into another face
+    // a fuse of faces[begin] with faces[begin + 1, end), null if OCC can't do it
 
-    void add_face(TopoDS_Shape const &face_to_add, TopoDS_Shape &final_face)
+    TopoDS_Shape try_fuse(std::vector<TopoDS_Shape> const &faces, size_t begin, size_t end)
     {
-        if(final_face.IsNull()) {
-            final_face = face_to_add;
-            return;
+        TopTools_ListOfShape arguments;
+        TopTools_ListOfShape tools;
+        arguments.Append(faces[begin]);
+        for(size_t i = begin + 1; i < end; ++i) {
+            tools.Append(faces[i]);
+        }
+
+        BRepAlgoAPI_Fuse fuse;
+        fuse.SetArguments(arguments);
+        fuse.SetTools(tools);
+        fuse.SetRunParallel(true);
+        fuse.Build();
+
+        if(!fuse.IsDone()) {
+            dump_alerts("fuse", fuse.GetReport());
+            return {};
         }
-        boolean_face(face_to_add, final_face, BOPAlgo_FUSE);
+        return unify(fuse.Shape());
     }
 
     //////////////////////////////////////////////////////////////////////
-    // remove one face from another
+    // one multi-argument fuse of faces[begin, end). If that fails they get fused one
+    // at a time and any which still won't fuse are kept alongside in a compound
 
-    void remove_face(TopoDS_Shape const &face_to_remove, TopoDS_Shape &final_face)
+    TopoDS_Shape fuse_group(std::vector<TopoDS_Shape> const &faces, size_t begin, size_t end)
     {
-        if(final_face.IsNull()) {
-            return;
+        if(end - begin == 1) {
+            return faces[begin];
+        }
+
+        TopoDS_Shape fused = try_fuse(faces, begin, end);
+        if(!fused.IsNull()) {
+            return fused;
+        }
+
+        LOG_WARNING("Fusing {} faces failed, fusing them one at a time", end - begin);
+
+        std::vector<TopoDS_Shape> pair{ faces[begin], TopoDS_Shape{} };
+        std::vector<TopoDS_Shape> unfused;
+
+        for(size_t i = begin + 1; i < end; ++i) {
+            pair[1] = faces[i];
+            fused = try_fuse(pair, 0, 2);
+            if(fused.IsNull()) {
+                unfused.push_back(faces[i]);
+            } else {
+                pair[0] = fused;
+            }
+        }
+
+        if(unfused.empty()) {
+            return pair[0];
+        }
+
+        LOG_ERROR("Couldn't fuse {} faces, they're kept as they are and might overlap", unfused.size());
+
+        BRep_Builder builder;
+        TopoDS_Compound compound;
+        builder.MakeCompound(compound);
+        builder.Add(compound, pair[0]);
+        for(TopoDS_Shape const &face : unfused) {
+            builder.Add(compound, face);
+        }
+        return compound;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // fuse a lot of faces with a balanced tree of fuses, each level is done on
+    // all the threads so nothing ever gets fused into an ever growing shape
+
+    TopoDS_Shape fuse_faces(std::vector<TopoDS_Shape> faces)
+    {
+        int num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        while(faces.size() > 1) {
+
+            size_t num_groups = (faces.size() + fuse_group_size - 1) / fuse_group_size;
+
+            std::vector<TopoDS_Shape> fused(num_groups);
+
+            std::atomic<size_t> next_group{ 0 };
+
+            auto worker = [&]() {
+                for(size_t i = next_group++; i < num_groups; i = next_group++) {
+                    size_t begin = i * fuse_group_size;
+                    fused[i] = fuse_group(faces, begin, std::min(begin + fuse_group_size, faces.size()));
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for(int i = 0; i < std::min(num_threads, static_cast<int>(num_groups)); ++i) {
+                threads.emplace_back(worker);
+            }
+            for(auto &t : threads) {
+                t.join();
+            }
+
+            LOG_DEBUG("fused {} faces into {}", faces.size(), num_groups);
+
+            faces = std::move(fused);
+        }
+        return faces.front();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    TopoDS_Shape try_cut(TopoDS_Shape const &face, TopoDS_Shape const &tool)
+    {
+        TopTools_ListOfShape arguments;
+        TopTools_ListOfShape tools;
+        arguments.Append(face);
+        tools.Append(tool);
+
+        BRepAlgoAPI_Cut cut;
+        cut.SetArguments(arguments);
+        cut.SetTools(tools);
+        cut.SetRunParallel(true);
+        cut.Build();
+
+        if(!cut.IsDone()) {
+            dump_alerts("cut", cut.GetReport());
+            return {};
+        }
+        return unify(cut.Shape());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // if cutting the whole tool out fails, cut its faces out one at a time
+
+    TopoDS_Shape cut_face(TopoDS_Shape const &face, TopoDS_Shape const &tool)
+    {
+        TopoDS_Shape result = try_cut(face, tool);
+        if(!result.IsNull()) {
+            return result;
+        }
+
+        LOG_WARNING("Cut failed, cutting one face at a time");
+
+        result = face;
+        int failed = 0;
+        for(TopExp_Explorer explorer(tool, TopAbs_FACE); explorer.More(); explorer.Next()) {
+            TopoDS_Shape cut = try_cut(result, explorer.Current());
+            if(cut.IsNull()) {
+                failed += 1;
+            } else {
+                result = cut;
+            }
+        }
+        if(failed != 0) {
+            LOG_ERROR("Couldn't cut {} clear faces out, they're missing from the layer", failed);
         }
-        boolean_face(face_to_remove, final_face, BOPAlgo_CUT);
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    TopoDS_Wire make_wire(gerber_lib::clip_path const &path)
+    {
+        BRepBuilderAPI_MakePolygon polygon;
+        for(gerber_lib::clip_point const &p : path) {
+            gerber_2d::vec2d v = gerber_lib::mm_from_clip_point(p);
+            polygon.Add(gp_Pnt(v.x, v.y, 0));
+        }
+        polygon.Close();
+        return polygon.Wire();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // outer is counter clockwise and the holes are clockwise, which is what MakeFace wants
+
+    TopoDS_Face make_face(gerber_lib::clip_polygon const &polygon)
+    {
+        BRepBuilderAPI_MakeFace face(make_wire(polygon.outer), true);
+        for(gerber_lib::clip_path const &hole : polygon.holes) {
+            face.Add(make_wire(hole));
+        }
+        return face.Face();
     }
 
 }    // namespace
@@ -120,44 +285,65 @@ namespace gerber_3d
 
     void occ_drawer::set_gerber(gerber *g)
     {
-        g->draw(*this);
+        gerber_file = g;
 
-        // deal with the last current_face which might be dangling
+        gerber_util::gerber_timer t;
+        t.reset();
 
-        if(main_face.IsNull()) {
-            main_face = current_face;
-        } else if(!current_face.IsNull()) {
-            // add or remove it to/from main_face
-            if(previous_fill) {
-                add_face(current_face, main_face);
-            } else {
-                remove_face(current_face, main_face);
+        if(exact_arcs) {
+
+            run_dark = true;
+            g->draw_list().replay(*this);
+            LOG_DEBUG("booleans took {:7.2} seconds", t.elapsed_seconds());
+
+        } else {
+
+            // merge the whole layer into polygons first, much quicker than one boolean per shape
+
+            std::vector<clip_polygon> polygons;
+
+            if(g->flatten(polygons) != ok || polygons.empty()) {
+                return;
             }
-        }
-        if(!main_face.IsNull()) {
 
-            double const depth = 0.5;
-            // double const depth = 1.0;
+            LOG_DEBUG("flatten made {} polygons, took {:7.2} seconds", polygons.size(), t.elapsed_seconds());
 
-            gerber_util::gerber_timer t;
+            BRep_Builder builder;
+            TopoDS_Compound faces;
+            builder.MakeCompound(faces);
 
-            LOG_DEBUG("BRepPrimAPI_MakePrism begins");
-            t.reset();
-            BRepPrimAPI_MakePrism prism(main_face, gp_Vec(0, 0, depth));
-            prism.Build();
+            for(clip_polygon const &polygon : polygons) {
+                builder.Add(faces, make_face(polygon));
+            }
+            main_face = faces;
+        }
 
-            vout.add_shape(prism.Shape());
-            LOG_DEBUG("BRepPrimAPI_MakePrism complete, took {:7.2} seconds", t.elapsed_seconds());
-            gerber_file = g;
-            previous_fill = false;
-            current_fill = false;
-            current_face.Nullify();
+        if(!main_face.IsNull()) {
+            add_prism(main_face);
             main_face.Nullify();
         }
     }
 
     //////////////////////////////////////////////////////////////////////
 
+    void occ_drawer::add_prism(TopoDS_Shape const &face)
+    {
+        double const depth = 0.5;
+        // double const depth = 1.0;
+
+        gerber_util::gerber_timer t;
+
+        LOG_DEBUG("BRepPrimAPI_MakePrism begins");
+        t.reset();
+        BRepPrimAPI_MakePrism prism(face, gp_Vec(0, 0, depth));
+        prism.Build();
+
+        vout.add_shape(prism.Shape());
+        LOG_DEBUG("BRepPrimAPI_MakePrism complete, took {:7.2} seconds", t.elapsed_seconds());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     void occ_drawer::on_gerber_finished()
     {
         vout.add_shapes_to_scene();
@@ -206,35 +392,63 @@ namespace gerber_3d
         wire.Build();
         if(wire.IsDone()) {
 
-            // build up a face while the polarity is the same
+            bool dark = polarity == polarity_dark || polarity == polarity_positive;
+
+            if(dark != run_dark) {
+                flush_run();
+                run_dark = dark;
+            }
+
+            ShapeFix_Shape fixer(BRepBuilderAPI_MakeFace(wire).Face());
+            fixer.Perform();
+            run_faces.push_back(fixer.Shape());
+        }
+    }
 
-            BRepBuilderAPI_MakeFace wire_face(wire);
-            TopoDS_Face new_face = wire_face.Face();
+    //////////////////////////////////////////////////////////////////////
 
-            current_fill = polarity == polarity_dark || polarity == polarity_positive;
+    void occ_drawer::begin_polarity_run(gerber_polarity polarity, size_t num_shapes, size_t num_elements)
+    {
+        (void)num_elements;
 
-            if(current_face.IsNull()) {
-                current_face = new_face;
+        flush_run();
+        run_dark = polarity == polarity_dark || polarity == polarity_positive;
+        run_faces.reserve(num_shapes);
+    }
 
-            } else if(current_fill != previous_fill) {
+    //////////////////////////////////////////////////////////////////////
 
-                // add or remove it to/from main_face
-                if(previous_fill) {
-                    if(main_face.IsNull()) {
-                        main_face = current_face;
-                    } else {
-                        add_face(current_face, main_face);
-                    }
-                } else {
-                    remove_face(current_face, main_face);
-                }
-                // now the current face is what we just filled
-                current_face = new_face;
-            } else {
-                add_face(new_face, current_face);
+    void occ_drawer::end_polarity_run()
+    {
+        flush_run();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void occ_drawer::end_layer()
+    {
+        flush_run();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void occ_drawer::flush_run()
+    {
+        if(run_faces.empty()) {
+            return;
+        }
+
+        LOG_DEBUG("{} run of {} faces", run_dark ? "dark" : "clear", run_faces.size());
+
+        if(run_dark) {
+            if(!main_face.IsNull()) {
+                run_faces.push_back(main_face);
             }
-            previous_fill = current_fill;
+            main_face = fuse_faces(std::move(run_faces));
+        } else if(!main_face.IsNull()) {
+            main_face = cut_face(main_face, fuse_faces(std::move(run_faces)));
         }
+        run_faces.clear();
     }
 
 }    // namespace gerber_3d
@@ -199,6 +199,17 @@ namespace gerber_lib
                 }
                 return 0;
             }
+
+            //////////////////////////////////////////////////////////////////////
+            // grow to include p
+
+            void add_point(vec2d const &p)
+            {
+                min_pos.x = std::min(min_pos.x, p.x);
+                min_pos.y = std::min(min_pos.y, p.y);
+                max_pos.x = std::max(max_pos.x, p.x);
+                max_pos.y = std::max(max_pos.y, p.y);
+            }
         };
 
         //////////////////////////////////////////////////////////////////////
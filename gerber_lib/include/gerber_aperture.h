@@ -15,6 +15,9 @@ namespace gerber_lib
 
     static constexpr int max_num_aperture_parameters = 102;
 
+    // aperture macros which need a deeper stack than this don't compile
+    static constexpr int max_macro_stack_depth = 256;
+
     //////////////////////////////////////////////////////////////////////
 
     struct gerber_aperture_info
@@ -66,6 +69,16 @@ namespace gerber_lib
         }
     };
 
+    //////////////////////////////////////////////////////////////////////
+    // one step of a compiled macro, operand is an index into constants for
+    // push_value, the parameter number for push/pop_parameter or the primitive code
+
+    struct gerber_macro_op
+    {
+        gerber_opcode opcode;
+        int operand;
+    };
+
     //////////////////////////////////////////////////////////////////////
 
     struct gerber_aperture_macro
@@ -73,14 +86,27 @@ namespace gerber_lib
         std::vector<gerber_instruction> instructions;
         std::string name;
 
+        // instructions compiled: brackets and unary plus gone, arithmetic on constants already
+        // done and the stack depth checked so each AD can run it on a fixed size stack
+
+        std::vector<gerber_macro_op> code;
+        std::vector<double> constants;
+        int max_stack_depth{};
+        int num_parameters{};
+
+        // what compile() said, any AD which uses the macro fails with this
+        gerber_error_code compile_error{ ok };
+
         std::string to_string() const
         {
-            return std::format("APERTURE_MACRO: NAME: {}, INSTRUCTIONS: {}", name, instructions.size());
+            return std::format("APERTURE_MACRO: NAME: {}, INSTRUCTIONS: {}, CODE: {}", name, instructions.size(), code.size());
         }
 
         gerber_aperture_macro() = default;
 
         gerber_error_code parse_aperture_macro(gerber_reader &reader);
+
+        gerber_error_code compile();
     };
 
 
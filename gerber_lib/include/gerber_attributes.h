@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // every distinct attribute name and value is stored once in here, the
+    // pointers stay valid until the pool goes away. The parse chunks share
+    // one pool so it's got a lock, but it's only used when %TO/%TD change things
+
+    struct gerber_string_pool
+    {
+        std::mutex mutex;
+        std::unordered_set<std::string> strings;
+
+        std::string const *intern(std::string const &s);
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_attribute
+    {
+        std::string const *name;
+        std::string const *value;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // a snapshot of the attribute dictionary, never changes once it's made.
+    // All the entities between two %TO/%TD commands share the same one
+
+    struct gerber_attributes
+    {
+        std::vector<gerber_attribute> items;    // sorted by name
+
+        size_t size() const
+        {
+            return items.size();
+        }
+
+        auto begin() const
+        {
+            return items.begin();
+        }
+
+        auto end() const
+        {
+            return items.end();
+        }
+
+        // nullptr if it's not there
+        std::string const *find(std::string const &name) const;
+    };
+
+    using gerber_attribute_set = std::shared_ptr<gerber_attributes const>;
+
+    // nullptr if the dictionary is empty
+    gerber_attribute_set make_attribute_set(gerber_string_pool &pool, std::map<std::string, std::string> const &dictionary);
+
+}    // namespace gerber_lib
@@ -0,0 +1,23 @@
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // bump cache_version whenever anything which gets saved in the cache changes
+
+    static constexpr uint32_t cache_magic = 0x43524247;    // 'GBRC'
+    static constexpr uint32_t cache_version = 4;
+
+    // xxhash64 of the file contents, the cache file is named after this
+
+    uint64_t content_hash(std::span<char const> data);
+
+    std::string cache_file_path(char const *cache_folder, uint64_t hash);
+
+}    // namespace gerber_lib
@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////
+// 2D polygon booleans on integer coordinates
+//
+// Paths are closed (the last point joins the first) and filled with the
+// non-zero or even-odd rule. All the edges are split where they cross or touch, then one
+// sweep across them works out the winding numbers on each side of every edge
+// and keeps the ones which separate inside from outside. Those get joined up
+// into rings and the holes are matched up with the outlines they're in.
+//
+// Coordinates must be within +/- clip_max_coordinate (2^60), clip_polygons fails
+// with anything bigger. Testing for edges going through a point doubles the
+// coordinates and then takes differences of them in 64 bits, which needs 3 bits
+// of headroom, and cross products of those differences are done in 128 bits.
+// Gerber coordinates are nanometres so that's plenty.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "gerber_2d.h"
+#include "gerber_draw.h"
+#include "gerber_error.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct clip_point
+    {
+        int64_t x;
+        int64_t y;
+
+        bool operator==(clip_point const &) const = default;
+    };
+
+    using clip_path = std::vector<clip_point>;
+
+    //////////////////////////////////////////////////////////////////////
+    // outer is counter clockwise, holes are clockwise
+
+    struct clip_polygon
+    {
+        clip_path outer;
+        std::vector<clip_path> holes;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    enum clip_operation
+    {
+        clip_union,
+        clip_intersection,
+        clip_difference,    // subject minus clip
+        clip_xor
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    enum clip_fill_rule
+    {
+        clip_non_zero,
+        clip_even_odd
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    static constexpr double clip_units_per_millimetre = 1000000.0;
+
+    static constexpr int64_t clip_max_coordinate = int64_t{ 1 } << 60;
+
+    inline clip_point clip_point_from_mm(gerber_2d::vec2d const &p)
+    {
+        return { llround(p.x * clip_units_per_millimetre), llround(p.y * clip_units_per_millimetre) };
+    }
+
+    inline gerber_2d::vec2d mm_from_clip_point(clip_point const &p)
+    {
+        return { static_cast<double>(p.x) / clip_units_per_millimetre, static_cast<double>(p.y) / clip_units_per_millimetre };
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    // error_clipping_failed if the crossings couldn't be sorted out, polygons is empty then
+
+    gerber_error_code clip_polygons(std::vector<clip_path> const &subject, std::vector<clip_path> const &clip, clip_operation operation, clip_fill_rule fill_rule,
+                                    std::vector<clip_polygon> &polygons);
+
+    // the outers and holes of some polygons as paths, so they can go back into clip_polygons
+    void append_polygon_paths(std::vector<clip_polygon> const &polygons, std::vector<clip_path> &paths);
+
+    // twice the signed area, positive means counter clockwise
+    double clip_path_area2(clip_path const &path);
+
+    // how many times the path goes round, +1 for a simple counter clockwise path
+    int clip_path_turns(clip_path const &path);
+
+    // the closed path which the elements of one filled shape make (any gaps get joined up), arcs
+    // get turned into lines which are never more than tolerance (mm) away from the real arc
+    void clip_path_from_elements(gerber_draw_element const *elements, size_t num_elements, double tolerance, clip_path &path);
+
+}    // namespace gerber_lib
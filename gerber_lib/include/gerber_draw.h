@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "gerber_2d.h"
 #include "gerber_enums.h"
 
@@ -83,6 +85,26 @@ namespace gerber_lib
         }
     };
 
+    //////////////////////////////////////////////////////////////////////
+    // one filled shape in a batch, its elements are [first_element, first_element + num_elements)
+
+    struct gerber_draw_shape
+    {
+        uint32_t first_element;
+        uint32_t num_elements;
+        gerber_polarity polarity;
+        int entity_id;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // where an aperture is flashed
+
+    struct gerber_flash
+    {
+        vec2d pos;
+        int entity_id;
+    };
+
     //////////////////////////////////////////////////////////////////////
 
     struct gerber_draw_interface
@@ -92,6 +114,100 @@ namespace gerber_lib
         // draw a filled shape of lines/arcs
         virtual void fill_elements(gerber_draw_element const *elements, size_t num_elements, gerber_polarity polarity, int entity_id) = 0;
 
+        //////////////////////////////////////////////////////////////////////
+        // Optional batch interface, gerber_draw_list::replay() uses it. A layer is
+        // a sequence of polarity runs, each run is a span of shapes which all have
+        // the same polarity. The counts are there so a drawer can allocate up front.
+        // The defaults do nothing except fill_shapes which calls fill_elements for
+        // each shape, so a drawer which only does fill_elements still works
+
+        virtual void begin_layer(size_t num_shapes, size_t num_elements)
+        {
+            (void)num_shapes;
+            (void)num_elements;
+        }
+
+        virtual void begin_polarity_run(gerber_polarity polarity, size_t num_shapes, size_t num_elements)
+        {
+            (void)polarity;
+            (void)num_shapes;
+            (void)num_elements;
+        }
+
+        // shapes[n].first_element is an index into elements
+        virtual void fill_shapes(gerber_draw_element const *elements, gerber_draw_shape const *shapes, size_t num_shapes)
+        {
+            for(size_t i = 0; i < num_shapes; ++i) {
+                gerber_draw_shape const &shape = shapes[i];
+                fill_elements(elements + shape.first_element, shape.num_elements, shape.polarity, shape.entity_id);
+            }
+        }
+
+        virtual void end_polarity_run()
+        {
+        }
+
+        virtual void end_layer()
+        {
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // Optional step and repeat interface. The shapes between begin_repeat and
+        // end_repeat are one copy of a block which gets drawn at each offset in turn
+        // (the first offset is always 0,0). A drawer which returns true from
+        // draws_repeats gets the block once with the offsets, otherwise the block's
+        // shapes come again, moved, for each copy. Repeats never start or end in
+        // the middle of a polarity run
+
+        virtual bool draws_repeats() const
+        {
+            return false;
+        }
+
+        virtual void begin_repeat(vec2d const *offsets, size_t num_offsets)
+        {
+            (void)offsets;
+            (void)num_offsets;
+        }
+
+        virtual void end_repeat()
+        {
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // Optional flash interface. The shapes of each aperture are made once, at
+        // 0,0, and a drawer which returns true from draws_flashes gets them from
+        // define_aperture before the first flash_aperture for it (maybe again
+        // later, with the same shapes). flash_aperture is some flashes of one
+        // aperture with the same polarity, a dark shape in the aperture gets that
+        // polarity and a clear one the opposite (apertures are all dark shapes,
+        // clear macro primitives get cut out of them). Otherwise the drawer gets the
+        // shapes again, moved, for each flash. Flashes are never in the middle of
+        // a polarity run and never between begin_repeat and end_repeat
+
+        virtual bool draws_flashes() const
+        {
+            return false;
+        }
+
+        virtual void define_aperture(int aperture_id, gerber_draw_element const *elements, gerber_draw_shape const *shapes, size_t num_shapes)
+        {
+            (void)aperture_id;
+            (void)elements;
+            (void)shapes;
+            (void)num_shapes;
+        }
+
+        virtual void flash_aperture(int aperture_id, gerber_polarity polarity, gerber_flash const *flashes, size_t num_flashes)
+        {
+            (void)aperture_id;
+            (void)polarity;
+            (void)flashes;
+            (void)num_flashes;
+        }
+
+        virtual ~gerber_draw_interface() = default;
+
         bool show_progress{ false };
     };
 
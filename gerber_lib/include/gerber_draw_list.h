@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "gerber_draw.h"
+#include "gerber_enums.h"
+#include "gerber_error.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // consecutive shapes with the same polarity
+
+    struct gerber_polarity_run
+    {
+        uint32_t first_shape;
+        uint32_t num_shapes;
+        size_t num_elements;
+        gerber_polarity polarity;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // a step and repeat block, its shapes are drawn at each of its offsets
+
+    struct gerber_repeat
+    {
+        uint32_t first_shape;
+        uint32_t num_shapes;
+        uint32_t first_offset;
+        uint32_t num_offsets;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // some flashes of an aperture, they come just before shape before_shape
+
+    struct gerber_flash_run
+    {
+        uint32_t before_shape;
+        int aperture_id;
+        gerber_polarity polarity;
+        uint32_t first_flash;
+        uint32_t num_flashes;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // the shapes of an aperture at 0,0, in aperture_shapes
+
+    struct gerber_aperture_shapes
+    {
+        int aperture_id;
+        uint32_t first_shape;
+        uint32_t num_shapes;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // A recording of everything gerber::draw() sends to a drawer. Once it's
+    // been made it doesn't change, replay() sends it all to another drawer
+    // through the batch interface without doing any of the geometry again.
+    // Step and repeat blocks are kept as one copy and a list of offsets,
+    // flashes as where they are and one copy of each aperture's shapes
+
+    struct gerber_draw_list : gerber_draw_interface
+    {
+        std::vector<gerber_draw_element> elements;
+        std::vector<gerber_draw_shape> shapes;
+        std::vector<gerber_polarity_run> runs;
+        std::vector<gerber_repeat> repeats;
+        std::vector<vec2d> repeat_offsets;
+        std::vector<gerber_flash> flashes;
+        std::vector<gerber_flash_run> flash_runs;
+        std::vector<gerber_draw_element> aperture_elements;
+        std::vector<gerber_draw_shape> aperture_shapes;
+        std::vector<gerber_aperture_shapes> apertures;
+
+        // what draw() returned when this was recorded
+        gerber_error_code error{ ok };
+
+        void set_gerber(gerber *g) override;
+        void fill_elements(gerber_draw_element const *draw_elements, size_t num_elements, gerber_polarity polarity, int entity_id) override;
+
+        bool draws_repeats() const override;
+        void begin_repeat(vec2d const *offsets, size_t num_offsets) override;
+        void end_repeat() override;
+
+        bool draws_flashes() const override;
+        void define_aperture(int aperture_id, gerber_draw_element const *draw_elements, gerber_draw_shape const *draw_shapes, size_t num_shapes) override;
+        void flash_aperture(int aperture_id, gerber_polarity polarity, gerber_flash const *draw_flashes, size_t num_flashes) override;
+
+        gerber_aperture_shapes const *find_aperture(int aperture_id) const;
+
+        // call this once it's all been recorded, runs are split where repeats start and end and where there are flashes
+        void find_polarity_runs();
+
+        gerber_error_code replay(gerber_draw_interface &drawer) const;
+
+        // what draw() would have sent, one fill_elements per shape (and per copy and flash if the drawer doesn't draw those)
+        void send_shapes(gerber_draw_interface &drawer) const;
+
+        // the same but apertures which are already in defined_apertures (indexed by aperture id) don't get defined again
+        void send_shapes(gerber_draw_interface &drawer, std::vector<bool> &defined_apertures) const;
+
+        // for a list which is the shapes of an aperture at 0,0, send them to a drawer as one flash of it
+        void send_flash(gerber_draw_interface &drawer, gerber_flash const &flash, gerber_polarity polarity) const;
+
+        void clear();
+
+        size_t bytes_used() const;
+    };
+
+}    // namespace gerber_lib
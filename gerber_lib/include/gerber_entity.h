@@ -6,24 +6,28 @@
 // arc
 // flashed aperture
 
+#include "gerber_attributes.h"
+
 namespace gerber_lib
 {
     struct gerber_net;
 
     struct gerber_entity
     {
-        int line_number_begin;
-        int line_number_end;
+        // source range in the file is [offset_begin, offset_end), use gerber_reader::line_number_at to get line numbers
+
+        size_t offset_begin;
+        size_t offset_end;
         size_t net_index;
-        std::map<std::string, std::string> attributes;
+        gerber_attribute_set attributes;    // nullptr if there weren't any
 
-        gerber_entity(int begin, int end, size_t net_id) : line_number_begin(begin), line_number_end(end), net_index(net_id)
+        gerber_entity(size_t begin, size_t end, size_t net_id) : offset_begin(begin), offset_end(end), net_index(net_id)
         {
         }
 
         std::string to_string() const
         {
-            return std::format("NET INDEX {}, LINE BEGIN {}, LINE END {}", net_index, line_number_begin, line_number_end);
+            return std::format("NET INDEX {}, OFFSET BEGIN {}, OFFSET END {}", net_index, offset_begin, offset_end);
         }
     };
 
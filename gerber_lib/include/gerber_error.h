@@ -106,12 +106,13 @@ namespace gerber_lib
         gerber_error_code error_code{};
         std::string message{};
         std::string filename{};
+        size_t file_offset{};
         int line_number{};
 
         gerber_error() = default;
 
-        gerber_error(gerber_error_code code, std::string const &msg, std::string const &file, int line)
-            : error_code(code), message(msg), filename(file), line_number(line)
+        gerber_error(gerber_error_code code, std::string const &msg, std::string const &file, size_t offset, int line)
+            : error_code(code), message(msg), filename(file), file_offset(offset), line_number(line)
         {
         }
     };
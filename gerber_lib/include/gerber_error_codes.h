@@ -59,4 +59,6 @@
     GERBER_ERROR_CODE(empty_file)                   \
     GERBER_ERROR_CODE(bad_file_offset)              \
     GERBER_ERROR_CODE(file_not_found)               \
-    GERBER_ERROR_CODE(missing_attribute)
+    GERBER_ERROR_CODE(missing_attribute)            \
+    GERBER_ERROR_CODE(invalid_cache_file)           \
+    GERBER_ERROR_CODE(clipping_failed)
@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////////////////
+// A drawer which merges everything into polygons with holes. Each shape is
+// filled with the even-odd rule (like the gdi drawer), then every dark run gets
+// added to what's there so far and every clear run gets taken away from it
+
+#pragma once
+
+#include <vector>
+
+#include "gerber_draw.h"
+#include "gerber_clipper.h"
+#include "gerber_error.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_flattener : gerber_draw_interface
+    {
+        // the result so far
+        std::vector<clip_polygon> polygons;
+
+        // how far (mm) flattened arcs can be from the real thing
+        double arc_tolerance{ 0.001 };
+
+        // the first thing that went wrong, if anything did polygons are incomplete
+        gerber_error_code error{ ok };
+
+        void set_gerber(gerber *g) override;
+        void fill_elements(gerber_draw_element const *elements, size_t num_elements, gerber_polarity polarity, int entity_id) override;
+
+        void begin_polarity_run(gerber_polarity polarity, size_t num_shapes, size_t num_elements) override;
+        void end_polarity_run() override;
+        void end_layer() override;
+
+        // merge the current run into polygons
+        void flush();
+
+        void set_error(gerber_error_code code);
+
+        std::vector<clip_path> run_paths;
+        bool run_dark{ true };
+
+        clip_path shape_path;
+        std::vector<clip_path> shape_paths;
+        std::vector<clip_polygon> shape_polygons;
+    };
+
+}    // namespace gerber_lib
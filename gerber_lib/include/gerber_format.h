@@ -2,10 +2,66 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "gerber_enums.h"
 
 namespace gerber_lib
 {
+    //////////////////////////////////////////////////////////////////////
+    // Turns the digits of a coordinate word into integer nanometres
+    // Everything which depends on the format is worked out once when
+    // the %FS is parsed so decode() is just integer multiply/divide
+
+    struct gerber_coordinate_decoder
+    {
+        static constexpr double nanometres_per_millimetre = 1000000.0;
+
+        enum
+        {
+            axis_x = 0,
+            axis_y = 1
+        };
+
+        // [axis] = integral + decimal digits, for putting back omitted trailing zeros
+        int total_digits[2]{};
+
+        // [axis][unit_inch, unit_millimeter]
+        int64_t multiplier[2][2]{};
+        int64_t divisor[2][2]{};
+
+        bool pad_trailing_zeros{ false };
+
+        gerber_coordinate_decoder();
+
+        void setup(int integral_part_x, int decimal_part_x, int integral_part_y, int decimal_part_y, gerber_omit_zeros omit_zeros);
+
+        int64_t decode(int64_t value, size_t num_digits, int axis, gerber_unit unit) const
+        {
+            if(pad_trailing_zeros) {
+                int omitted = total_digits[axis] - static_cast<int>(num_digits);
+                if(omitted > 0) {
+                    value *= power_of_ten(omitted);
+                }
+            }
+            int u = unit == unit_millimeter ? 1 : 0;
+            value *= multiplier[axis][u];
+            int64_t d = divisor[axis][u];
+            if(d == 1) {
+                return value;
+            }
+            // round half away from zero, same as round()
+            if(value < 0) {
+                return -((-value + d / 2) / d);
+            }
+            return (value + d / 2) / d;
+        }
+
+        static int64_t power_of_ten(int n);
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
     struct gerber_format
     {
         gerber_omit_zeros omit_zeros{ omit_zeros_leading };
@@ -19,7 +75,9 @@ namespace gerber_lib
         int plot_function_limit{};
         int misc_function_limit{};
 
+        gerber_coordinate_decoder decoder;
+
         gerber_format() = default;
     };
 
-}    // namespace gerber_lib
\ No newline at end of file
+}    // namespace gerber_lib
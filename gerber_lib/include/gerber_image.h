@@ -10,14 +10,15 @@
 #include "gerber_enums.h"
 #include "gerber_stats.h"
 #include "gerber_format.h"
+#include "gerber_net.h"
+#include "gerber_level.h"
+#include "gerber_pool.h"
+#include "gerber_net_store.h"
 
 namespace gerber_lib
 {
     struct gerber_aperture;
     struct gerber_aperture_macro;
-    struct gerber_net;
-    struct gerber_level;
-    struct gerber_net_state;
 
     //////////////////////////////////////////////////////////////////////
 
@@ -41,6 +42,51 @@ namespace gerber_lib
         gerber_image_info() = default;
     };
 
+    //////////////////////////////////////////////////////////////////////
+    // apertures indexed by d-code so looking one up is just an index,
+    // the table only grows as far as the highest d-code defined
+
+    struct gerber_aperture_table
+    {
+        std::vector<gerber_aperture *> table;
+        size_t count{};
+
+        gerber_aperture *find(int number) const
+        {
+            if(number < 0 || static_cast<size_t>(number) >= table.size()) {
+                return nullptr;
+            }
+            return table[number];
+        }
+
+        // returns whatever was there before (nullptr if nothing)
+        gerber_aperture *set(int number, gerber_aperture *aperture)
+        {
+            if(static_cast<size_t>(number) >= table.size()) {
+                table.resize(number + 1, nullptr);
+            }
+            gerber_aperture *old = table[number];
+            table[number] = aperture;
+            if(old == nullptr && aperture != nullptr) {
+                count += 1;
+            } else if(old != nullptr && aperture == nullptr) {
+                count -= 1;
+            }
+            return old;
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        void clear()
+        {
+            table.clear();
+            count = 0;
+        }
+    };
+
     //////////////////////////////////////////////////////////////////////
 
     struct gerber;
@@ -56,12 +102,20 @@ namespace gerber_lib
         gerber_file_type file_type{ file_type_rs274x };
         gerber_stats stats{};
         gerber_format format;
-        std::map<int, gerber_aperture *> apertures;
+        gerber_aperture_table apertures;
         std::vector<gerber_aperture_macro *> aperture_macros;
         std::vector<gerber_net *> nets;
         std::vector<gerber_level *> levels;
         std::vector<gerber_net_state *> net_states;
 
+        // nets, levels and net_states all live in these, the vectors above just point into them
+        gerber_pool<gerber_net> net_pool;
+        gerber_pool<gerber_level> level_pool;
+        gerber_pool<gerber_net_state> net_state_pool;
+
+        // once parsing is done, the nets get moved in here and nets/net_pool are emptied
+        gerber_net_store net_store;
+
         gerber_image_info info;
         gerber *gerber;
 
@@ -69,6 +123,8 @@ namespace gerber_lib
 
         void cleanup();
 
+        void compact_nets();
+
         ~gerber_image();
     };
 
@@ -35,12 +35,26 @@ namespace gerber_lib
 
     struct gerber_step_and_repeat
     {
+        // set on the level an SR command makes, not on the ones an LP etc makes inside the block
+        bool first_instance{ false };
         gerber_2d::vec2d pos{ 1, 1 };
         gerber_2d::vec2d distance{ 0, 0 };
 
         std::string to_string() const
         {
-            return std::format("STEP_AND_REPEAT: POS: {}, DISTANCE: {}", pos.to_string(), distance.to_string());
+            return std::format("STEP_AND_REPEAT: FIRST_INSTANCE: {}, POS: {}, DISTANCE: {}", first_instance, pos.to_string(), distance.to_string());
+        }
+
+        size_t num_copies() const
+        {
+            return static_cast<size_t>(pos.x) * static_cast<size_t>(pos.y);
+        }
+
+        // copies go along each row then up
+        gerber_2d::vec2d copy_offset(size_t index) const
+        {
+            size_t across = static_cast<size_t>(pos.x);
+            return { static_cast<double>(index % across) * distance.x, static_cast<double>(index / across) * distance.y };
         }
 
         gerber_step_and_repeat() = default;
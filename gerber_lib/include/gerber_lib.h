@@ -11,6 +11,9 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+
 #include "gerber_error.h"
 #include "gerber_stats.h"
 #include "gerber_image.h"
@@ -19,12 +22,25 @@
 #include "gerber_entity.h"
 #include "gerber_reader.h"
 #include "gerber_draw.h"
+#include "gerber_draw_list.h"
+#include "gerber_clipper.h"
 #include "gerber_arc.h"
 
 namespace gerber_lib
 {
     struct gerber_net;
     struct gerber_macro_parameters;
+    struct gerber_parse_chunk;
+
+    //////////////////////////////////////////////////////////////////////
+    // nets [first_net, end_net) are a step and repeat block
+
+    struct gerber_repeat_block
+    {
+        size_t first_net;
+        size_t end_net;
+        gerber_step_and_repeat const *step_and_repeat;
+    };
 
     //////////////////////////////////////////////////////////////////////
 
@@ -41,14 +57,34 @@ namespace gerber_lib
 
         gerber_2d::matrix aperture_matrix;
 
+        // aperture_matrix only depends on these, keep the last one and only
+        // build a new one (with all the trig) when one of them changes
+
+        struct aperture_transform_inputs
+        {
+            double offset_a{};
+            double offset_b{};
+            double image_rotation{};
+            double scale_x{};
+            double scale_y{};
+            double offset_x{};
+            double offset_y{};
+            gerber_mirror_state mirror_state{ mirror_state_none };
+            gerber_axis_select axis_select{ axis_select_none };
+
+            bool operator==(aperture_transform_inputs const &) const = default;
+        };
+
+        aperture_transform_inputs aperture_transform_key{};
+        gerber_2d::matrix aperture_transform{};
+        bool aperture_transform_valid{ false };
+
         bool knockout_measure{ false };
         gerber_2d::vec2d knockout_limit_min{};
         gerber_2d::vec2d knockout_limit_max{};
 
         gerber_level knockout_level{};
 
-        int accuracy_decimal_places{ 6 };
-
         int current_net_id{};
 
         gerber_stats stats{};
@@ -58,9 +94,16 @@ namespace gerber_lib
 
         std::map<std::string, std::string> dictionary;
 
+        // the entities share snapshots of the dictionary, a new one is made when %TO/%TD change it
+        std::shared_ptr<gerber_string_pool> string_pool{ std::make_shared<gerber_string_pool>() };
+        gerber_attribute_set attributes;
+        bool attributes_changed{ false };
+
         std::vector<gerber_entity> entities;
 
-        gerber_entity &add_entity();
+        gerber_entity &add_entity(size_t source_offset);
+
+        gerber_attribute_set const &current_attributes();
 
         bool is_gerber_274d(std::string file_path)
         {
@@ -78,21 +121,72 @@ namespace gerber_lib
         void update_net_bounds(gerber_2d::rect &bounds, double x, double y, double w, double h) const;
         void update_image_bounds(gerber_2d::rect &bounds, double repeat_offset_x, double repeat_offset_y, gerber_image &cur_image);
 
+        gerber_2d::matrix const &get_aperture_transform();
+
         gerber_error_code get_aperture_points(gerber_macro_parameters const &macro, gerber_net *net, std::vector<gerber_2d::vec2d> &points);
 
         gerber_error_code parse_file(char const *file_path);
 
+        // same result as parse_file but splits the file up and parses the pieces on multiple threads
+        // num_threads = 0 means use all the cores, chunk_size = 0 means work it out from the file size
+
+        gerber_error_code parse_file_parallel(char const *file_path, int num_threads = 0, size_t chunk_size = 0);
+
+        // load it from cache_folder if it's been parsed before, otherwise parse it and save it there
+
+        gerber_error_code parse_file_cached(char const *file_path, char const *cache_folder, int num_threads = 0);
+
+        gerber_error_code save_cache(char const *cache_path, uint64_t hash) const;
+        gerber_error_code load_cache(std::span<char const> cache_data, uint64_t hash);
+
         gerber_error_code draw(gerber_draw_interface &drawer) const;
-        gerber_error_code fill_region_path(gerber_draw_interface &drawer, size_t net_index, gerber_polarity polarity) const;
+        gerber_error_code draw_nets(gerber_draw_interface &drawer, size_t begin_net, size_t end_net) const;
+        gerber_error_code draw_net_range(gerber_draw_interface &drawer, size_t begin_net, size_t end_net, bool use_flashes) const;
+
+        void find_repeat_blocks(size_t begin_net, size_t end_net, std::vector<gerber_repeat_block> &blocks) const;
+
+        // same output as draw(), in the same order, but the outlines are made on multiple threads
+        // num_threads = 0 means use all the cores
+
+        gerber_error_code draw_parallel(gerber_draw_interface &drawer, int num_threads = 0) const;
+
+        // draw() recorded the first time it's asked for, then kept until cleanup()
+        // so drawing it again is just draw_list().replay(drawer)
+
+        gerber_draw_list const &draw_list() const;
+
+        // the whole layer merged into polygons with holes, clear polarity already taken out
+
+        gerber_error_code flatten(std::vector<clip_polygon> &polygons, double arc_tolerance = 0.001) const;
+
+        mutable std::unique_ptr<gerber_draw_list> recorded_draw_list;
+        mutable std::mutex draw_list_mutex;
 
-        gerber_error_code draw_linear_interpolation(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *aperture) const;
-        gerber_error_code draw_linear_circle(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *aperture) const;
-        gerber_error_code draw_linear_rectangle(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *aperture) const;
-        gerber_error_code draw_macro(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *const macro_aperture) const;
-        gerber_error_code draw_capsule(gerber_draw_interface &drawer, gerber_net *net, double width, double height) const;
-        gerber_error_code draw_arc(gerber_draw_interface &drawer, gerber_net *net, double thickness) const;
-        gerber_error_code draw_circle(gerber_draw_interface &drawer, gerber_net *net, vec2d const &pos, double radius) const;
-        gerber_error_code draw_rectangle(gerber_draw_interface &drawer, gerber_net *net, rect const &r) const;
+        // the shapes of each aperture at 0,0 (indexed by aperture number), made
+        // the first time anything is drawn and kept until cleanup(). A flash is
+        // those shapes moved, so they're only worked out once per aperture
+
+        std::vector<gerber_draw_list> const &flash_shapes() const;
+
+        mutable std::unique_ptr<std::vector<gerber_draw_list>> aperture_flash_shapes;
+        mutable std::mutex flash_shapes_mutex;
+
+        gerber_error_code draw_aperture(gerber_draw_interface &drawer, gerber_aperture *aperture) const;
+        gerber_error_code fill_region_path(gerber_draw_interface &drawer, gerber_region const &region, gerber_polarity polarity) const;
+
+        gerber_error_code draw_linear_interpolation(gerber_draw_interface &drawer, size_t net_index, gerber_aperture *aperture) const;
+        gerber_error_code draw_linear_circle(gerber_draw_interface &drawer, size_t net_index, gerber_aperture *aperture) const;
+        gerber_error_code draw_linear_rectangle(gerber_draw_interface &drawer, size_t net_index, gerber_aperture *aperture) const;
+        gerber_error_code draw_macro(gerber_draw_interface &drawer, gerber_aperture *const macro_aperture) const;
+        gerber_error_code draw_capsule(gerber_draw_interface &drawer, double width, double height) const;
+        gerber_error_code draw_arc(gerber_draw_interface &drawer, size_t net_index, double thickness) const;
+        gerber_error_code draw_circle(gerber_draw_interface &drawer, size_t net_index, vec2d const &pos, double radius) const;
+        gerber_error_code draw_rectangle(gerber_draw_interface &drawer, rect const &r) const;
+
+        gerber_polarity net_polarity(size_t net_index) const
+        {
+            return image.levels[image.net_store.level[net_index]]->polarity;
+        }
 
         gerber_error_code fill_polygon(gerber_draw_interface &drawer, double diameter, int num_sides, double angle_degrees) const;
 
@@ -102,9 +196,14 @@ namespace gerber_lib
         gerber_error_code parse_d_code();
         gerber_error_code parse_tf_code();
         bool parse_m_code();
+        gerber_error_code parse_coordinate(char axis);
 
         gerber_error_code parse_rs274x(gerber_net *net);
 
+        gerber_error_code prescan_chunks(std::vector<gerber_parse_chunk> &chunks, size_t chunk_size);
+        gerber_error_code parse_chunk(gerber const &source, gerber_parse_chunk &chunk);
+        void stitch_chunk(gerber &worker);
+
         gerber_error_code parse_aperture_definition(gerber_aperture *aperture, gerber_image *cur_image, double unit_scale);
 
         void update_knockout_measurements();
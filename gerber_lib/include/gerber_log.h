@@ -2,10 +2,22 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <string>
 #include <format>
 
+//////////////////////////////////////////////////////////////////////
+// define GERBER_LOG_MIN_LEVEL as one of the levels to choose what gets compiled in
+
+#if !defined(GERBER_LOG_MIN_LEVEL)
+#if defined(NDEBUG)
+#define GERBER_LOG_MIN_LEVEL log_level_info
+#else
+#define GERBER_LOG_MIN_LEVEL log_level_debug
+#endif
+#endif
+
 namespace gerber_lib
 {
     //////////////////////////////////////////////////////////////////////
@@ -22,11 +34,27 @@ namespace gerber_lib
     };
 
     //////////////////////////////////////////////////////////////////////
+    // anything below this is compiled out, the arguments aren't even evaluated
+
+    constexpr gerber_log_level log_min_level = GERBER_LOG_MIN_LEVEL;
+
+    //////////////////////////////////////////////////////////////////////
+    // each context remembers the larger of its own level and the global one
+    // so whether to log is a single compare. Contexts add themselves to a
+    // list when they're constructed so changing either level can update them
 
     struct gerber_log_context
     {
+        gerber_log_context(char const *name, gerber_log_level level);
+
+        gerber_log_context(gerber_log_context const &) = delete;
+        gerber_log_context &operator=(gerber_log_context const &) = delete;
+
         char const *context;
         gerber_log_level max_level;
+        // worker threads read it while the levels are being changed
+        std::atomic<gerber_log_level> threshold;
+        gerber_log_context *next;
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -39,10 +67,13 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    inline void log_set_level(gerber_log_level level)
-    {
-        log_level = level;
-    }
+    void log_set_level(gerber_log_level level);
+
+    //////////////////////////////////////////////////////////////////////
+    // change the level of every context with this name, including ones inside
+    // functions which haven't been called yet
+
+    void log_set_context_level(char const *context, gerber_log_level level);
 
     //////////////////////////////////////////////////////////////////////
 
@@ -57,26 +88,39 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    template <typename... args> constexpr void log(gerber_log_level level, gerber_log_context const &context, char const *fmt, args &&...arguments)
+    inline bool log_enabled(gerber_log_level level, gerber_log_context const &context)
+    {
+        return level >= context.threshold.load(std::memory_order_relaxed);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the LOG_ macros only get here if log_enabled() said yes
+
+    template <typename... args> void log(gerber_log_level level, gerber_log_context const &context, char const *fmt, args &&...arguments)
     {
-        if(level >= log_level && level >= context.max_level) {
-            gerber_log(level, context.context, fmt, std::make_format_args(arguments...));
-        }
+        gerber_log(level, context.context, fmt, std::make_format_args(arguments...));
     }
 
 }    // namespace gerber_lib
 
 //////////////////////////////////////////////////////////////////////
 
-#define LOG_CONTEXT(context, max_level)                              \
-    static ::gerber_lib::gerber_log_context __log_context            \
-    {                                                                \
-        context, gerber_lib::gerber_log_level::log_level_##max_level \
-    }
-
-#define LOG_DEBUG(msg, ...) ::gerber_lib::log(::gerber_lib::log_level_debug, __log_context, msg, ##__VA_ARGS__)
-#define LOG_VERBOSE(msg, ...) ::gerber_lib::log(::gerber_lib::log_level_verbose, __log_context, msg, ##__VA_ARGS__)
-#define LOG_INFO(msg, ...) ::gerber_lib::log(::gerber_lib::log_level_info, __log_context, msg, ##__VA_ARGS__)
-#define LOG_WARNING(msg, ...) ::gerber_lib::log(::gerber_lib::log_level_warning, __log_context, msg, ##__VA_ARGS__)
-#define LOG_ERROR(msg, ...) ::gerber_lib::log(::gerber_lib::log_level_error, __log_context, msg, ##__VA_ARGS__)
-#define LOG_FATAL(msg, ...) ::gerber_lib::log(::gerber_lib::log_level_fatal, __log_context, msg, ##__VA_ARGS__)
+#define LOG_CONTEXT(context, max_level) static ::gerber_lib::gerber_log_context __log_context(context, ::gerber_lib::gerber_log_level::log_level_##max_level)
+
+// the arguments are only evaluated if the level is compiled in and enabled for the context
+
+#define GERBER_LOG(level, msg, ...)                                                     \
+    do {                                                                                \
+        if constexpr(level >= ::gerber_lib::log_min_level) {                            \
+            if(::gerber_lib::log_enabled(level, __log_context)) {                       \
+                ::gerber_lib::log(level, __log_context, msg, ##__VA_ARGS__);            \
+            }                                                                           \
+        }                                                                               \
+    } while(0)
+
+#define LOG_DEBUG(msg, ...) GERBER_LOG(::gerber_lib::log_level_debug, msg, ##__VA_ARGS__)
+#define LOG_VERBOSE(msg, ...) GERBER_LOG(::gerber_lib::log_level_verbose, msg, ##__VA_ARGS__)
+#define LOG_INFO(msg, ...) GERBER_LOG(::gerber_lib::log_level_info, msg, ##__VA_ARGS__)
+#define LOG_WARNING(msg, ...) GERBER_LOG(::gerber_lib::log_level_warning, msg, ##__VA_ARGS__)
+#define LOG_ERROR(msg, ...) GERBER_LOG(::gerber_lib::log_level_error, msg, ##__VA_ARGS__)
+#define LOG_FATAL(msg, ...) GERBER_LOG(::gerber_lib::log_level_fatal, msg, ##__VA_ARGS__)
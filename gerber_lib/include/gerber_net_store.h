@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gerber_2d.h"
+#include "gerber_arc.h"
+#include "gerber_draw.h"
+#include "gerber_enums.h"
+
+namespace gerber_lib
+{
+    struct gerber_net;
+
+    //////////////////////////////////////////////////////////////////////
+    // A region (G36..G37) and where its outline lives in region_elements
+
+    struct gerber_region
+    {
+        static constexpr size_t no_net = SIZE_MAX;
+
+        size_t first_net{};    // the region_start net
+        size_t last_net{};     // the region_end net, or size() if it never ended
+        size_t first_element{};
+        size_t num_elements{};
+        size_t num_contours{};
+        size_t bad_net{ no_net };    // a net which can't be part of an outline, draw() complains about it
+        gerber_2d::rect bounds{ DBL_MAX, DBL_MAX, -DBL_MAX, -DBL_MAX };
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // The nets of a parsed image, one column per field
+    //
+    // gerber_net is what the parser builds, once parsing is done they get
+    // squashed into one of these and thrown away. Net index N is row N in every column.
+
+    struct gerber_net_store
+    {
+        static constexpr uint32_t no_extra = UINT32_MAX;
+
+        // hot columns, draw() looks at these for every net
+
+        std::vector<uint8_t> aperture_state;          // gerber_aperture_state
+        std::vector<uint8_t> interpolation_method;    // gerber_interpolation
+        std::vector<uint8_t> hidden;
+        std::vector<int32_t> aperture;
+        std::vector<int32_t> level;                   // index into image.levels
+        std::vector<int32_t> entity_id;
+        std::vector<gerber_2d::vec2d> start;
+        std::vector<gerber_2d::vec2d> end;
+
+        // cold columns
+
+        std::vector<gerber_2d::rect> bounding_box;
+        std::vector<int32_t> net_state;    // index into image.net_states
+
+        // for arcs this is an index into arcs, for region starts it's the number of points in the region
+        std::vector<uint32_t> extra;
+
+        std::vector<gerber_arc> arcs;
+        std::map<size_t, std::string> labels;
+
+        // all the regions in net order, their outlines are slices of region_elements
+
+        std::vector<gerber_region> regions;
+        std::vector<gerber_draw_element> region_elements;
+
+        //////////////////////////////////////////////////////////////////////
+
+        size_t size() const
+        {
+            return end.size();
+        }
+
+        gerber_aperture_state get_aperture_state(size_t net_index) const
+        {
+            return static_cast<gerber_aperture_state>(aperture_state[net_index]);
+        }
+
+        gerber_interpolation get_interpolation(size_t net_index) const
+        {
+            return static_cast<gerber_interpolation>(interpolation_method[net_index]);
+        }
+
+        bool is_arc(size_t net_index) const
+        {
+            gerber_interpolation i = get_interpolation(net_index);
+            return i == interpolation_clockwise_circular || i == interpolation_counterclockwise_circular;
+        }
+
+        // only for arcs
+        gerber_arc const &arc(size_t net_index) const
+        {
+            return arcs[extra[net_index]];
+        }
+
+        // only for region starts
+        int num_region_points(size_t net_index) const
+        {
+            return static_cast<int>(extra[net_index]);
+        }
+
+        // nullptr if net_index isn't the start of a region
+        gerber_region const *find_region(size_t net_index) const;
+
+        gerber_draw_element const *region_outline(gerber_region const &region) const
+        {
+            return region_elements.data() + region.first_element;
+        }
+
+        void reserve(size_t num_nets);
+        void add(gerber_net const &net, int32_t level_index, int32_t net_state_index);
+        void index_regions();
+        void clear();
+
+        size_t bytes_used() const;
+    };
+
+}    // namespace gerber_lib
@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // gerber_pool hands out T's from big blocks so they're mostly contiguous and never move.
+    // Nothing gets freed on its own, clear() destroys everything and frees the blocks
+
+    template <typename T> struct gerber_pool
+    {
+        static constexpr size_t first_block_size = 64;
+        static constexpr size_t max_block_size = 65536;
+
+        struct alignas(T) slot
+        {
+            std::byte bytes[sizeof(T)];
+        };
+
+        struct block
+        {
+            std::unique_ptr<slot[]> slots;
+            size_t capacity{};
+            size_t used{};
+        };
+
+        std::vector<block> blocks;
+        size_t next_block_size{ first_block_size };
+
+        gerber_pool() = default;
+
+        gerber_pool(gerber_pool const &) = delete;
+        gerber_pool &operator=(gerber_pool const &) = delete;
+
+        ~gerber_pool()
+        {
+            clear();
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        template <typename... args> T *create(args &&...arguments)
+        {
+            if(blocks.empty() || blocks.back().used == blocks.back().capacity) {
+                add_block(next_block_size);
+            }
+            block &b = blocks.back();
+            T *p = ::new(static_cast<void *>(&b.slots[b.used])) T(std::forward<args>(arguments)...);
+            b.used += 1;
+            return p;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // make sure the next count create()s go in one block
+
+        void reserve(size_t count)
+        {
+            if(blocks.empty() || blocks.back().capacity - blocks.back().used < count) {
+                add_block(std::max(count, next_block_size));
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // take all of other's blocks, the objects in them don't move
+
+        void adopt(gerber_pool &other)
+        {
+            for(block &b : other.blocks) {
+                blocks.push_back(std::move(b));
+            }
+            other.blocks.clear();
+            other.next_block_size = first_block_size;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        size_t size() const
+        {
+            size_t total = 0;
+            for(block const &b : blocks) {
+                total += b.used;
+            }
+            return total;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void clear()
+        {
+            for(block &b : blocks) {
+                for(size_t i = 0; i < b.used; ++i) {
+                    std::destroy_at(std::launder(reinterpret_cast<T *>(&b.slots[i])));
+                }
+            }
+            blocks.clear();
+            next_block_size = first_block_size;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void add_block(size_t capacity)
+        {
+            block &b = blocks.emplace_back();
+            b.slots.reset(new slot[capacity]);
+            b.capacity = capacity;
+            next_block_size = std::min(max_block_size, next_block_size * 2);
+        }
+    };
+
+}    // namespace gerber_lib
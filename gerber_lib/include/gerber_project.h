@@ -0,0 +1,91 @@
+//////////////////////////////////////////////////////////////////////
+// A board job: a bunch of layers loaded at the same time
+
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gerber_lib.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    enum gerber_layer_status
+    {
+        layer_status_pending,
+        layer_status_loading,
+        layer_status_loaded,
+        layer_status_failed
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_project_layer
+    {
+        std::string filename;
+
+        // only look at this once result is ready (or status is loaded/failed)
+        std::unique_ptr<gerber> layer;
+
+        std::atomic<gerber_layer_status> status{ layer_status_pending };
+
+        std::promise<gerber_error_code> promise;
+        std::shared_future<gerber_error_code> result{ promise.get_future().share() };
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // load_directory/load_files return as soon as the layers are queued, the
+    // layers are parsed on a pool of threads (each one on as many threads as
+    // there are cores to spare) so the whole job takes about as long as the biggest layer
+
+    struct gerber_project
+    {
+        std::vector<std::unique_ptr<gerber_project_layer>> layers;
+        std::vector<std::thread> threads;
+
+        std::atomic<size_t> next_layer{};
+        std::atomic<size_t> layers_finished{};
+        int threads_per_layer{ 1 };
+
+        // if this is set, layers are loaded through the parsed file cache in this folder
+        std::string cache_folder;
+
+        gerber_project() = default;
+
+        gerber_project(gerber_project const &) = delete;
+        gerber_project &operator=(gerber_project const &) = delete;
+
+        ~gerber_project();
+
+        // all the files in a folder which look like gerber files (by extension)
+        gerber_error_code load_directory(char const *path, int num_threads = 0);
+
+        gerber_error_code load_files(std::vector<std::string> const &filenames, int num_threads = 0);
+
+        // block until every layer is done, returns the first error if any of them failed
+        gerber_error_code wait();
+
+        // 0..1, how many layers have finished
+        double progress() const;
+
+        bool finished() const;
+
+        // union of the extents of all the layers which have loaded so far
+        gerber_2d::rect extent() const;
+
+        void cleanup();
+
+        void worker();
+
+        static bool is_gerber_filename(std::string const &filename);
+    };
+
+}    // namespace gerber_lib
+
+GERBER_MAKE_ENUM_FORMATTER(gerber_layer_status);
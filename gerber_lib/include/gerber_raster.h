@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////
+// A drawer which renders to a greyscale image, no windowing system needed
+//
+// fill_elements just keeps the outlines. save() renders them in square tiles
+// on all the cores, one band of tiles at a time, and writes each band out as
+// soon as it's done so a huge image never has to be in memory all at once.
+//
+// Every shape is made to go round counter clockwise once (like the flattener,
+// rings etc. get sorted out with the even-odd rule first) so the shapes in a
+// polarity run can all be filled together with the non-zero rule. Each row of
+// pixels is sampled along 16 scanlines and the covered length of each pixel
+// along those is exact, so edges are anti-aliased without any seams where
+// shapes touch. Each run's coverage is added (dark) or taken away (clear) in
+// order. 255 is copper, 0 is nothing.
+//
+// Step and repeat blocks are kept once with a list of offsets, and each aperture
+// once with a list of where it's flashed, the copies are only made as the
+// tiles are rendered.
+//
+//     gerber_rasterizer r;
+//     r.dpi = 2400;
+//     g.draw_list().replay(r);
+//     r.save("top_copper.png");
+
+#pragma once
+
+#include <map>
+#include <cstdint>
+#include <vector>
+
+#include "gerber_draw.h"
+#include "gerber_draw_list.h"
+#include "gerber_error.h"
+#include "gerber_clipper.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_rasterizer : gerber_draw_interface
+    {
+        double dpi{ 1200 };
+
+        // pixels, each thread renders one of these at a time
+        int tile_size{ 256 };
+
+        // space (mm) to leave around the edges of the image
+        double border{ 0.5 };
+
+        void set_gerber(gerber *g) override;
+        void fill_elements(gerber_draw_element const *elements, size_t num_elements, gerber_polarity polarity, int entity_id) override;
+        void begin_layer(size_t num_shapes, size_t num_elements) override;
+
+        bool draws_repeats() const override;
+        void begin_repeat(vec2d const *offsets, size_t num_offsets) override;
+        void end_repeat() override;
+
+        bool draws_flashes() const override;
+        void define_aperture(int aperture_id, gerber_draw_element const *elements, gerber_draw_shape const *draw_shapes, size_t num_shapes) override;
+        void flash_aperture(int aperture_id, gerber_polarity polarity, gerber_flash const *flashes, size_t num_flashes) override;
+
+        // render it and save it as .png (uncompressed) or anything else as binary .pgm
+        // num_threads = 0 means use all the cores
+
+        gerber_error_code save(char const *file_path, int num_threads = 0) const;
+
+        // extent (mm) of everything that's been drawn
+        rect bounds() const;
+
+        // a shape at one of the offsets, sorting these puts them in the order they were drawn
+
+        struct raster_item
+        {
+            uint32_t instance;
+            uint32_t shape;
+
+            auto operator<=>(raster_item const &) const = default;
+        };
+
+        // render some of the shapes (in the order they were drawn) into a block of pixels.
+        // left, top is the top left corner of the block in mm, scale is pixels per mm
+
+        void render(raster_item const *items, size_t num_items, double left, double top, double scale, int width, int height, uint8_t *pixels,
+                    size_t stride) const;
+
+        void clear();
+
+        //////////////////////////////////////////////////////////////////////
+        // outlines in mm, floats are plenty at any sensible dpi and half the size
+
+        struct raster_point
+        {
+            float x;
+            float y;
+        };
+
+        // one closed path, a shape with holes is an outline and some clockwise paths
+
+        struct raster_shape
+        {
+            uint32_t first_point;
+            uint32_t num_points;
+            float min_x;
+            float min_y;
+            float max_x;
+            float max_y;
+            bool dark;
+        };
+
+        // shapes which are drawn at each of some offsets, all of them at the first offset then all
+        // at the next and so on. Outside step and repeat blocks there's just one offset (0,0). For
+        // flashes the shapes are an aperture's, made once, and the offsets are where it's flashed
+
+        struct raster_group
+        {
+            uint32_t first_shape;
+            uint32_t num_shapes;
+            uint32_t first_instance;
+            uint32_t num_instances;
+            float min_x;
+            float min_y;
+            float max_x;
+            float max_y;
+        };
+
+        std::vector<raster_point> points;
+        std::vector<raster_shape> shapes;
+        std::vector<raster_group> groups;
+        std::vector<raster_point> instances;
+
+        // fill_elements adds shapes to the last group while this is set
+        bool group_open{ false };
+
+        // the shapes of each aperture, from define_aperture
+        std::map<int, gerber_draw_list> apertures;
+
+        // the shapes each aperture has been made into for dark and clear flashes (in groups with no instances)
+        std::map<std::pair<int, bool>, raster_group> flash_shapes;
+
+        void add_outline(gerber_draw_element const *elements, size_t num_elements, bool dark);
+        void add_path(clip_path const &path, bool dark);
+        void add_group(raster_point const *offsets, size_t num_offsets);
+        void add_to_group(raster_group &group, uint32_t first_shape) const;
+
+        clip_path shape_path;
+        std::vector<clip_path> shape_paths;
+        std::vector<clip_polygon> shape_polygons;
+    };
+
+}    // namespace gerber_lib
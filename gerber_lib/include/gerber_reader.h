@@ -1,22 +1,48 @@
 #pragma once
 
+#include <cstdint>
 #include <format>
 #include <string>
-#include <fstream>
+#include <vector>
+#include <span>
 
+#include "gerber_util.h"
 #include "gerber_error.h"
 
 namespace gerber_lib
 {
     //////////////////////////////////////////////////////////////////////
 
+    struct gerber_reader;
+
+    //////////////////////////////////////////////////////////////////////
+    // a position in the file which turns into a line number when it's formatted
+
+    struct gerber_source_line
+    {
+        gerber_reader const *reader;
+        size_t offset;
+
+        std::string to_string() const;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
     struct gerber_reader
     {
         gerber_reader() = default;
 
+        gerber_reader(gerber_reader const &) = delete;
+        gerber_reader &operator=(gerber_reader const &) = delete;
+
+        ~gerber_reader();
+
         gerber_error_code open(char const *file_path);
         void close();
 
+        // read [begin, end) of a file which another reader has open, offsets stay relative to the whole file
+        void open_view(gerber_reader const &source, size_t begin, size_t end);
+
         bool eof() const;
 
         gerber_error_code peek(char *c);
@@ -24,6 +50,7 @@ namespace gerber_lib
         gerber_error_code read_short(uint32_t *c, int count);
         gerber_error_code read_until(std::string *s, char value);
         gerber_error_code get_int(int *value, size_t *length = nullptr);
+        gerber_error_code get_int(int64_t *value, size_t *length = nullptr);
         gerber_error_code get_double(double *value, size_t *length = nullptr);
 
         void skip(size_t num_chars);
@@ -31,13 +58,37 @@ namespace gerber_lib
         void skip_whitespace();
         void skip_whitespace_reverse();
 
+        static char const *find_char(char const *p, size_t length, char value);
+
+        // line numbers are only worked out when something needs to display one
+
+        int line_number_at(size_t offset) const;
+        gerber_source_line line() const;
+        void build_line_index() const;
+
         //////////////////////////////////////////////////////////////////////
 
-        int line_number{};
-        std::ifstream input_stream;
         std::string filename;
-        std::vector<char> file_contents;
         size_t file_pos{};
+
+        // everything reads from file_data, which is either the memory mapped file
+        // or file_contents if the file couldn't be mapped (or mapping isn't supported)
+
+        std::span<char const> file_data;
+        std::vector<char> file_contents;
+
+        void *mapped_address{ nullptr };
+        size_t mapped_size{};
+
+        // offset of every '\n' in file_data, built on demand by build_line_index
+
+        mutable std::vector<size_t> newline_offsets;
+        mutable bool line_index_built{ false };
+
+        template <typename T> gerber_error_code get_integer(T *value, size_t *length);
+
+        gerber_error_code map_file(char const *file_path, size_t file_size);
+        gerber_error_code load_file(char const *file_path, size_t file_size);
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -76,3 +127,5 @@ namespace gerber_lib
         return result;
     }
 }    // namespace gerber_lib
+
+GERBER_MAKE_FORMATTER(gerber_lib::gerber_source_line);
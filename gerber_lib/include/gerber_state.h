@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "gerber_enums.h"
 
 namespace gerber_lib
@@ -12,17 +14,22 @@ namespace gerber_lib
 
     struct gerber_state
     {
-        int current_x{};
-        int current_y{};
+        // coordinates are in nanometres
+
+        int64_t current_x{};
+        int64_t current_y{};
 
-        int previous_x{};
-        int previous_y{};
+        int64_t previous_x{};
+        int64_t previous_y{};
 
-        int center_x{};
-        int center_y{};
+        int64_t center_x{};
+        int64_t center_y{};
 
         int current_aperture{};
 
+        // counts entities as they're found, nets get tagged with this
+        int entity_id{};
+
         bool changed_state{ false };
 
         gerber_aperture_state aperture_state;
@@ -26,6 +26,9 @@ namespace gerber_lib
         std::vector<gerber_aperture_info *> apertures;
         std::vector<gerber_aperture_info *> d_codes;
 
+        // d_codes indexed by d-code number so counting one is O(1)
+        std::vector<gerber_aperture_info *> d_code_table;
+
         int level_count{};
         int g0{};
         int g1{};
@@ -74,9 +77,18 @@ namespace gerber_lib
         //////////////////////////////////////////////////////////////////////
 
         void add_aperture(int level, int number, gerber_aperture_type type, double parameter[5]);
+        gerber_aperture_info *find_d_code(int number) const;
+        void insert_d_code(gerber_aperture_info *d);
+
         void add_to_d_list(int number);
         void add_new_d_list(int number);
-        gerber_error_code increment_d_list_count(int number, int count, int line);
+        gerber_error_code increment_d_list_count(int number, int count, size_t file_offset);
+
+        // add the counters from another gerber_stats (errors are not included)
+        void accumulate(gerber_stats const &other);
+
+        // zero the counters (errors and apertures are kept)
+        void reset_counters();
 
         //////////////////////////////////////////////////////////////////////
 
@@ -93,9 +105,13 @@ namespace gerber_lib
 
             std::string error_text = get_error_text(code);
 
-            std::string error_message = std::format("error {} ({}) at line {}: {}", static_cast<int>(code), error_text, reader.line_number, error_msg);
+            // errors are rare and get logged straight away so may as well resolve the line number here
+
+            int line_number = reader.line_number_at(reader.file_pos);
+
+            std::string error_message = std::format("error {} ({}) at line {}: {}", static_cast<int>(code), error_text, line_number, error_msg);
 
-            errors.emplace_back(gerber_error(code, error_message, reader.filename, reader.line_number));
+            errors.emplace_back(gerber_error(code, error_message, reader.filename, reader.file_pos, line_number));
             LOG_ERROR("{}", error_message);
             return code;
         }
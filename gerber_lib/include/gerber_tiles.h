@@ -0,0 +1,133 @@
+//////////////////////////////////////////////////////////////////////
+// Rendered tiles of a layer at power of two zoom levels, for viewers
+//
+// Level 0 is the whole layer in one tile, each level after that has twice as
+// many tiles across and down. Tiles are rendered by worker threads when
+// they're asked for and kept in a cache which throws out the least recently
+// used ones when it goes over the memory budget. set_view() says where the
+// viewer is looking, what's in view gets rendered first, then the tiles
+// around it and the level above so panning and zooming out are instant.
+//
+// Tiles are rows of tile_size bytes from the top left, 255 is copper.
+
+#pragma once
+
+#include <set>
+#include <map>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "gerber_raster.h"
+
+namespace gerber_lib
+{
+    struct gerber;
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_tile_key
+    {
+        int level;
+        int x;
+        int y;
+
+        auto operator<=>(gerber_tile_key const &) const = default;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_tile
+    {
+        gerber_tile_key key;
+        std::vector<uint8_t> pixels;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct gerber_tile_pyramid
+    {
+        int tile_size{ 256 };
+
+        // the most zoomed in level is the first one with at least this many dots per inch
+        double max_dpi{ 4800 };
+
+        // called on a worker thread when a tile that was asked for is ready
+        std::function<void(gerber_tile_key const &)> tile_ready;
+
+        gerber_tile_pyramid() = default;
+        ~gerber_tile_pyramid();
+
+        gerber_tile_pyramid(gerber_tile_pyramid const &) = delete;
+        gerber_tile_pyramid &operator=(gerber_tile_pyramid const &) = delete;
+
+        // get the outlines from g (which isn't needed after this) and start the worker threads
+        // num_threads = 0 means use all the cores
+
+        gerber_error_code open(gerber const &g, size_t memory_budget = 256 << 20, int num_threads = 0);
+        void close();
+
+        // the tile if it's in the cache, otherwise nullptr and it gets rendered as soon as possible
+        std::shared_ptr<gerber_tile const> find_tile(gerber_tile_key const &key);
+
+        // the tile, rendered right now on this thread if it isn't in the cache
+        std::shared_ptr<gerber_tile const> get_tile(gerber_tile_key const &key);
+
+        // view is in mm, anything queued for the previous view which hasn't started is forgotten
+        void set_view(rect const &view, int level);
+
+        // the first level with pixels no bigger than pixel_size (mm)
+        int level_for_pixel_size(double pixel_size) const;
+
+        // the area (mm) a tile covers
+        rect tile_rect(gerber_tile_key const &key) const;
+
+        int max_level{};
+
+        // the square (mm) which level 0 covers
+        double left{};
+        double top{};
+        double size{};
+
+        gerber_rasterizer rasterizer;
+
+        // which shapes are in each cell of a grid over the whole thing, so a tile
+        // doesn't have to look at all of them. Step and repeat copies aren't in
+        // it, a tile looks up each copy which touches it moved back to the first
+
+        int grid_cells_across{};
+        std::vector<size_t> grid_offsets;
+        std::vector<uint32_t> grid_shapes;
+
+        void items_in(rect const &area, std::vector<gerber_rasterizer::raster_item> &items) const;
+
+        std::shared_ptr<gerber_tile const> render_tile(gerber_tile_key const &key) const;
+
+        // these need the mutex
+        void add_to_cache(std::shared_ptr<gerber_tile const> const &tile);
+        void enqueue(gerber_tile_key const &key, bool urgent);
+
+        void worker();
+
+        std::mutex mutex;
+        std::condition_variable work_available;
+        std::vector<std::thread> workers;
+        bool stopping{ false };
+
+        // front is the most recently used
+        std::list<std::shared_ptr<gerber_tile const>> lru;
+        std::map<gerber_tile_key, std::list<std::shared_ptr<gerber_tile const>>::iterator> cache;
+        size_t memory_budget{};
+        size_t memory_used{};
+
+        std::deque<gerber_tile_key> queue;
+        std::set<gerber_tile_key> queued;
+        std::set<gerber_tile_key> rendering;
+    };
+
+}    // namespace gerber_lib
@@ -3,6 +3,7 @@
 #include <format>
 #include <stack>
 #include <map>
+#include <algorithm>
 
 #include "gerber_error.h"
 #include "gerber_util.h"
@@ -338,7 +339,142 @@ namespace gerber_lib
 
             case '%':
                 done = true;
-                LOG_DEBUG("Finished parsing {}, {} instructions", name, instructions.size());
+                compile_error = compile();
+                LOG_DEBUG("Finished parsing {}, {} instructions, {} compiled", name, instructions.size(), code.size());
+                break;
+
+            default:
+                break;
+            }
+        }
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // doesn't log anything, a broken macro is only an error if an AD uses it
+
+    gerber_error_code gerber_aperture_macro::compile()
+    {
+        code.clear();
+        constants.clear();
+        max_stack_depth = 0;
+        num_parameters = 0;
+
+        // for each value on the stack, where in code the push_value for it is or -1 if
+        // it isn't a constant. Something else (a pop_parameter) can come after the push
+        // so constants only get folded if their pushes are the last things in code
+
+        std::vector<int> constant;
+
+        auto push = [&](gerber_macro_op op, bool is_constant) {
+            if(constant.size() >= max_macro_stack_depth) {
+                return error_formula_too_complex;
+            }
+            constant.push_back(is_constant ? static_cast<int>(code.size()) : -1);
+            code.push_back(op);
+            max_stack_depth = std::max(max_stack_depth, static_cast<int>(constant.size()));
+            return ok;
+        };
+
+        auto last_pushed = [&](size_t depth_from_top) {
+            int pushed_at = constant[constant.size() - 1 - depth_from_top];
+            return pushed_at >= 0 && static_cast<size_t>(pushed_at) + 1 + depth_from_top == code.size();
+        };
+
+        for(gerber_instruction const &instruction : instructions) {
+
+            switch(instruction.opcode) {
+
+            case opcode_push_value: {
+                gerber_error_code error = push({ opcode_push_value, static_cast<int>(constants.size()) }, true);
+                if(error != ok) {
+                    return error;
+                }
+                constants.push_back(instruction.double_value);
+            } break;
+
+            case opcode_push_parameter: {
+                if(instruction.int_value <= 0) {
+                    return error_bad_parameter_index;
+                }
+                gerber_error_code error = push({ opcode_push_parameter, instruction.int_value }, false);
+                if(error != ok) {
+                    return error;
+                }
+                num_parameters = std::max(num_parameters, instruction.int_value);
+            } break;
+
+            case opcode_pop_parameter:
+                if(constant.empty()) {
+                    return error_expression_stack_underflow;
+                }
+                if(instruction.int_value <= 0) {
+                    return error_bad_parameter_index;
+                }
+                code.push_back({ opcode_pop_parameter, instruction.int_value });
+                constant.pop_back();
+                num_parameters = std::max(num_parameters, instruction.int_value);
+                break;
+
+            case opcode_unary_plus:
+                if(constant.empty()) {
+                    return error_expression_stack_underflow;
+                }
+                break;
+
+            case opcode_unary_minus:
+                if(constant.empty()) {
+                    return error_expression_stack_underflow;
+                }
+                if(last_pushed(0)) {
+                    double &v = constants[code.back().operand];
+                    v = -v;
+                } else {
+                    code.push_back({ opcode_unary_minus, 0 });
+                    constant.back() = -1;
+                }
+                break;
+
+            case opcode_add:
+            case opcode_subtract:
+            case opcode_multiply:
+            case opcode_divide: {
+                size_t depth = constant.size();
+                if(depth < 2) {
+                    return error_expression_stack_underflow;
+                }
+                if(last_pushed(0) && last_pushed(1)) {
+                    int b_index = code.back().operand;
+                    double b = constants[b_index];
+                    if(b_index == static_cast<int>(constants.size()) - 1) {
+                        constants.pop_back();
+                    }
+                    code.pop_back();
+                    double &a = constants[code.back().operand];
+                    switch(instruction.opcode) {
+                    case opcode_add:
+                        a = b + a;
+                        break;
+                    case opcode_subtract:
+                        a = a - b;
+                        break;
+                    case opcode_multiply:
+                        a = b * a;
+                        break;
+                    default:
+                        a = a / b;
+                        break;
+                    }
+                } else {
+                    code.push_back({ instruction.opcode, 0 });
+                    constant[depth - 2] = -1;
+                }
+                constant.pop_back();
+            } break;
+
+            case opcode_primitive:
+                code.push_back({ opcode_primitive, instruction.int_value });
+                constant.clear();
                 break;
 
             default:
@@ -354,133 +490,92 @@ namespace gerber_lib
     {
         LOG_CONTEXT("execute_aperture_macro", info);
 
-        LOG_DEBUG("Execute aperture macro \"{}\"", aperture_macro->name);
+        gerber_aperture_macro const &macro = *aperture_macro;
+
+        LOG_DEBUG("Execute aperture macro \"{}\"", macro.name);
+
+        CHECK(macro.compile_error);
 
         size_t num_of_parameters{ 0 };
         bool clear_operator_used{ false };
         gerber_aperture_type type{ aperture_type_none };
 
-        std::vector<double> macro_stack;
-
-        auto stack_string = [&]() { return std::format("[{}]", join(macro_stack, ",")); };
-
-        auto pop = [&](double *d) {
-            if(d == nullptr) {
-                return error_internal_bad_pointer;
-            }
-            if(macro_stack.empty()) {
-                LOG_ERROR("stack underflow in execute_aperture_macro");
-                return error_expression_stack_underflow;
-            }
-            double t = macro_stack.back();
-            macro_stack.pop_back();
-            *d = t;
-            return ok;
-        };
+        // compile() checked the arithmetic can't underflow this or go off the end
+        double macro_stack[max_macro_stack_depth];
+        size_t stack_size = 0;
 
         for(size_t i = 0; i < parameters.size(); ++i) {
             LOG_VERBOSE("parameter ${}={}", i + 1, parameters[i]);
         }
 
-        for(auto const &instruction : aperture_macro->instructions) {
+        // so assigning parameters doesn't allocate more than once
+        parameters.reserve(macro.num_parameters);
 
-            // LOG_DEBUG("Instruction: {}, stack has {} entries", get_opcode_name(instruction.opcode), macro_stack.size());
+        for(gerber_macro_op const &op : macro.code) {
 
-            switch(instruction.opcode) {
-
-            case opcode_nop:
-                break;
+            switch(op.opcode) {
 
             case opcode_push_value:
-                macro_stack.push_back(instruction.double_value);
-                LOG_DEBUG("push value {} : {}", instruction.double_value, stack_string());
+                macro_stack[stack_size++] = macro.constants[op.operand];
                 break;
 
-            case opcode_push_parameter: {
-                if(instruction.int_value <= 0 || instruction.int_value > parameters.size()) {
+            case opcode_push_parameter:
+                if(static_cast<size_t>(op.operand) > parameters.size()) {
                     return error_bad_parameter_index;
                 }
-                double v = parameters[instruction.int_value - 1llu];
-                macro_stack.push_back(v);
-                LOG_DEBUG("push parameter {} (= {}) : {}", instruction.int_value, v, stack_string());
-            } break;
+                macro_stack[stack_size++] = parameters[op.operand - 1llu];
+                break;
 
-            case opcode_pop_parameter: {
-                double d;
-                CHECK(pop(&d));
-                int id = instruction.int_value - 1;
-                if(id < 0) {
-                    return error_bad_parameter_index;
-                }
-                if(parameters.size() <= id) {
-                    parameters.resize(static_cast<size_t>(id + 1));
+            case opcode_pop_parameter:
+                if(parameters.size() < static_cast<size_t>(op.operand)) {
+                    parameters.resize(op.operand);
                 }
-                parameters[id] = d;
-                LOG_DEBUG("pop parameter (${} = {}) : {}", id + 1, parameters[id], stack_string());
-            } break;
-
-            case opcode_unary_plus: {
-                double a;
-                CHECK(pop(&a));
-                macro_stack.push_back(a);
-                LOG_DEBUG("plusify (nop?) ({}) : {}", a, stack_string());
-            } break;
+                parameters[op.operand - 1llu] = macro_stack[--stack_size];
+                break;
 
-            case opcode_unary_minus: {
-                double a;
-                CHECK(pop(&a));
-                macro_stack.push_back(-a);
-                LOG_DEBUG("negate ({}) : {}", a, stack_string());
-            } break;
+            case opcode_unary_minus:
+                macro_stack[stack_size - 1] = -macro_stack[stack_size - 1];
+                break;
 
-            case opcode_add: {
-                double a, b;
-                CHECK(pop(&a));
-                CHECK(pop(&b));
-                macro_stack.push_back(a + b);
-                LOG_DEBUG("add ({},{} = {}) : {}", a, b, a + b, stack_string());
-            } break;
+            case opcode_add:
+                stack_size -= 1;
+                macro_stack[stack_size - 1] = macro_stack[stack_size] + macro_stack[stack_size - 1];
+                break;
 
-            case opcode_subtract: {
-                double a, b;
-                CHECK(pop(&b));
-                CHECK(pop(&a));
-                macro_stack.push_back(a - b);
-                LOG_DEBUG("subtract ({},{} = {}) : {}", a, b, a - b, stack_string());
-            } break;
+            case opcode_subtract:
+                stack_size -= 1;
+                macro_stack[stack_size - 1] = macro_stack[stack_size - 1] - macro_stack[stack_size];
+                break;
 
-            case opcode_multiply: {
-                double a, b;
-                CHECK(pop(&a));
-                CHECK(pop(&b));
-                macro_stack.push_back(a * b);
-                LOG_DEBUG("multiply ({},{} = {}) : {}", a, b, a * b, stack_string());
-            } break;
+            case opcode_multiply:
+                stack_size -= 1;
+                macro_stack[stack_size - 1] = macro_stack[stack_size] * macro_stack[stack_size - 1];
+                break;
 
-            case opcode_divide: {
-                double a, b;
-                CHECK(pop(&b));
-                CHECK(pop(&a));
-                macro_stack.push_back(a / b);
-                LOG_DEBUG("divide ({},{} = {}) : {}", a, b, a / b, stack_string());
-            } break;
+            case opcode_divide:
+                stack_size -= 1;
+                macro_stack[stack_size - 1] = macro_stack[stack_size - 1] / macro_stack[stack_size];
+                break;
 
             case opcode_primitive:
 
-                switch(instruction.int_value) {
+                switch(op.operand) {
 
                 case 1:
                     type = aperture_type_macro_circle;
                     num_of_parameters = circle_num_parameters;
 
                     // last parameter for circle (rotation) is optional...
-                    if(macro_stack.size() == circle_num_parameters - 1llu) {
+                    if(stack_size == circle_num_parameters - 1llu) {
                         num_of_parameters = circle_num_parameters - 1llu;
                     }
                     break;
 
                 case 4:
                     type = aperture_type_macro_outline;
+                    if(stack_size < 2) {
+                        return error_expression_stack_underflow;
+                    }
                     num_of_parameters = (static_cast<int>(macro_stack[1]) + 1llu) * 2 + 3;
                     if(num_of_parameters < 0 || num_of_parameters >= INT_MAX / 4) {
                         return error_bad_parameter_count;
@@ -524,11 +619,11 @@ namespace gerber_lib
                 default:
                     type = aperture_type_none;
                     num_of_parameters = 0;
-                    LOG_ERROR("Invalid primitive: {}", instruction.int_value);
+                    LOG_ERROR("Invalid primitive: {}", op.operand);
                     break;
                 }
 
-                LOG_DEBUG("Aperture: {}, {} parameters : {}", type, num_of_parameters, stack_string());
+                LOG_DEBUG("Aperture: {}, {} parameters, {} on the stack", type, num_of_parameters, stack_size);
 
                 if(type != aperture_type_none) {
 
@@ -536,14 +631,18 @@ namespace gerber_lib
                         return error_bad_parameter_count;
                     }
 
+                    if(num_of_parameters > stack_size) {
+                        LOG_ERROR("stack underflow in execute_aperture_macro");
+                        return error_expression_stack_underflow;
+                    }
+
+                    // the parameters are the top num_of_parameters values, in the order they were pushed
+                    stack_size -= num_of_parameters;
+
                     gerber_macro_parameters *macro = new gerber_macro_parameters();
 
                     macro->aperture_type = type;
-                    macro->parameters.resize(num_of_parameters);
-
-                    for(intptr_t i = num_of_parameters - 1; i >= 0; i -= 1) {
-                        CHECK(pop(&macro->parameters[i]));
-                    }
+                    macro->parameters.assign(macro_stack + stack_size, macro_stack + stack_size + num_of_parameters);
 
                     double exposure = 1.0;
 
@@ -622,7 +721,7 @@ namespace gerber_lib
                         index += 1;
                     }
                 }
-                macro_stack.clear();
+                stack_size = 0;
                 break;
 
             default:
@@ -0,0 +1,45 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "gerber_attributes.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    std::string const *gerber_string_pool::intern(std::string const &s)
+    {
+        std::lock_guard lock(mutex);
+        return &*strings.insert(s).first;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::string const *gerber_attributes::find(std::string const &name) const
+    {
+        auto f = std::lower_bound(items.begin(), items.end(), name, [](gerber_attribute const &a, std::string const &n) { return *a.name < n; });
+        if(f == items.end() || *f->name != name) {
+            return nullptr;
+        }
+        return f->value;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_attribute_set make_attribute_set(gerber_string_pool &pool, std::map<std::string, std::string> const &dictionary)
+    {
+        if(dictionary.empty()) {
+            return nullptr;
+        }
+        auto attributes = std::make_shared<gerber_attributes>();
+        attributes->items.reserve(dictionary.size());
+
+        // std::map is already sorted by name
+        for(auto const &[name, value] : dictionary) {
+            attributes->items.push_back({ pool.intern(name), pool.intern(value) });
+        }
+        return attributes;
+    }
+
+}    // namespace gerber_lib
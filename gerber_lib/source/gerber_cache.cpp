@@ -0,0 +1,693 @@
+//////////////////////////////////////////////////////////////////////
+// Save a parsed gerber file in a binary cache file and load it back
+//
+// Cache files are named after a hash of the gerber file contents and live in
+// whatever folder the caller wants. Everything is written in native byte order,
+// the header has the version and byte order so a cache file from a different
+// build just gets ignored and the gerber file is parsed again.
+//
+// The cache file is memory mapped (by gerber_reader) and the net store columns
+// are copied straight out of it, there's nothing to do per net except check the indices.
+
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <type_traits>
+#include <cstring>
+#include <thread>
+
+#include "gerber_lib.h"
+#include "gerber_cache.h"
+#include "gerber_net.h"
+#include "gerber_aperture.h"
+#include "gerber_level.h"
+
+LOG_CONTEXT("cache", info);
+
+namespace
+{
+    using namespace gerber_lib;
+
+    constexpr uint32_t byte_order_mark = 0x01020304;
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct cache_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t pad;
+        uint64_t content_hash;
+        uint64_t file_size;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    int gerber_stats::*const stats_counters[] = {
+        &gerber_stats::level_count, &gerber_stats::g0, &gerber_stats::g1, &gerber_stats::g2, &gerber_stats::g3,
+        &gerber_stats::g4, &gerber_stats::g36, &gerber_stats::g37, &gerber_stats::g54, &gerber_stats::g55,
+        &gerber_stats::g70, &gerber_stats::g71, &gerber_stats::g74, &gerber_stats::g75, &gerber_stats::g90,
+        &gerber_stats::g91, &gerber_stats::d1, &gerber_stats::d2, &gerber_stats::d3, &gerber_stats::m0,
+        &gerber_stats::m1, &gerber_stats::m2, &gerber_stats::unknown_g_codes, &gerber_stats::unknown_d_codes,
+        &gerber_stats::unknown_m_codes, &gerber_stats::d_code_errors, &gerber_stats::x_count, &gerber_stats::y_count,
+        &gerber_stats::i_count, &gerber_stats::j_count, &gerber_stats::star_count, &gerber_stats::unknown_count,
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct cache_writer
+    {
+        std::vector<char> data;
+
+        template <typename T> void put(T const &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            char const *p = reinterpret_cast<char const *>(&value);
+            data.insert(data.end(), p, p + sizeof(T));
+        }
+
+        void put_count(size_t count)
+        {
+            put(static_cast<uint64_t>(count));
+        }
+
+        void put_string(std::string const &s)
+        {
+            put_count(s.size());
+            data.insert(data.end(), s.begin(), s.end());
+        }
+
+        template <typename T> void put_vector(std::vector<T> const &v)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            put_count(v.size());
+            char const *p = reinterpret_cast<char const *>(v.data());
+            data.insert(data.end(), p, p + v.size() * sizeof(T));
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // reads past the end just set failed and return zeros
+
+    struct cache_reader
+    {
+        std::span<char const> data;
+        size_t pos{};
+        bool failed{ false };
+
+        template <typename T> T get()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T value{};
+            if(failed || sizeof(T) > data.size() - pos) {
+                failed = true;
+                return value;
+            }
+            memcpy(&value, data.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        // number of things which are at least item_size bytes each, 0 if there can't be that many left
+
+        size_t get_count(size_t item_size)
+        {
+            uint64_t count = get<uint64_t>();
+            if(failed || count > (data.size() - pos) / item_size) {
+                failed = true;
+                return 0;
+            }
+            return static_cast<size_t>(count);
+        }
+
+        std::string get_string()
+        {
+            size_t length = get_count(1);
+            std::string s(data.data() + pos, length);
+            pos += length;
+            return s;
+        }
+
+        template <typename T> void get_vector(std::vector<T> &v)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            size_t count = get_count(sizeof(T));
+            v.resize(count);
+            memcpy(v.data(), data.data() + pos, count * sizeof(T));
+            pos += count * sizeof(T);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    void put_stats(cache_writer &w, gerber_stats const &stats)
+    {
+        for(auto counter : stats_counters) {
+            w.put(stats.*counter);
+        }
+        w.put_count(stats.errors.size());
+        for(auto const &e : stats.errors) {
+            w.put(e.error_code);
+            w.put_string(e.message);
+            w.put_string(e.filename);
+            w.put(static_cast<uint64_t>(e.file_offset));
+            w.put(e.line_number);
+        }
+        w.put_count(stats.apertures.size());
+        for(auto a : stats.apertures) {
+            w.put(*a);
+        }
+        w.put_count(stats.d_codes.size());
+        for(auto d : stats.d_codes) {
+            w.put(*d);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void get_stats(cache_reader &r, gerber_stats &stats)
+    {
+        for(auto counter : stats_counters) {
+            stats.*counter = r.get<int>();
+        }
+        size_t num_errors = r.get_count(sizeof(gerber_error_code));
+        for(size_t i = 0; i < num_errors; ++i) {
+            gerber_error e;
+            e.error_code = r.get<gerber_error_code>();
+            e.message = r.get_string();
+            e.filename = r.get_string();
+            e.file_offset = static_cast<size_t>(r.get<uint64_t>());
+            e.line_number = r.get<int>();
+            stats.errors.push_back(e);
+        }
+        size_t num_apertures = r.get_count(sizeof(gerber_aperture_info));
+        for(size_t i = 0; i < num_apertures; ++i) {
+            stats.apertures.push_back(new gerber_aperture_info(r.get<gerber_aperture_info>()));
+        }
+        size_t num_d_codes = r.get_count(sizeof(gerber_aperture_info));
+        for(size_t i = 0; i < num_d_codes; ++i) {
+            gerber_aperture_info d = r.get<gerber_aperture_info>();
+            if(d.number < 0 || d.number > gerber::max_num_apertures) {
+                r.failed = true;
+                break;
+            }
+            stats.insert_d_code(new gerber_aperture_info(d));
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // all the columns the same length and all the indices in range
+
+    bool valid_net_store(gerber_net_store const &nets, size_t num_nets, size_t num_levels, size_t num_net_states)
+    {
+        if(nets.aperture_state.size() != num_nets || nets.interpolation_method.size() != num_nets || nets.hidden.size() != num_nets ||
+           nets.aperture.size() != num_nets || nets.level.size() != num_nets || nets.entity_id.size() != num_nets || nets.start.size() != num_nets ||
+           nets.end.size() != num_nets || nets.bounding_box.size() != num_nets || nets.net_state.size() != num_nets || nets.extra.size() != num_nets) {
+            return false;
+        }
+        for(size_t i = 0; i < num_nets; ++i) {
+            if(nets.level[i] >= static_cast<int32_t>(num_levels) || nets.net_state[i] >= static_cast<int32_t>(num_net_states)) {
+                return false;
+            }
+            if(nets.is_arc(i) && nets.extra[i] >= nets.arcs.size()) {
+                return false;
+            }
+        }
+        for(auto const &label : nets.labels) {
+            if(label.first >= num_nets) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void put_level(cache_writer &w, gerber_level const &level)
+    {
+        w.put(level.knockout);
+        w.put(level.step_and_repeat);
+        w.put(level.polarity);
+        w.put_string(level.name);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void get_level(cache_reader &r, gerber_level &level)
+    {
+        level.knockout = r.get<gerber_knockout>();
+        level.step_and_repeat = r.get<gerber_step_and_repeat>();
+        level.polarity = r.get<gerber_polarity>();
+        level.name = r.get_string();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void put_string_map(cache_writer &w, std::map<std::string, std::string> const &m)
+    {
+        w.put_count(m.size());
+        for(auto const &[key, value] : m) {
+            w.put_string(key);
+            w.put_string(value);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void get_string_map(cache_reader &r, std::map<std::string, std::string> &m)
+    {
+        size_t count = r.get_count(sizeof(uint64_t) * 2);
+        for(size_t i = 0; i < count; ++i) {
+            std::string key = r.get_string();
+            m[key] = r.get_string();
+        }
+    }
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    uint64_t content_hash(std::span<char const> data)
+    {
+        constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+        constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+        constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+        constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+        constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+        auto read64 = [](char const *p) {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        };
+
+        auto read32 = [](char const *p) {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        };
+
+        auto round = [](uint64_t acc, uint64_t input) { return std::rotl(acc + input * prime2, 31) * prime1; };
+
+        auto merge = [&](uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * prime1 + prime4; };
+
+        char const *p = data.data();
+        char const *end = p + data.size();
+        uint64_t h;
+
+        if(data.size() >= 32) {
+            uint64_t v1 = prime1 + prime2;
+            uint64_t v2 = prime2;
+            uint64_t v3 = 0;
+            uint64_t v4 = 0 - prime1;
+            for(; end - p >= 32; p += 32) {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+            }
+            h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+            h = merge(h, v1);
+            h = merge(h, v2);
+            h = merge(h, v3);
+            h = merge(h, v4);
+        } else {
+            h = prime5;
+        }
+
+        h += static_cast<uint64_t>(data.size());
+
+        for(; end - p >= 8; p += 8) {
+            h = std::rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+        }
+        if(end - p >= 4) {
+            h = std::rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+            p += 4;
+        }
+        for(; p < end; ++p) {
+            h = std::rotl(h ^ (static_cast<uint8_t>(*p) * prime5), 11) * prime1;
+        }
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::string cache_file_path(char const *cache_folder, uint64_t hash)
+    {
+        return (std::filesystem::path(cache_folder) / std::format("{:016x}.gcache", hash)).string();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber::save_cache(char const *cache_path, uint64_t hash) const
+    {
+        cache_writer w;
+
+        w.put(cache_header{ cache_magic, cache_version, byte_order_mark, 0, hash, reader.file_data.size() });
+
+        w.put(image_scale_a);
+        w.put(image_scale_b);
+        w.put(image_rotation);
+        w.put(aperture_matrix);
+        w.put(knockout_measure);
+        w.put(knockout_limit_min);
+        w.put(knockout_limit_max);
+        put_level(w, knockout_level);
+        w.put(current_net_id);
+        put_string_map(w, dictionary);
+        put_stats(w, stats);
+
+        // image
+
+        w.put(image.file_type);
+        w.put(image.format);
+        put_stats(w, image.stats);
+
+        gerber_image_info const &info = image.info;
+        w.put_string(info.image_name);
+        w.put(info.polarity);
+        w.put(info.extent);
+        w.put(info.offset_a);
+        w.put(info.offset_b);
+        w.put(info.image_rotation);
+        w.put(info.justify_a);
+        w.put(info.justify_b);
+        w.put(info.image_justify_offset_a);
+        w.put(info.image_justify_offset_b);
+        w.put(info.image_justify_offset_actual_a);
+        w.put(info.image_justify_offset_actual_b);
+        w.put_string(info.plotter_film);
+        w.put_string(info.filetype_name);
+
+        std::unordered_map<gerber_aperture_macro const *, int> macro_index;
+        w.put_count(image.aperture_macros.size());
+        for(auto m : image.aperture_macros) {
+            macro_index[m] = static_cast<int>(macro_index.size());
+            w.put_string(m->name);
+            w.put_vector(m->instructions);
+        }
+
+        w.put_count(image.apertures.size());
+        for(int number = 0; number < static_cast<int>(image.apertures.table.size()); ++number) {
+            gerber_aperture const *aperture = image.apertures.table[number];
+            if(aperture == nullptr) {
+                continue;
+            }
+            w.put(number);
+            w.put(aperture->aperture_type);
+            w.put(aperture->aperture_macro != nullptr ? macro_index[aperture->aperture_macro] : -1);
+            w.put(aperture->unit);
+            w.put(aperture->aperture_number);
+            w.put_vector(aperture->parameters);
+            w.put_count(aperture->macro_parameters_list.size());
+            for(auto m : aperture->macro_parameters_list) {
+                w.put(m->aperture_type);
+                w.put_vector(m->parameters);
+            }
+        }
+
+        w.put_count(image.levels.size());
+        for(auto l : image.levels) {
+            put_level(w, *l);
+        }
+
+        w.put_count(image.net_states.size());
+        for(auto s : image.net_states) {
+            w.put(*s);
+        }
+
+        // the net store is just columns so they get written as they are
+
+        gerber_net_store const &nets = image.net_store;
+        w.put_count(nets.size());
+        w.put_vector(nets.aperture_state);
+        w.put_vector(nets.interpolation_method);
+        w.put_vector(nets.hidden);
+        w.put_vector(nets.aperture);
+        w.put_vector(nets.level);
+        w.put_vector(nets.entity_id);
+        w.put_vector(nets.start);
+        w.put_vector(nets.end);
+        w.put_vector(nets.bounding_box);
+        w.put_vector(nets.net_state);
+        w.put_vector(nets.extra);
+        w.put_vector(nets.arcs);
+        w.put_count(nets.labels.size());
+        for(auto const &[net_index, label] : nets.labels) {
+            w.put_count(net_index);
+            w.put_string(label);
+        }
+
+        // each distinct attribute set once, then the entities refer to them by index
+
+        std::unordered_map<gerber_attributes const *, int32_t> attribute_index;
+        std::vector<gerber_attributes const *> attribute_sets;
+        for(auto const &e : entities) {
+            if(e.attributes != nullptr && attribute_index.try_emplace(e.attributes.get(), static_cast<int32_t>(attribute_sets.size())).second) {
+                attribute_sets.push_back(e.attributes.get());
+            }
+        }
+
+        w.put_count(attribute_sets.size());
+        for(gerber_attributes const *a : attribute_sets) {
+            w.put_count(a->size());
+            for(gerber_attribute const &item : *a) {
+                w.put_string(*item.name);
+                w.put_string(*item.value);
+            }
+        }
+
+        w.put_count(entities.size());
+        for(auto const &e : entities) {
+            w.put(static_cast<uint64_t>(e.offset_begin));
+            w.put(static_cast<uint64_t>(e.offset_end));
+            w.put(static_cast<uint64_t>(e.net_index));
+            w.put(e.attributes != nullptr ? attribute_index[e.attributes.get()] : -1);
+        }
+
+        // write it somewhere else and rename it so nobody ever sees half a cache file
+
+        std::error_code ec;
+        std::filesystem::path path(cache_path);
+        std::filesystem::create_directories(path.parent_path(), ec);
+
+        std::filesystem::path temp_path = path;
+        temp_path += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream f(temp_path, std::ios::binary | std::ios::trunc);
+            if(!f.write(w.data.data(), w.data.size())) {
+                LOG_WARNING("Can't write cache file {}", temp_path.string());
+                f.close();
+                std::filesystem::remove(temp_path, ec);
+                return error_cant_open_file;
+            }
+        }
+        std::filesystem::rename(temp_path, path, ec);
+        if(ec) {
+            LOG_WARNING("Can't rename cache file to {} ({})", path.string(), ec.message());
+            std::filesystem::remove(temp_path, ec);
+            return error_cant_open_file;
+        }
+        LOG_VERBOSE("Saved {} bytes to {}", w.data.size(), path.string());
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber::load_cache(std::span<char const> cache_data, uint64_t hash)
+    {
+        cleanup();
+
+        image.file_type = file_type_rs274x;
+        image.gerber = this;
+
+        cache_reader r{ cache_data };
+
+        cache_header header = r.get<cache_header>();
+        if(r.failed || header.magic != cache_magic || header.version != cache_version || header.byte_order != byte_order_mark ||
+           header.content_hash != hash || header.file_size != reader.file_data.size()) {
+            return error_invalid_cache_file;
+        }
+
+        image_scale_a = r.get<double>();
+        image_scale_b = r.get<double>();
+        image_rotation = r.get<double>();
+        aperture_matrix = r.get<gerber_2d::matrix>();
+        knockout_measure = r.get<bool>();
+        knockout_limit_min = r.get<gerber_2d::vec2d>();
+        knockout_limit_max = r.get<gerber_2d::vec2d>();
+        get_level(r, knockout_level);
+        current_net_id = r.get<int>();
+        get_string_map(r, dictionary);
+        attributes_changed = true;
+        get_stats(r, stats);
+
+        image.file_type = r.get<gerber_file_type>();
+        image.format = r.get<gerber_format>();
+        get_stats(r, image.stats);
+
+        gerber_image_info &info = image.info;
+        info.image_name = r.get_string();
+        info.polarity = r.get<gerber_polarity>();
+        info.extent = r.get<gerber_2d::rect>();
+        info.offset_a = r.get<double>();
+        info.offset_b = r.get<double>();
+        info.image_rotation = r.get<double>();
+        info.justify_a = r.get<gerber_image_justify>();
+        info.justify_b = r.get<gerber_image_justify>();
+        info.image_justify_offset_a = r.get<double>();
+        info.image_justify_offset_b = r.get<double>();
+        info.image_justify_offset_actual_a = r.get<double>();
+        info.image_justify_offset_actual_b = r.get<double>();
+        info.plotter_film = r.get_string();
+        info.filetype_name = r.get_string();
+
+        size_t num_macros = r.get_count(sizeof(uint64_t) * 2);
+        for(size_t i = 0; i < num_macros; ++i) {
+            gerber_aperture_macro *m = new gerber_aperture_macro();
+            image.aperture_macros.push_back(m);
+            m->name = r.get_string();
+            r.get_vector(m->instructions);
+            m->compile_error = m->compile();
+        }
+
+        size_t num_apertures = r.get_count(sizeof(int) * 4);
+        for(size_t i = 0; i < num_apertures && !r.failed; ++i) {
+            int number = r.get<int>();
+            if(number < 0 || number > gerber::max_num_apertures) {
+                r.failed = true;
+                break;
+            }
+            gerber_aperture *aperture = new gerber_aperture();
+            delete image.apertures.set(number, aperture);
+            aperture->aperture_type = r.get<gerber_aperture_type>();
+            int macro = r.get<int>();
+            if(macro >= static_cast<int>(image.aperture_macros.size())) {
+                r.failed = true;
+            } else if(macro >= 0) {
+                aperture->aperture_macro = image.aperture_macros[macro];
+            }
+            aperture->unit = r.get<gerber_unit>();
+            aperture->aperture_number = r.get<int>();
+            r.get_vector(aperture->parameters);
+            size_t num_macro_parameters = r.get_count(sizeof(gerber_aperture_type) + sizeof(uint64_t));
+            for(size_t j = 0; j < num_macro_parameters; ++j) {
+                gerber_macro_parameters *m = new gerber_macro_parameters();
+                aperture->macro_parameters_list.push_back(m);
+                m->aperture_type = r.get<gerber_aperture_type>();
+                r.get_vector(m->parameters);
+            }
+        }
+
+        size_t num_levels = r.get_count(sizeof(gerber_knockout));
+        for(size_t i = 0; i < num_levels; ++i) {
+            gerber_level *l = image.level_pool.create();
+            image.levels.push_back(l);
+            get_level(r, *l);
+        }
+
+        size_t num_net_states = r.get_count(sizeof(gerber_net_state));
+        for(size_t i = 0; i < num_net_states; ++i) {
+            image.net_states.push_back(image.net_state_pool.create(r.get<gerber_net_state>()));
+        }
+
+        gerber_net_store &nets = image.net_store;
+        size_t num_nets = r.get_count(1);
+        r.get_vector(nets.aperture_state);
+        r.get_vector(nets.interpolation_method);
+        r.get_vector(nets.hidden);
+        r.get_vector(nets.aperture);
+        r.get_vector(nets.level);
+        r.get_vector(nets.entity_id);
+        r.get_vector(nets.start);
+        r.get_vector(nets.end);
+        r.get_vector(nets.bounding_box);
+        r.get_vector(nets.net_state);
+        r.get_vector(nets.extra);
+        r.get_vector(nets.arcs);
+        size_t num_labels = r.get_count(sizeof(uint64_t) * 2);
+        for(size_t i = 0; i < num_labels; ++i) {
+            size_t index = r.get_count(1);
+            nets.labels[index] = r.get_string();
+        }
+
+        if(r.failed || !valid_net_store(nets, num_nets, image.levels.size(), image.net_states.size())) {
+            cleanup();
+            return error_invalid_cache_file;
+        }
+
+        // cheap enough to rebuild rather than store
+        nets.index_regions();
+
+        std::vector<gerber_attribute_set> attribute_sets;
+        size_t num_attribute_sets = r.get_count(sizeof(uint64_t));
+        for(size_t i = 0; i < num_attribute_sets && !r.failed; ++i) {
+            std::map<std::string, std::string> m;
+            get_string_map(r, m);
+            attribute_sets.push_back(make_attribute_set(*string_pool, m));
+        }
+
+        size_t num_entities = r.get_count(sizeof(uint64_t) * 3 + sizeof(int32_t));
+        entities.reserve(num_entities);
+        for(size_t i = 0; i < num_entities && !r.failed; ++i) {
+            size_t begin = static_cast<size_t>(r.get<uint64_t>());
+            size_t end = static_cast<size_t>(r.get<uint64_t>());
+            size_t net_index = static_cast<size_t>(r.get<uint64_t>());
+            gerber_entity &e = entities.emplace_back(begin, end, net_index);
+            int32_t attribute_set = r.get<int32_t>();
+            if(attribute_set >= static_cast<int32_t>(attribute_sets.size())) {
+                r.failed = true;
+            } else if(attribute_set >= 0) {
+                e.attributes = attribute_sets[attribute_set];
+            }
+        }
+
+        if(r.failed || r.pos != cache_data.size()) {
+            cleanup();
+            return error_invalid_cache_file;
+        }
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber::parse_file_cached(char const *file_path, char const *cache_folder, int num_threads)
+    {
+        cleanup();
+
+        CHECK(reader.open(file_path));
+
+        uint64_t hash = content_hash(reader.file_data);
+
+        std::string cache_path = cache_file_path(cache_folder, hash);
+
+        {
+            gerber_reader cache_file;
+            if(cache_file.open(cache_path.c_str()) == ok) {
+                if(load_cache(cache_file.file_data, hash) == ok) {
+                    filename = std::string{ file_path };
+                    LOG_VERBOSE("Loaded {} from {}", file_path, cache_path);
+                    return ok;
+                }
+                LOG_WARNING("Ignoring cache file {} for {}", cache_path, file_path);
+            }
+        }
+
+        CHECK(parse_file_parallel(file_path, num_threads));
+
+        // not being able to save the cache isn't fatal
+        save_cache(cache_path.c_str(), hash);
+
+        return ok;
+    }
+
+}    // namespace gerber_lib
@@ -0,0 +1,1052 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <set>
+
+#include "gerber_log.h"
+#include "gerber_math.h"
+#include "gerber_clipper.h"
+
+LOG_CONTEXT("clipper", info);
+
+namespace
+{
+    using namespace gerber_lib;
+
+    //////////////////////////////////////////////////////////////////////
+    // sign of a * b - c * d, exact for anything up to 2^63
+
+    struct int128
+    {
+        int64_t hi;
+        uint64_t lo;
+    };
+
+    int128 multiply(int64_t a, int64_t b)
+    {
+        bool negative = (a < 0) != (b < 0);
+        uint64_t ua = a < 0 ? 0 - static_cast<uint64_t>(a) : static_cast<uint64_t>(a);
+        uint64_t ub = b < 0 ? 0 - static_cast<uint64_t>(b) : static_cast<uint64_t>(b);
+
+        uint64_t a_lo = ua & 0xffffffff;
+        uint64_t a_hi = ua >> 32;
+        uint64_t b_lo = ub & 0xffffffff;
+        uint64_t b_hi = ub >> 32;
+
+        uint64_t p0 = a_lo * b_lo;
+        uint64_t p1 = a_lo * b_hi;
+        uint64_t p2 = a_hi * b_lo;
+        uint64_t p3 = a_hi * b_hi;
+
+        uint64_t mid = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff);
+        uint64_t lo = (p0 & 0xffffffff) | (mid << 32);
+        uint64_t hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+
+        if(negative) {
+            lo = ~lo + 1;
+            hi = ~hi + (lo == 0 ? 1 : 0);
+        }
+        return { static_cast<int64_t>(hi), lo };
+    }
+
+    int compare_products(int64_t a, int64_t b, int64_t c, int64_t d)
+    {
+        // nearly always small enough for plain 64 bit maths
+        constexpr int64_t small = int64_t{ 1 } << 31;
+        if(a > -small && a < small && b > -small && b < small && c > -small && c < small && d > -small && d < small) {
+            int64_t ab = a * b;
+            int64_t cd = c * d;
+            return (ab > cd) - (ab < cd);
+        }
+        int128 ab = multiply(a, b);
+        int128 cd = multiply(c, d);
+        if(ab.hi != cd.hi) {
+            return ab.hi > cd.hi ? 1 : -1;
+        }
+        return (ab.lo > cd.lo) - (ab.lo < cd.lo);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // > 0 if c is left of a->b, < 0 if it's right, 0 if they're in a line
+
+    int orientation(clip_point const &a, clip_point const &b, clip_point const &c)
+    {
+        return compare_products(b.x - a.x, c.y - a.y, b.y - a.y, c.x - a.x);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // sweep order, by x then y
+
+    bool point_less(clip_point const &a, clip_point const &b)
+    {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // p is always before q in sweep order, winding is how much the winding number of each
+    // operand goes up crossing from below the segment to above it (for vertical segments,
+    // from the right to the left)
+
+    struct segment
+    {
+        clip_point p;
+        clip_point q;
+        int32_t winding[2];
+    };
+
+    void add_segment(std::vector<segment> &segments, clip_point const &from, clip_point const &to, int32_t const winding[2])
+    {
+        if(from == to) {
+            return;
+        }
+        segment &s = segments.emplace_back();
+        if(point_less(from, to)) {
+            s.p = from;
+            s.q = to;
+            s.winding[0] = winding[0];
+            s.winding[1] = winding[1];
+        } else {
+            s.p = to;
+            s.q = from;
+            s.winding[0] = -winding[0];
+            s.winding[1] = -winding[1];
+        }
+    }
+
+    void add_paths(std::vector<segment> &segments, std::vector<clip_path> const &paths, int operand)
+    {
+        int32_t winding[2]{ 0, 0 };
+        winding[operand] = 1;
+
+        for(clip_path const &path : paths) {
+            size_t n = path.size();
+            if(n < 3) {
+                continue;
+            }
+            for(size_t i = 0; i < n; ++i) {
+                add_segment(segments, path[i], path[(i + 1) % n], winding);
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool paths_in_range(std::vector<clip_path> const &paths)
+    {
+        for(clip_path const &path : paths) {
+            for(clip_point const &p : path) {
+                if(p.x < -clip_max_coordinate || p.x > clip_max_coordinate || p.y < -clip_max_coordinate || p.y > clip_max_coordinate) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // a grid over all the segments
+
+    struct segment_grid
+    {
+        int64_t min_x{ INT64_MAX };
+        int64_t min_y{ INT64_MAX };
+        double width;
+        double height;
+        double average_length;
+
+        int64_t columns;
+        int64_t rows;
+        double cell_size;
+
+        explicit segment_grid(std::vector<segment> const &segments)
+        {
+            int64_t max_x = INT64_MIN;
+            int64_t max_y = INT64_MIN;
+            double total_length = 0;
+
+            for(segment const &s : segments) {
+                min_x = std::min(min_x, s.p.x);
+                max_x = std::max(max_x, s.q.x);
+                min_y = std::min({ min_y, s.p.y, s.q.y });
+                max_y = std::max({ max_y, s.p.y, s.q.y });
+                total_length += std::max(static_cast<double>(s.q.x - s.p.x), fabs(static_cast<double>(s.q.y - s.p.y)));
+            }
+
+            width = static_cast<double>(max_x - min_x) + 3;
+            height = static_cast<double>(max_y - min_y) + 3;
+            average_length = total_length / static_cast<double>(std::max(segments.size(), size_t{ 1 }));
+        }
+
+        // about count cells, but none smaller than min_size
+        void set_cells(size_t count, double min_size)
+        {
+            cell_size = std::max({ sqrt(width * height / static_cast<double>(std::max(count, size_t{ 1 }))), min_size, 1.0 });
+            columns = static_cast<int64_t>(width / cell_size) + 1;
+            rows = static_cast<int64_t>(height / cell_size) + 1;
+        }
+
+        size_t num_cells() const
+        {
+            return static_cast<size_t>(columns * rows);
+        }
+
+        int64_t column_of(double x) const
+        {
+            return std::clamp(static_cast<int64_t>((x - static_cast<double>(min_x) + 1) / cell_size), int64_t{ 0 }, columns - 1);
+        }
+
+        int64_t row_of(double y) const
+        {
+            return std::clamp(static_cast<int64_t>((y - static_cast<double>(min_y) + 1) / cell_size), int64_t{ 0 }, rows - 1);
+        }
+
+        uint64_t cell_of(clip_point const &p) const
+        {
+            return static_cast<uint64_t>(row_of(static_cast<double>(p.y)) * columns + column_of(static_cast<double>(p.x)));
+        }
+
+        // every cell which is within a unit of the segment (and maybe a few more)
+
+        template <typename F> void for_each_cell(segment const &s, F fn) const
+        {
+            double sx = static_cast<double>(s.p.x);
+            double sy = static_cast<double>(s.p.y);
+            double ex = static_cast<double>(s.q.x);
+
+            int64_t x0 = column_of(sx - 1);
+            int64_t x1 = column_of(ex + 1);
+            int64_t y0 = row_of(static_cast<double>(std::min(s.p.y, s.q.y)) - 1);
+            int64_t y1 = row_of(static_cast<double>(std::max(s.p.y, s.q.y)) + 1);
+
+            if(x0 == x1 || y0 == y1 || s.p.x == s.q.x) {
+                for(int64_t y = y0; y <= y1; ++y) {
+                    for(int64_t x = x0; x <= x1; ++x) {
+                        fn(static_cast<uint64_t>(y * columns + x));
+                    }
+                }
+                return;
+            }
+
+            // diagonals only go in the cells they pass through
+            double slope = static_cast<double>(s.q.y - s.p.y) / (ex - sx);
+
+            for(int64_t x = x0; x <= x1; ++x) {
+                double left = std::clamp(static_cast<double>(min_x) - 1 + static_cast<double>(x) * cell_size, sx, ex);
+                double right = std::clamp(static_cast<double>(min_x) - 1 + static_cast<double>(x + 1) * cell_size, sx, ex);
+                double ya = sy + (left - sx) * slope;
+                double yb = sy + (right - sx) * slope;
+                int64_t r0 = std::clamp(row_of(std::min(ya, yb) - 2), y0, y1);
+                int64_t r1 = std::clamp(row_of(std::max(ya, yb) + 2), y0, y1);
+                for(int64_t y = r0; y <= r1; ++y) {
+                    fn(static_cast<uint64_t>(y * columns + x));
+                }
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // where two segments properly cross (not at an end of either), rounded to the nearest unit
+
+    bool crossing_point(segment const &s, segment const &t, clip_point &c)
+    {
+        int o1 = orientation(s.p, s.q, t.p);
+        int o2 = orientation(s.p, s.q, t.q);
+        if(o1 == 0 || o2 == 0 || (o1 > 0) == (o2 > 0)) {
+            return false;
+        }
+        int o3 = orientation(t.p, t.q, s.p);
+        int o4 = orientation(t.p, t.q, s.q);
+        if(o3 == 0 || o4 == 0 || (o3 > 0) == (o4 > 0)) {
+            return false;
+        }
+
+        double ax = static_cast<double>(s.p.x);
+        double ay = static_cast<double>(s.p.y);
+        double bx = static_cast<double>(s.q.x) - ax;
+        double by = static_cast<double>(s.q.y) - ay;
+        double cx = static_cast<double>(t.p.x) - ax;
+        double cy = static_cast<double>(t.p.y) - ay;
+        double dx = static_cast<double>(t.q.x) - static_cast<double>(t.p.x);
+        double dy = static_cast<double>(t.q.y) - static_cast<double>(t.p.y);
+
+        double u = (cx * dy - cy * dx) / (bx * dy - by * dx);
+
+        c = { llround(ax + bx * u), llround(ay + by * u) };
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // does the segment go through the unit square centred on h (but not start or end there)
+
+    bool crosses_pixel(segment const &s, clip_point const &h)
+    {
+        if(h == s.p || h == s.q) {
+            return false;
+        }
+
+        // everything doubled so the corners are whole numbers
+        int64_t left = h.x * 2 - 1;
+        int64_t right = h.x * 2 + 1;
+        int64_t bottom = h.y * 2 - 1;
+        int64_t top = h.y * 2 + 1;
+
+        if(s.p.x * 2 > right || s.q.x * 2 < left || std::min(s.p.y, s.q.y) * 2 > top || std::max(s.p.y, s.q.y) * 2 < bottom) {
+            return false;
+        }
+
+        clip_point p{ s.p.x * 2, s.p.y * 2 };
+        clip_point q{ s.q.x * 2, s.q.y * 2 };
+
+        int o1 = orientation(p, q, { left, bottom });
+        int o2 = orientation(p, q, { right, bottom });
+        int o3 = orientation(p, q, { left, top });
+        int o4 = orientation(p, q, { right, top });
+
+        return !((o1 > 0 && o2 > 0 && o3 > 0 && o4 > 0) || (o1 < 0 && o2 < 0 && o3 < 0 && o4 < 0));
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // which things are in each cell of a grid, the things in cell c are
+    // items[offsets[c]] .. items[offsets[c + 1] - 1]
+
+    struct cell_lists
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> items;
+
+        // add(i, fn) calls fn(cell) for each cell which item i is in
+        template <typename F> void build(size_t num_cells, size_t num_items, F add)
+        {
+            offsets.assign(num_cells + 1, 0);
+            for(uint32_t i = 0; i < num_items; ++i) {
+                add(i, [&](uint64_t cell) { offsets[cell + 1] += 1; });
+            }
+            for(size_t c = 0; c < num_cells; ++c) {
+                offsets[c + 1] += offsets[c];
+            }
+            items.resize(offsets[num_cells]);
+            std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+            for(uint32_t i = 0; i < num_items; ++i) {
+                add(i, [&](uint64_t cell) { items[next[cell]++] = i; });
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct split_point
+    {
+        uint32_t segment_index;
+        clip_point point;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Snap rounding: every end and every crossing is a hot pixel and any segment which goes
+    // through a hot pixel gets bent to go through the middle of it. That can take a piece
+    // through another hot pixel, so the new pieces get checked again until nothing changes.
+    // After that nothing crosses except at the ends, although segments can end up on top
+    // of each other. If it hasn't settled down after a few passes some segments might still
+    // cross and the sweep can't cope with that, so give up
+
+    gerber_error_code split_segments(std::vector<segment> &segments)
+    {
+        size_t num_segments = segments.size();
+        if(num_segments == 0) {
+            return ok;
+        }
+
+        // one segment per cell to find the crossings, unless they're long
+
+        segment_grid grid(segments);
+        grid.set_cells(num_segments, grid.average_length);
+
+        cell_lists segment_cells;
+        segment_cells.build(grid.num_cells(), num_segments, [&](uint32_t i, auto fn) { grid.for_each_cell(segments[i], fn); });
+
+        // the crossings, a pair which shares more than one cell gets found more than once but
+        // that just makes the same hot pixel again
+
+        std::vector<clip_point> hot_pixels;
+        hot_pixels.reserve(num_segments * 2);
+
+        for(size_t c = 0; c < grid.num_cells(); ++c) {
+
+            uint32_t const *begin = segment_cells.items.data() + segment_cells.offsets[c];
+            uint32_t const *end = segment_cells.items.data() + segment_cells.offsets[c + 1];
+
+            for(uint32_t const *a = begin; a < end; ++a) {
+
+                segment const &s = segments[*a];
+                int64_t s_min_y = std::min(s.p.y, s.q.y);
+                int64_t s_max_y = std::max(s.p.y, s.q.y);
+
+                for(uint32_t const *b = a + 1; b < end; ++b) {
+
+                    segment const &t = segments[*b];
+
+                    if(t.p.x < s.q.x && t.q.x > s.p.x && std::min(t.p.y, t.q.y) < s_max_y && std::max(t.p.y, t.q.y) > s_min_y) {
+                        clip_point cross;
+                        if(crossing_point(s, t, cross)) {
+                            hot_pixels.push_back(cross);
+                        }
+                    }
+                }
+            }
+        }
+        segment_cells = {};
+
+        size_t num_crossings = hot_pixels.size();
+
+        for(segment const &s : segments) {
+            hot_pixels.push_back(s.p);
+            hot_pixels.push_back(s.q);
+        }
+
+        std::sort(hot_pixels.begin(), hot_pixels.end(), [](clip_point const &a, clip_point const &b) { return point_less(a, b); });
+        hot_pixels.erase(std::unique(hot_pixels.begin(), hot_pixels.end()), hot_pixels.end());
+
+        // then one hot pixel per cell to find which segments go through them
+
+        grid.set_cells(hot_pixels.size(), 1);
+
+        cell_lists pixel_cells;
+        pixel_cells.build(grid.num_cells(), hot_pixels.size(), [&](uint32_t i, auto fn) { fn(grid.cell_of(hot_pixels[i])); });
+
+        LOG_DEBUG("{} segments, {} crossings, {} hot pixels", num_segments, num_crossings, hot_pixels.size());
+
+        // bend the segments through their hot pixels, then the pieces that made and so on
+
+        constexpr int max_passes = 16;
+
+        std::vector<segment> done;
+        done.reserve(num_segments + hot_pixels.size());
+
+        std::vector<segment> pieces;
+        std::vector<clip_point> points;
+
+        for(int pass = 0; pass < max_passes && !segments.empty(); ++pass) {
+
+            pieces.clear();
+
+            for(segment const &s : segments) {
+
+                points.clear();
+
+                grid.for_each_cell(s, [&](uint64_t cell) {
+                    for(uint32_t n = pixel_cells.offsets[cell]; n < pixel_cells.offsets[cell + 1]; ++n) {
+                        clip_point const &h = hot_pixels[pixel_cells.items[n]];
+                        if(crosses_pixel(s, h)) {
+                            points.push_back(h);
+                        }
+                    }
+                });
+
+                if(points.empty()) {
+                    done.push_back(s);
+                    continue;
+                }
+
+                // hot pixels can be slightly off the line so order them by how far along it they are
+
+                double dx = static_cast<double>(s.q.x - s.p.x);
+                double dy = static_cast<double>(s.q.y - s.p.y);
+
+                auto along = [&](clip_point const &c) { return static_cast<double>(c.x - s.p.x) * dx + static_cast<double>(c.y - s.p.y) * dy; };
+
+                std::sort(points.begin(), points.end(), [&](clip_point const &a, clip_point const &b) { return along(a) < along(b); });
+                points.erase(std::unique(points.begin(), points.end()), points.end());
+
+                clip_point from = s.p;
+                for(clip_point const &to : points) {
+                    add_segment(pieces, from, to, s.winding);
+                    from = to;
+                }
+                add_segment(pieces, from, s.q, s.winding);
+            }
+
+            LOG_DEBUG("Pass {}: {} new pieces", pass, pieces.size());
+
+            segments.swap(pieces);
+        }
+
+        if(!segments.empty()) {
+            LOG_ERROR("Still splitting {} segments after {} passes", segments.size(), max_passes);
+            return error_clipping_failed;
+        }
+        segments.swap(done);
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the same segment from different places becomes one, windings add up
+
+    void merge_segments(std::vector<segment> &segments)
+    {
+        std::sort(segments.begin(), segments.end(), [](segment const &a, segment const &b) {
+            if(a.p != b.p) {
+                return point_less(a.p, b.p);
+            }
+            return point_less(a.q, b.q);
+        });
+
+        size_t out = 0;
+        for(size_t i = 0; i < segments.size();) {
+            segment s = segments[i];
+            size_t j = i + 1;
+            for(; j < segments.size() && segments[j].p == s.p && segments[j].q == s.q; ++j) {
+                s.winding[0] += segments[j].winding[0];
+                s.winding[1] += segments[j].winding[1];
+            }
+            if(s.winding[0] != 0 || s.winding[1] != 0) {
+                segments[out++] = s;
+            }
+            i = j;
+        }
+        segments.resize(out);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct directed_edge
+    {
+        clip_point from;
+        clip_point to;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // the segments which a vertical line at the sweep position goes through, bottom to
+    // top. None of them cross so any two which are in at the same time can be compared
+    // without knowing where the sweep is
+
+    struct status_less
+    {
+        std::vector<segment> const *segments;
+
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            if(a == b) {
+                return false;
+            }
+            segment const &s = (*segments)[a];
+            segment const &t = (*segments)[b];
+
+            if(s.p == t.p) {
+                int o = orientation(s.p, s.q, t.q);
+                return o != 0 ? o > 0 : a < b;
+            }
+            if(point_less(s.p, t.p)) {
+                int o = orientation(s.p, s.q, t.p);
+                if(o == 0) {
+                    o = orientation(s.p, s.q, t.q);
+                }
+                return o != 0 ? o > 0 : a < b;
+            }
+            int o = orientation(t.p, t.q, s.p);
+            if(o == 0) {
+                o = orientation(t.p, t.q, s.q);
+            }
+            return o != 0 ? o < 0 : a < b;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // sweep left to right working out the winding numbers either side of every segment,
+    // keep the ones which have the inside on one side and the outside on the other. They
+    // come out pointing so the inside is on the left
+
+    void classify_segments(std::vector<segment> const &segments, clip_operation operation, clip_fill_rule fill_rule, std::vector<directed_edge> &edges)
+    {
+        auto filled = [fill_rule](int32_t w) { return fill_rule == clip_even_odd ? (w & 1) != 0 : w != 0; };
+
+        auto inside = [&](int32_t const w[2]) {
+            bool a = filled(w[0]);
+            bool b = filled(w[1]);
+            switch(operation) {
+            case clip_union:
+                return a || b;
+            case clip_intersection:
+                return a && b;
+            case clip_difference:
+                return a && !b;
+            case clip_xor:
+                return a != b;
+            }
+            return false;
+        };
+
+        uint32_t num_segments = static_cast<uint32_t>(segments.size());
+
+        // segment * 2 + 1 for the left end, segment * 2 for the right end
+
+        std::vector<uint32_t> events(num_segments * 2);
+        for(uint32_t i = 0; i < num_segments * 2; ++i) {
+            events[i] = i;
+        }
+
+        std::sort(events.begin(), events.end(), [&](uint32_t a, uint32_t b) {
+            segment const &s = segments[a >> 1];
+            segment const &t = segments[b >> 1];
+            clip_point const &sp = (a & 1) ? s.p : s.q;
+            clip_point const &tp = (b & 1) ? t.p : t.q;
+            if(sp != tp) {
+                return point_less(sp, tp);
+            }
+            // right ends first, then left ends bottom to top
+            if((a & 1) != (b & 1)) {
+                return (a & 1) == 0;
+            }
+            if((a & 1) != 0) {
+                int o = orientation(sp, s.q, t.q);
+                if(o != 0) {
+                    return o > 0;
+                }
+            }
+            return a < b;
+        });
+
+        using status_set = std::set<uint32_t, status_less>;
+
+        status_set status(status_less{ &segments });
+        std::vector<status_set::iterator> where(num_segments, status.end());
+
+        struct windings
+        {
+            int32_t below[2];
+            int32_t above[2];
+        };
+
+        std::vector<windings> winding(num_segments);
+
+        for(uint32_t event : events) {
+
+            uint32_t i = event >> 1;
+
+            if((event & 1) == 0) {
+                if(where[i] != status.end()) {
+                    status.erase(where[i]);
+                    where[i] = status.end();
+                }
+                continue;
+            }
+
+            auto [it, inserted] = status.insert(i);
+            if(!inserted) {
+                LOG_WARNING("Overlapping segments in sweep");
+                continue;
+            }
+            where[i] = it;
+
+            windings &w = winding[i];
+            segment const &s = segments[i];
+
+            if(it == status.begin()) {
+                w.below[0] = 0;
+                w.below[1] = 0;
+            } else {
+                windings const &b = winding[*std::prev(it)];
+                w.below[0] = b.above[0];
+                w.below[1] = b.above[1];
+            }
+            w.above[0] = w.below[0] + s.winding[0];
+            w.above[1] = w.below[1] + s.winding[1];
+
+            bool in_below = inside(w.below);
+            bool in_above = inside(w.above);
+
+            if(in_below != in_above) {
+                if(in_above) {
+                    edges.push_back({ s.p, s.q });
+                } else {
+                    edges.push_back({ s.q, s.p });
+                }
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // join the edges into rings, where more than one edge leaves a point take the
+    // sharpest left turn so rings which touch at a point stay separate
+
+    void build_rings(std::vector<directed_edge> &edges, std::vector<clip_path> &rings)
+    {
+        std::sort(edges.begin(), edges.end(), [](directed_edge const &a, directed_edge const &b) { return point_less(a.from, b.from); });
+
+        std::vector<uint8_t> used(edges.size(), 0);
+
+        auto first_from = [&](clip_point const &p) {
+            auto f = std::lower_bound(edges.begin(), edges.end(), p, [](directed_edge const &e, clip_point const &v) { return point_less(e.from, v); });
+            return static_cast<size_t>(f - edges.begin());
+        };
+
+        clip_path ring;
+        clip_path clean;
+
+        for(size_t start = 0; start < edges.size(); ++start) {
+
+            if(used[start]) {
+                continue;
+            }
+
+            ring.clear();
+            clip_point const origin = edges[start].from;
+            size_t current = start;
+
+            while(true) {
+
+                used[current] = 1;
+                directed_edge const &e = edges[current];
+                ring.push_back(e.from);
+
+                if(e.to == origin) {
+                    break;
+                }
+
+                double in_x = static_cast<double>(e.to.x - e.from.x);
+                double in_y = static_cast<double>(e.to.y - e.from.y);
+
+                size_t best = SIZE_MAX;
+                double best_turn = 0;
+
+                for(size_t n = first_from(e.to); n < edges.size() && edges[n].from == e.to; ++n) {
+                    if(used[n]) {
+                        continue;
+                    }
+                    double out_x = static_cast<double>(edges[n].to.x - edges[n].from.x);
+                    double out_y = static_cast<double>(edges[n].to.y - edges[n].from.y);
+                    double turn = atan2(in_x * out_y - in_y * out_x, in_x * out_x + in_y * out_y);
+                    if(best == SIZE_MAX || turn > best_turn) {
+                        best = n;
+                        best_turn = turn;
+                    }
+                }
+
+                if(best == SIZE_MAX) {
+                    LOG_WARNING("Ring doesn't close at {},{}", e.to.x, e.to.y);
+                    ring.clear();
+                    break;
+                }
+                current = best;
+            }
+
+            // drop points in the middle of straight lines
+
+            clean.clear();
+
+            for(clip_point const &p : ring) {
+                while(clean.size() >= 2 && orientation(clean[clean.size() - 2], clean.back(), p) == 0) {
+                    clean.pop_back();
+                }
+                clean.push_back(p);
+            }
+
+            size_t first = 0;
+            bool changed = true;
+            while(changed && clean.size() - first >= 3) {
+                changed = false;
+                if(orientation(clean[clean.size() - 2], clean.back(), clean[first]) == 0) {
+                    clean.pop_back();
+                    changed = true;
+                } else if(orientation(clean.back(), clean[first], clean[first + 1]) == 0) {
+                    first += 1;
+                    changed = true;
+                }
+            }
+
+            if(clean.size() - first >= 3) {
+                rings.emplace_back(clean.begin() + first, clean.end());
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct bounds
+    {
+        int64_t min_x{ INT64_MAX };
+        int64_t min_y{ INT64_MAX };
+        int64_t max_x{ INT64_MIN };
+        int64_t max_y{ INT64_MIN };
+
+        void add(clip_point const &p)
+        {
+            min_x = std::min(min_x, p.x);
+            min_y = std::min(min_y, p.y);
+            max_x = std::max(max_x, p.x);
+            max_y = std::max(max_y, p.y);
+        }
+    };
+
+    bool point_in_ring(clip_path const &ring, double x, double y)
+    {
+        bool in = false;
+        size_t n = ring.size();
+        for(size_t i = 0, j = n - 1; i < n; j = i++) {
+            double xi = static_cast<double>(ring[i].x);
+            double yi = static_cast<double>(ring[i].y);
+            double xj = static_cast<double>(ring[j].x);
+            double yj = static_cast<double>(ring[j].y);
+            if((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi) {
+                in = !in;
+            }
+        }
+        return in;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // counter clockwise rings are outlines, clockwise ones are holes and each hole
+    // belongs to the smallest outline which has it inside
+
+    std::vector<clip_polygon> make_polygons(std::vector<clip_path> &rings)
+    {
+        std::vector<clip_polygon> polygons;
+
+        struct outline
+        {
+            size_t polygon;
+            double area;
+            bounds box;
+        };
+
+        std::vector<outline> outlines;
+        std::vector<size_t> holes;
+        bounds all;
+
+        for(size_t i = 0; i < rings.size(); ++i) {
+            double area = clip_path_area2(rings[i]);
+            if(area < 0) {
+                holes.push_back(i);
+                continue;
+            }
+            if(area == 0) {
+                continue;
+            }
+            outline &o = outlines.emplace_back();
+            o.polygon = polygons.size();
+            o.area = area;
+            for(clip_point const &p : rings[i]) {
+                o.box.add(p);
+            }
+            all.add({ o.box.min_x, o.box.min_y });
+            all.add({ o.box.max_x, o.box.max_y });
+            polygons.emplace_back().outer = std::move(rings[i]);
+        }
+
+        if(holes.empty()) {
+            return polygons;
+        }
+
+        if(outlines.empty()) {
+            LOG_WARNING("{} holes but no outlines", holes.size());
+            return polygons;
+        }
+
+        // outlines go in every cell they cover unless that's lots, then they always get checked
+
+        constexpr int64_t max_outline_cells = 64;
+
+        int64_t cells_across = static_cast<int64_t>(sqrt(static_cast<double>(outlines.size()))) + 1;
+        double cell_width = (static_cast<double>(all.max_x - all.min_x) + 1) / static_cast<double>(cells_across);
+        double cell_height = (static_cast<double>(all.max_y - all.min_y) + 1) / static_cast<double>(cells_across);
+
+        auto column_of = [&](double x) { return std::clamp(static_cast<int64_t>((x - static_cast<double>(all.min_x)) / cell_width), int64_t{ 0 }, cells_across - 1); };
+        auto row_of = [&](double y) { return std::clamp(static_cast<int64_t>((y - static_cast<double>(all.min_y)) / cell_height), int64_t{ 0 }, cells_across - 1); };
+
+        std::vector<std::vector<uint32_t>> cells(cells_across * cells_across);
+        std::vector<uint32_t> big_outlines;
+
+        for(uint32_t i = 0; i < outlines.size(); ++i) {
+            bounds const &b = outlines[i].box;
+            int64_t x0 = column_of(static_cast<double>(b.min_x));
+            int64_t x1 = column_of(static_cast<double>(b.max_x));
+            int64_t y0 = row_of(static_cast<double>(b.min_y));
+            int64_t y1 = row_of(static_cast<double>(b.max_y));
+            if((x1 - x0 + 1) * (y1 - y0 + 1) > max_outline_cells) {
+                big_outlines.push_back(i);
+                continue;
+            }
+            for(int64_t y = y0; y <= y1; ++y) {
+                for(int64_t x = x0; x <= x1; ++x) {
+                    cells[y * cells_across + x].push_back(i);
+                }
+            }
+        }
+
+        for(size_t h : holes) {
+
+            clip_path &hole = rings[h];
+
+            // the middle of an edge can't be on any other ring
+            double x = (static_cast<double>(hole[0].x) + static_cast<double>(hole[1].x)) / 2;
+            double y = (static_cast<double>(hole[0].y) + static_cast<double>(hole[1].y)) / 2;
+
+            outline const *best = nullptr;
+
+            auto check = [&](uint32_t i) {
+                outline const &o = outlines[i];
+                if(best != nullptr && o.area >= best->area) {
+                    return;
+                }
+                if(x < static_cast<double>(o.box.min_x) || x > static_cast<double>(o.box.max_x) || y < static_cast<double>(o.box.min_y) ||
+                   y > static_cast<double>(o.box.max_y)) {
+                    return;
+                }
+                if(point_in_ring(polygons[o.polygon].outer, x, y)) {
+                    best = &o;
+                }
+            };
+
+            for(uint32_t i : cells[row_of(y) * cells_across + column_of(x)]) {
+                check(i);
+            }
+            for(uint32_t i : big_outlines) {
+                check(i);
+            }
+
+            if(best == nullptr) {
+                LOG_WARNING("Hole isn't inside anything");
+                continue;
+            }
+            polygons[best->polygon].holes.push_back(std::move(hole));
+        }
+        return polygons;
+    }
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code clip_polygons(std::vector<clip_path> const &subject, std::vector<clip_path> const &clip, clip_operation operation, clip_fill_rule fill_rule,
+                                    std::vector<clip_polygon> &polygons)
+    {
+        polygons.clear();
+
+        if(!paths_in_range(subject) || !paths_in_range(clip)) {
+            LOG_ERROR("Coordinates out of range for clipping");
+            return error_clipping_failed;
+        }
+
+        std::vector<segment> segments;
+        add_paths(segments, subject, 0);
+        add_paths(segments, clip, 1);
+
+        // lots of shapes have edges in common, no point splitting them all
+        merge_segments(segments);
+        CHECK(split_segments(segments));
+        merge_segments(segments);
+
+        std::vector<directed_edge> edges;
+        classify_segments(segments, operation, fill_rule, edges);
+        segments = {};
+
+        std::vector<clip_path> rings;
+        build_rings(edges, rings);
+
+        polygons = make_polygons(rings);
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void append_polygon_paths(std::vector<clip_polygon> const &polygons, std::vector<clip_path> &paths)
+    {
+        for(clip_polygon const &polygon : polygons) {
+            paths.push_back(polygon.outer);
+            paths.insert(paths.end(), polygon.holes.begin(), polygon.holes.end());
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    double clip_path_area2(clip_path const &path)
+    {
+        size_t n = path.size();
+        if(n < 3) {
+            return 0;
+        }
+        // relative to the first point to keep the numbers small
+        double ox = static_cast<double>(path[0].x);
+        double oy = static_cast<double>(path[0].y);
+        double area = 0;
+        for(size_t i = 1; i + 1 < n; ++i) {
+            double ax = static_cast<double>(path[i].x) - ox;
+            double ay = static_cast<double>(path[i].y) - oy;
+            double bx = static_cast<double>(path[i + 1].x) - ox;
+            double by = static_cast<double>(path[i + 1].y) - oy;
+            area += ax * by - ay * bx;
+        }
+        return area;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    int clip_path_turns(clip_path const &path)
+    {
+        size_t n = path.size();
+        if(n < 3) {
+            return 0;
+        }
+        double total = 0;
+        for(size_t i = 0; i < n; ++i) {
+            clip_point const &a = path[i];
+            clip_point const &b = path[(i + 1) % n];
+            clip_point const &c = path[(i + 2) % n];
+            double in_x = static_cast<double>(b.x - a.x);
+            double in_y = static_cast<double>(b.y - a.y);
+            double out_x = static_cast<double>(c.x - b.x);
+            double out_y = static_cast<double>(c.y - b.y);
+            total += atan2(in_x * out_y - in_y * out_x, in_x * out_x + in_y * out_y);
+        }
+        return static_cast<int>(lround(total / (2 * M_PI)));
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void clip_path_from_elements(gerber_draw_element const *elements, size_t num_elements, double tolerance, clip_path &path)
+    {
+        path.clear();
+
+        auto add_point = [&](vec2d const &p) {
+            clip_point c = clip_point_from_mm(p);
+            if(path.empty() || path.back() != c) {
+                path.push_back(c);
+            }
+        };
+
+        for(size_t i = 0; i < num_elements; ++i) {
+
+            gerber_draw_element const &e = elements[i];
+
+            switch(e.draw_element_type) {
+
+            case draw_element_line:
+                add_point(e.line_start);
+                add_point(e.line_end);
+                break;
+
+            case draw_element_arc: {
+                double start = deg_2_rad(e.start_degrees);
+                double sweep = deg_2_rad(e.end_degrees - e.start_degrees);
+
+                // the most a chord can turn through and stay within tolerance of the arc
+                double max_step = M_PI / 4;
+                if(e.radius > tolerance) {
+                    max_step = std::min(max_step, 2 * acos(1 - tolerance / e.radius));
+                }
+                int steps = std::max(1, static_cast<int>(ceil(fabs(sweep) / max_step)));
+
+                for(int n = 0; n <= steps; ++n) {
+                    double a = start + sweep * n / steps;
+                    add_point({ e.arc_center.x + cos(a) * e.radius, e.arc_center.y + sin(a) * e.radius });
+                }
+            } break;
+            }
+        }
+
+        while(path.size() > 1 && path.back() == path.front()) {
+            path.pop_back();
+        }
+    }
+
+}    // namespace gerber_lib
@@ -0,0 +1,511 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "gerber_draw_list.h"
+
+namespace
+{
+    using namespace gerber_lib;
+
+    //////////////////////////////////////////////////////////////////////
+    // a copy of some shapes moved by offset, with their elements renumbered from 0
+
+    void move_shapes(gerber_draw_element const *elements, gerber_draw_shape const *shapes, size_t num_shapes, vec2d const &offset,
+                     std::vector<gerber_draw_element> &moved_elements, std::vector<gerber_draw_shape> &moved_shapes)
+    {
+        moved_elements.clear();
+        moved_shapes.clear();
+        for(size_t i = 0; i < num_shapes; ++i) {
+            gerber_draw_shape shape = shapes[i];
+            gerber_draw_element const *e = elements + shape.first_element;
+            shape.first_element = static_cast<uint32_t>(moved_elements.size());
+            moved_shapes.push_back(shape);
+            for(uint32_t n = 0; n < shape.num_elements; ++n) {
+                gerber_draw_element &m = moved_elements.emplace_back(e[n]);
+                if(m.draw_element_type == draw_element_line) {
+                    m.line_start = m.line_start.add(offset);
+                    m.line_end = m.line_end.add(offset);
+                } else {
+                    m.arc_center = m.arc_center.add(offset);
+                }
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // a dark shape in an aperture gets the polarity of the flash, a clear one the opposite
+
+    gerber_polarity flashed_polarity(gerber_polarity shape_polarity, gerber_polarity flash_polarity)
+    {
+        if(shape_polarity != polarity_clear) {
+            return flash_polarity;
+        }
+        return flash_polarity == polarity_clear ? polarity_dark : polarity_clear;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // some of an aperture's shapes moved to where it's flashed
+
+    void flash_shapes(gerber_draw_element const *elements, gerber_draw_shape const *shapes, size_t num_shapes, gerber_flash const &flash, gerber_polarity polarity,
+                      std::vector<gerber_draw_element> &moved_elements, std::vector<gerber_draw_shape> &moved_shapes)
+    {
+        move_shapes(elements, shapes, num_shapes, flash.pos, moved_elements, moved_shapes);
+        for(gerber_draw_shape &shape : moved_shapes) {
+            shape.polarity = flashed_polarity(shape.polarity, polarity);
+            shape.entity_id = flash.entity_id;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // a flash run to a drawer which draws flashes, with its aperture first if the drawer hasn't had it yet
+
+    void send_flash_run(gerber_draw_list const &list, gerber_draw_interface &drawer, gerber_flash_run const &flash_run, std::vector<bool> &defined_apertures)
+    {
+        gerber_aperture_shapes const *aperture = list.find_aperture(flash_run.aperture_id);
+        if(aperture == nullptr) {
+            return;
+        }
+        size_t id = static_cast<size_t>(aperture->aperture_id);
+        if(id >= defined_apertures.size()) {
+            defined_apertures.resize(id + 1, false);
+        }
+        if(!defined_apertures[id]) {
+            drawer.define_aperture(aperture->aperture_id, list.aperture_elements.data(), list.aperture_shapes.data() + aperture->first_shape, aperture->num_shapes);
+            defined_apertures[id] = true;
+        }
+        drawer.flash_aperture(flash_run.aperture_id, flash_run.polarity, list.flashes.data() + flash_run.first_flash, flash_run.num_flashes);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // replay() works out a list of these first
+
+    enum replay_step_type
+    {
+        step_shapes,          // a run, maybe moved to a repeat offset
+        step_flash,           // some shapes of an aperture moved to a flash
+        step_flash_run,       // a flash run, to a drawer which draws flashes
+        step_begin_repeat,    // to a drawer which draws repeats
+        step_end_repeat
+    };
+
+    static constexpr uint32_t not_moved = UINT32_MAX;
+
+    struct replay_step
+    {
+        replay_step_type type;
+        uint32_t index;                // run, flash run or repeat
+        uint32_t offset{};             // repeat offset (or not_moved) for a run, flash for a flash
+        uint32_t first_shape{};        // in shapes for a run, aperture_shapes for a flash
+        uint32_t num_shapes{};
+        size_t num_elements{};
+        gerber_polarity polarity{};
+    };
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::set_gerber(gerber *g)
+    {
+        (void)g;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::fill_elements(gerber_draw_element const *draw_elements, size_t num_elements, gerber_polarity polarity, int entity_id)
+    {
+        shapes.push_back({ static_cast<uint32_t>(elements.size()), static_cast<uint32_t>(num_elements), polarity, entity_id });
+        elements.insert(elements.end(), draw_elements, draw_elements + num_elements);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool gerber_draw_list::draws_repeats() const
+    {
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::begin_repeat(vec2d const *offsets, size_t num_offsets)
+    {
+        repeats.push_back({ static_cast<uint32_t>(shapes.size()), 0, static_cast<uint32_t>(repeat_offsets.size()), static_cast<uint32_t>(num_offsets) });
+        repeat_offsets.insert(repeat_offsets.end(), offsets, offsets + num_offsets);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::end_repeat()
+    {
+        if(!repeats.empty()) {
+            repeats.back().num_shapes = static_cast<uint32_t>(shapes.size()) - repeats.back().first_shape;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool gerber_draw_list::draws_flashes() const
+    {
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::define_aperture(int aperture_id, gerber_draw_element const *draw_elements, gerber_draw_shape const *draw_shapes, size_t num_shapes)
+    {
+        if(find_aperture(aperture_id) != nullptr) {
+            return;
+        }
+        apertures.push_back({ aperture_id, static_cast<uint32_t>(aperture_shapes.size()), static_cast<uint32_t>(num_shapes) });
+        for(size_t i = 0; i < num_shapes; ++i) {
+            gerber_draw_shape shape = draw_shapes[i];
+            gerber_draw_element const *e = draw_elements + shape.first_element;
+            shape.first_element = static_cast<uint32_t>(aperture_elements.size());
+            aperture_shapes.push_back(shape);
+            aperture_elements.insert(aperture_elements.end(), e, e + shape.num_elements);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::flash_aperture(int aperture_id, gerber_polarity polarity, gerber_flash const *draw_flashes, size_t num_flashes)
+    {
+        uint32_t before_shape = static_cast<uint32_t>(shapes.size());
+        if(!flash_runs.empty() && flash_runs.back().before_shape == before_shape && flash_runs.back().aperture_id == aperture_id &&
+           flash_runs.back().polarity == polarity) {
+            flash_runs.back().num_flashes += static_cast<uint32_t>(num_flashes);
+        } else {
+            flash_runs.push_back({ before_shape, aperture_id, polarity, static_cast<uint32_t>(flashes.size()), static_cast<uint32_t>(num_flashes) });
+        }
+        flashes.insert(flashes.end(), draw_flashes, draw_flashes + num_flashes);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_aperture_shapes const *gerber_draw_list::find_aperture(int aperture_id) const
+    {
+        for(gerber_aperture_shapes const &aperture : apertures) {
+            if(aperture.aperture_id == aperture_id) {
+                return &aperture;
+            }
+        }
+        return nullptr;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::find_polarity_runs()
+    {
+        // where repeats start and end and where there are flashes
+        std::vector<uint32_t> splits;
+        for(gerber_repeat const &repeat : repeats) {
+            if(repeat.num_shapes != 0) {
+                splits.push_back(repeat.first_shape);
+                splits.push_back(repeat.first_shape + repeat.num_shapes);
+            }
+        }
+        for(gerber_flash_run const &flash_run : flash_runs) {
+            splits.push_back(flash_run.before_shape);
+        }
+        std::sort(splits.begin(), splits.end());
+        size_t next_split = 0;
+
+        runs.clear();
+        for(uint32_t i = 0; i < static_cast<uint32_t>(shapes.size()); ++i) {
+            gerber_draw_shape const &shape = shapes[i];
+            bool split = false;
+            while(next_split < splits.size() && splits[next_split] <= i) {
+                split |= splits[next_split] == i;
+                next_split += 1;
+            }
+            if(runs.empty() || runs.back().polarity != shape.polarity || split) {
+                runs.push_back({ i, 0, 0, shape.polarity });
+            }
+            gerber_polarity_run &run = runs.back();
+            run.num_shapes += 1;
+            run.num_elements += shape.num_elements;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_draw_list::replay(gerber_draw_interface &drawer) const
+    {
+        // first work out what to send in what order, then shapes next to each
+        // other with the same polarity (from different runs, copies of runs or
+        // flashes) become one polarity run
+
+        bool repeats_drawn = drawer.draws_repeats();
+        bool flashes_drawn = drawer.draws_flashes();
+
+        std::vector<replay_step> steps;
+        steps.reserve(runs.size());
+
+        auto add_run = [&](size_t n, uint32_t offset) {
+            gerber_polarity_run const &run = runs[n];
+            steps.push_back({ step_shapes, static_cast<uint32_t>(n), offset, run.first_shape, run.num_shapes, run.num_elements, run.polarity });
+        };
+
+        // flash runs before a shape, the ones which aren't sent as flashes become a
+        // step for each flash and each change of polarity in its aperture
+
+        size_t f = 0;
+        auto add_flashes_before = [&](uint32_t shape_index) {
+            for(; f < flash_runs.size() && flash_runs[f].before_shape <= shape_index; ++f) {
+                gerber_flash_run const &flash_run = flash_runs[f];
+                if(flashes_drawn) {
+                    steps.push_back({ step_flash_run, static_cast<uint32_t>(f) });
+                    continue;
+                }
+                gerber_aperture_shapes const *aperture = find_aperture(flash_run.aperture_id);
+                if(aperture == nullptr) {
+                    continue;
+                }
+                gerber_draw_shape const *aperture_shape = aperture_shapes.data() + aperture->first_shape;
+                for(uint32_t n = 0; n < flash_run.num_flashes; ++n) {
+                    for(uint32_t s = 0; s < aperture->num_shapes;) {
+                        gerber_polarity polarity = flashed_polarity(aperture_shape[s].polarity, flash_run.polarity);
+                        replay_step step{ step_flash, static_cast<uint32_t>(f), flash_run.first_flash + n, aperture->first_shape + s, 0, 0, polarity };
+                        for(; s < aperture->num_shapes && flashed_polarity(aperture_shape[s].polarity, flash_run.polarity) == polarity; ++s) {
+                            step.num_shapes += 1;
+                            step.num_elements += aperture_shape[s].num_elements;
+                        }
+                        steps.push_back(step);
+                    }
+                }
+            }
+        };
+
+        // repeats with no shapes don't have any runs, so skip them
+
+        size_t r = 0;
+        auto skip_empty_repeats = [&]() {
+            while(r < repeats.size() && repeats[r].num_shapes == 0) {
+                r += 1;
+            }
+        };
+        skip_empty_repeats();
+
+        for(size_t i = 0; i < runs.size();) {
+            add_flashes_before(runs[i].first_shape);
+            if(r < repeats.size() && repeats[r].first_shape == runs[i].first_shape) {
+                gerber_repeat const &repeat = repeats[r];
+                size_t end = i;
+                while(end < runs.size() && runs[end].first_shape < repeat.first_shape + repeat.num_shapes) {
+                    end += 1;
+                }
+                if(repeats_drawn) {
+                    steps.push_back({ step_begin_repeat, static_cast<uint32_t>(r) });
+                    for(size_t n = i; n < end; ++n) {
+                        add_run(n, not_moved);
+                    }
+                    steps.push_back({ step_end_repeat, static_cast<uint32_t>(r) });
+                } else {
+                    for(uint32_t o = 0; o < repeat.num_offsets; ++o) {
+                        for(size_t n = i; n < end; ++n) {
+                            add_run(n, repeat.first_offset + o);
+                        }
+                    }
+                }
+                i = end;
+                r += 1;
+                skip_empty_repeats();
+            } else {
+                add_run(i, not_moved);
+                i += 1;
+            }
+        }
+        add_flashes_before(UINT32_MAX);
+
+        auto is_shapes = [](replay_step const &step) { return step.type == step_shapes || step.type == step_flash; };
+
+        size_t total_shapes = 0;
+        size_t total_elements = 0;
+        for(replay_step const &step : steps) {
+            if(is_shapes(step)) {
+                total_shapes += step.num_shapes;
+                total_elements += step.num_elements;
+            }
+        }
+
+        std::vector<gerber_draw_element> moved_elements;
+        std::vector<gerber_draw_shape> moved_shapes;
+        std::vector<bool> defined_apertures;
+
+        drawer.begin_layer(total_shapes, total_elements);
+
+        for(size_t i = 0; i < steps.size();) {
+
+            replay_step const &step = steps[i];
+
+            switch(step.type) {
+
+            case step_begin_repeat:
+                drawer.begin_repeat(repeat_offsets.data() + repeats[step.index].first_offset, repeats[step.index].num_offsets);
+                i += 1;
+                continue;
+
+            case step_end_repeat:
+                drawer.end_repeat();
+                i += 1;
+                continue;
+
+            case step_flash_run:
+                send_flash_run(*this, drawer, flash_runs[step.index], defined_apertures);
+                i += 1;
+                continue;
+
+            default:
+                break;
+            }
+
+            gerber_polarity polarity = step.polarity;
+            size_t num_shapes = 0;
+            size_t num_elements = 0;
+            size_t end = i;
+            while(end < steps.size() && is_shapes(steps[end]) && steps[end].polarity == polarity) {
+                num_shapes += steps[end].num_shapes;
+                num_elements += steps[end].num_elements;
+                end += 1;
+            }
+
+            drawer.begin_polarity_run(polarity, num_shapes, num_elements);
+            for(; i < end; ++i) {
+                replay_step const &s = steps[i];
+                if(s.type == step_flash) {
+                    flash_shapes(aperture_elements.data(), aperture_shapes.data() + s.first_shape, s.num_shapes, flashes[s.offset],
+                                 flash_runs[s.index].polarity, moved_elements, moved_shapes);
+                    drawer.fill_shapes(moved_elements.data(), moved_shapes.data(), moved_shapes.size());
+                } else if(s.offset == not_moved) {
+                    drawer.fill_shapes(elements.data(), shapes.data() + s.first_shape, s.num_shapes);
+                } else {
+                    move_shapes(elements.data(), shapes.data() + s.first_shape, s.num_shapes, repeat_offsets[s.offset], moved_elements, moved_shapes);
+                    drawer.fill_shapes(moved_elements.data(), moved_shapes.data(), moved_shapes.size());
+                }
+            }
+            drawer.end_polarity_run();
+        }
+        drawer.end_layer();
+        return error;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::send_shapes(gerber_draw_interface &drawer) const
+    {
+        std::vector<bool> defined_apertures;
+        send_shapes(drawer, defined_apertures);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::send_shapes(gerber_draw_interface &drawer, std::vector<bool> &defined_apertures) const
+    {
+        auto send = [&](gerber_draw_element const *draw_elements, gerber_draw_shape const *draw_shapes, size_t num_shapes) {
+            for(size_t i = 0; i < num_shapes; ++i) {
+                gerber_draw_shape const &shape = draw_shapes[i];
+                drawer.fill_elements(draw_elements + shape.first_element, shape.num_elements, shape.polarity, shape.entity_id);
+            }
+        };
+
+        std::vector<gerber_draw_element> moved_elements;
+        std::vector<gerber_draw_shape> moved_shapes;
+
+        uint32_t next_shape = 0;
+        size_t r = 0;
+
+        // the shapes up to end, flashes are never inside a repeat so it can't split one
+
+        auto send_up_to = [&](uint32_t end) {
+            for(; r < repeats.size() && repeats[r].first_shape < end; ++r) {
+
+                gerber_repeat const &repeat = repeats[r];
+
+                send(elements.data(), shapes.data() + next_shape, repeat.first_shape - next_shape);
+
+                gerber_draw_shape const *block = shapes.data() + repeat.first_shape;
+                vec2d const *offsets = repeat_offsets.data() + repeat.first_offset;
+
+                if(drawer.draws_repeats()) {
+                    drawer.begin_repeat(offsets, repeat.num_offsets);
+                    send(elements.data(), block, repeat.num_shapes);
+                    drawer.end_repeat();
+                } else {
+                    for(uint32_t o = 0; o < repeat.num_offsets; ++o) {
+                        move_shapes(elements.data(), block, repeat.num_shapes, offsets[o], moved_elements, moved_shapes);
+                        send(moved_elements.data(), moved_shapes.data(), moved_shapes.size());
+                    }
+                }
+                next_shape = repeat.first_shape + repeat.num_shapes;
+            }
+            send(elements.data(), shapes.data() + next_shape, end - next_shape);
+            next_shape = end;
+        };
+
+        for(gerber_flash_run const &flash_run : flash_runs) {
+
+            send_up_to(flash_run.before_shape);
+
+            if(drawer.draws_flashes()) {
+                send_flash_run(*this, drawer, flash_run, defined_apertures);
+                continue;
+            }
+            gerber_aperture_shapes const *aperture = find_aperture(flash_run.aperture_id);
+            if(aperture == nullptr) {
+                continue;
+            }
+            for(uint32_t n = 0; n < flash_run.num_flashes; ++n) {
+                flash_shapes(aperture_elements.data(), aperture_shapes.data() + aperture->first_shape, aperture->num_shapes, flashes[flash_run.first_flash + n],
+                             flash_run.polarity, moved_elements, moved_shapes);
+                send(moved_elements.data(), moved_shapes.data(), moved_shapes.size());
+            }
+        }
+        send_up_to(static_cast<uint32_t>(shapes.size()));
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::send_flash(gerber_draw_interface &drawer, gerber_flash const &flash, gerber_polarity polarity) const
+    {
+        thread_local std::vector<gerber_draw_element> moved_elements;
+        thread_local std::vector<gerber_draw_shape> moved_shapes;
+
+        flash_shapes(elements.data(), shapes.data(), shapes.size(), flash, polarity, moved_elements, moved_shapes);
+
+        for(gerber_draw_shape const &shape : moved_shapes) {
+            drawer.fill_elements(moved_elements.data() + shape.first_element, shape.num_elements, shape.polarity, shape.entity_id);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_draw_list::clear()
+    {
+        elements.clear();
+        shapes.clear();
+        runs.clear();
+        repeats.clear();
+        repeat_offsets.clear();
+        flashes.clear();
+        flash_runs.clear();
+        aperture_elements.clear();
+        aperture_shapes.clear();
+        apertures.clear();
+        error = ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    size_t gerber_draw_list::bytes_used() const
+    {
+        return elements.capacity() * sizeof(gerber_draw_element) + shapes.capacity() * sizeof(gerber_draw_shape) +
+               runs.capacity() * sizeof(gerber_polarity_run) + repeats.capacity() * sizeof(gerber_repeat) + repeat_offsets.capacity() * sizeof(vec2d) +
+               flashes.capacity() * sizeof(gerber_flash) + flash_runs.capacity() * sizeof(gerber_flash_run) +
+               aperture_elements.capacity() * sizeof(gerber_draw_element) + aperture_shapes.capacity() * sizeof(gerber_draw_shape) +
+               apertures.capacity() * sizeof(gerber_aperture_shapes);
+    }
+
+}    // namespace gerber_lib
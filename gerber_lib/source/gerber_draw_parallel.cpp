@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////
+// Draw a layer on multiple threads
+//
+// The nets are cut into chunks (never in the middle of a region or a step and
+// repeat block) and each chunk is drawn into its own gerber_draw_list on a
+// worker thread. The calling thread hands the chunks to the real drawer in
+// order as they finish, so the drawer sees exactly the same sequence of calls
+// as draw() makes.
+
+#include <thread>
+#include <atomic>
+#include <future>
+#include <algorithm>
+
+#include "gerber_lib.h"
+#include "gerber_draw_list.h"
+
+LOG_CONTEXT("draw_parallel", info);
+
+namespace
+{
+    // don't bother with threads for fewer nets than this per chunk
+
+    constexpr size_t min_draw_chunk_nets = 16384;
+
+    // more chunks than threads so a slow chunk doesn't hold everything up
+
+    constexpr size_t draw_chunks_per_thread = 4;
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber::draw_parallel(gerber_draw_interface &drawer, int num_threads) const
+    {
+        gerber_net_store const &nets = image.net_store;
+
+        size_t num_nets = nets.size();
+
+        if(num_threads <= 0) {
+            num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+
+        size_t num_chunks = std::min(static_cast<size_t>(num_threads) * draw_chunks_per_thread, num_nets / min_draw_chunk_nets);
+
+        if(num_threads == 1 || num_chunks < 2) {
+            return draw(drawer);
+        }
+
+        // cut points, moved past the end of any region or step and repeat block they land in
+
+        std::vector<gerber_repeat_block> blocks;
+        find_repeat_blocks(0, num_nets, blocks);
+
+        std::vector<size_t> cuts{ 0 };
+
+        for(size_t i = 1; i < num_chunks; ++i) {
+            size_t cut = num_nets * i / num_chunks;
+            auto r = std::upper_bound(nets.regions.begin(), nets.regions.end(), cut, [](size_t n, gerber_region const &g) { return n < g.first_net; });
+            if(r != nets.regions.begin()) {
+                gerber_region const &region = *std::prev(r);
+                if(region.first_net < cut && region.last_net >= cut) {
+                    cut = region.last_net + 1;
+                }
+            }
+            auto b = std::upper_bound(blocks.begin(), blocks.end(), cut, [](size_t n, gerber_repeat_block const &g) { return n < g.first_net; });
+            if(b != blocks.begin() && std::prev(b)->end_net > cut) {
+                cut = std::prev(b)->end_net;
+            }
+            if(cut > cuts.back() && cut < num_nets) {
+                cuts.push_back(cut);
+            }
+        }
+        cuts.push_back(num_nets);
+
+        num_chunks = cuts.size() - 1;
+
+        LOG_VERBOSE("Drawing {} nets in {} chunks on {} threads", num_nets, num_chunks, num_threads);
+
+        struct draw_chunk
+        {
+            gerber_draw_list list;
+            std::promise<void> done;
+        };
+
+        std::vector<draw_chunk> chunks(num_chunks);
+
+        std::atomic<size_t> next_chunk{ 0 };
+
+        auto worker = [&]() {
+            for(size_t i = next_chunk++; i < num_chunks; i = next_chunk++) {
+                draw_chunk &chunk = chunks[i];
+                chunk.list.error = draw_nets(chunk.list, cuts[i], cuts[i + 1]);
+                chunk.done.set_value();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(int i = 0; i < std::min(num_threads, static_cast<int>(num_chunks)); ++i) {
+            threads.emplace_back(worker);
+        }
+
+        // hand them over in order, stop at the first error just like draw() does
+
+        gerber_error_code result = ok;
+
+        // each aperture gets defined once for the whole lot, like replay() does
+        std::vector<bool> defined_apertures;
+
+        for(size_t i = 0; i < num_chunks; ++i) {
+
+            draw_chunk &chunk = chunks[i];
+            chunk.done.get_future().wait();
+
+            chunk.list.send_shapes(drawer, defined_apertures);
+
+            result = chunk.list.error;
+            chunk.list.clear();
+
+            if(result != ok) {
+                next_chunk = num_chunks;
+                break;
+            }
+        }
+
+        for(auto &t : threads) {
+            t.join();
+        }
+        return result;
+    }
+
+}    // namespace gerber_lib
@@ -0,0 +1,241 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "gerber_log.h"
+#include "gerber_flatten.h"
+
+LOG_CONTEXT("flatten", info);
+
+namespace
+{
+    using namespace gerber_lib;
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct path_bounds
+    {
+        int64_t min_x{ INT64_MAX };
+        int64_t min_y{ INT64_MAX };
+        int64_t max_x{ INT64_MIN };
+        int64_t max_y{ INT64_MIN };
+
+        explicit path_bounds(clip_path const &path)
+        {
+            for(clip_point const &p : path) {
+                min_x = std::min(min_x, p.x);
+                min_y = std::min(min_y, p.y);
+                max_x = std::max(max_x, p.x);
+                max_y = std::max(max_y, p.y);
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // A coarse grid over a run with the cells any of its paths cover marked. Two boxes
+    // which overlap always have a cell in common, so anything which doesn't land on a
+    // marked cell can't touch the run
+
+    struct run_area
+    {
+        int64_t min_x{ INT64_MAX };
+        int64_t min_y{ INT64_MAX };
+        int64_t max_x{ INT64_MIN };
+        int64_t max_y{ INT64_MIN };
+
+        int64_t cells_across;
+        double cell_width;
+        double cell_height;
+
+        std::vector<uint8_t> marked;
+
+        explicit run_area(std::vector<clip_path> const &paths)
+        {
+            std::vector<path_bounds> boxes;
+            boxes.reserve(paths.size());
+            for(clip_path const &path : paths) {
+                path_bounds const &b = boxes.emplace_back(path);
+                min_x = std::min(min_x, b.min_x);
+                min_y = std::min(min_y, b.min_y);
+                max_x = std::max(max_x, b.max_x);
+                max_y = std::max(max_y, b.max_y);
+            }
+
+            cells_across = static_cast<int64_t>(sqrt(static_cast<double>(paths.size()))) * 2 + 1;
+            cell_width = (static_cast<double>(max_x - min_x) + 1) / static_cast<double>(cells_across);
+            cell_height = (static_cast<double>(max_y - min_y) + 1) / static_cast<double>(cells_across);
+
+            marked.assign(cells_across * cells_across, 0);
+
+            for(path_bounds const &b : boxes) {
+                for_each_cell(b, [&](int64_t cell) {
+                    marked[cell] = 1;
+                    return false;
+                });
+            }
+        }
+
+        int64_t column_of(int64_t x) const
+        {
+            return std::clamp(static_cast<int64_t>(static_cast<double>(x - min_x) / cell_width), int64_t{ 0 }, cells_across - 1);
+        }
+
+        int64_t row_of(int64_t y) const
+        {
+            return std::clamp(static_cast<int64_t>(static_cast<double>(y - min_y) / cell_height), int64_t{ 0 }, cells_across - 1);
+        }
+
+        // stops early if fn returns true
+        template <typename F> bool for_each_cell(path_bounds const &b, F fn) const
+        {
+            for(int64_t y = row_of(b.min_y); y <= row_of(b.max_y); ++y) {
+                for(int64_t x = column_of(b.min_x); x <= column_of(b.max_x); ++x) {
+                    if(fn(y * cells_across + x)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        bool might_touch(clip_path const &outline) const
+        {
+            path_bounds b(outline);
+            if(b.max_x < min_x || b.min_x > max_x || b.max_y < min_y || b.min_y > max_y) {
+                return false;
+            }
+            return for_each_cell(b, [&](int64_t cell) { return marked[cell] != 0; });
+        }
+    };
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::set_gerber(gerber *g)
+    {
+        (void)g;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::fill_elements(gerber_draw_element const *elements, size_t num_elements, gerber_polarity polarity, int entity_id)
+    {
+        (void)entity_id;
+
+        bool dark = polarity == polarity_dark || polarity == polarity_positive;
+
+        if(dark != run_dark) {
+            flush();
+            run_dark = dark;
+        }
+
+        clip_path_from_elements(elements, num_elements, arc_tolerance, shape_path);
+
+        if(shape_path.size() < 3) {
+            return;
+        }
+
+        // a simple loop comes out the same with either fill rule, anything else (rings,
+        // regions with cut-ins or several contours) gets sorted out on its own first.
+        // Everything has to go round the same way or overlapping shapes would cancel out
+
+        int turns = clip_path_turns(shape_path);
+
+        if(turns == 1 || turns == -1) {
+            if(turns == -1) {
+                std::reverse(shape_path.begin(), shape_path.end());
+            }
+            run_paths.push_back(shape_path);
+            return;
+        }
+
+        shape_paths.clear();
+        shape_paths.push_back(shape_path);
+        gerber_error_code result = clip_polygons(shape_paths, {}, clip_union, clip_even_odd, shape_polygons);
+        if(result != ok) {
+            set_error(result);
+            return;
+        }
+        append_polygon_paths(shape_polygons, run_paths);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::begin_polarity_run(gerber_polarity polarity, size_t num_shapes, size_t num_elements)
+    {
+        (void)num_elements;
+
+        flush();
+        run_dark = polarity == polarity_dark || polarity == polarity_positive;
+        run_paths.reserve(num_shapes);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::end_polarity_run()
+    {
+        flush();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::end_layer()
+    {
+        flush();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::set_error(gerber_error_code code)
+    {
+        if(error == ok) {
+            error = code;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_flattener::flush()
+    {
+        if(run_paths.empty()) {
+            return;
+        }
+
+        // only the polygons which might touch the run need clipping, the rest stay as they are
+
+        std::vector<clip_path> touched;
+        std::vector<clip_polygon> untouched;
+
+        run_area area(run_paths);
+
+        for(clip_polygon &polygon : polygons) {
+            if(area.might_touch(polygon.outer)) {
+                touched.push_back(std::move(polygon.outer));
+                touched.insert(touched.end(), std::make_move_iterator(polygon.holes.begin()), std::make_move_iterator(polygon.holes.end()));
+            } else {
+                untouched.push_back(std::move(polygon));
+            }
+        }
+
+        if(run_dark || !touched.empty()) {
+
+            std::vector<clip_polygon> clipped;
+            gerber_error_code result = clip_polygons(touched, run_paths, run_dark ? clip_union : clip_difference, clip_non_zero, clipped);
+            if(result != ok) {
+                set_error(result);
+            }
+
+            LOG_DEBUG("{} run of {} paths touched {} of {} polygons, made {}", run_dark ? "dark" : "clear", run_paths.size(), polygons.size() - untouched.size(),
+                      polygons.size(), clipped.size());
+
+            untouched.insert(untouched.end(), std::make_move_iterator(clipped.begin()), std::make_move_iterator(clipped.end()));
+        }
+
+        polygons = std::move(untouched);
+        run_paths.clear();
+    }
+
+}    // namespace gerber_lib
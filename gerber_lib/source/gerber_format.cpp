@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////
+
+#include "gerber_format.h"
+
+namespace
+{
+    //////////////////////////////////////////////////////////////////////
+
+    constexpr int64_t powers_of_ten[] = { 1LL,
+                                          10LL,
+                                          100LL,
+                                          1000LL,
+                                          10000LL,
+                                          100000LL,
+                                          1000000LL,
+                                          10000000LL,
+                                          100000000LL,
+                                          1000000000LL,
+                                          10000000000LL,
+                                          100000000000LL,
+                                          1000000000000LL,
+                                          10000000000000LL,
+                                          100000000000000LL,
+                                          1000000000000000LL,
+                                          10000000000000000LL,
+                                          100000000000000000LL,
+                                          1000000000000000000LL };
+
+    constexpr int max_power_of_ten = static_cast<int>(sizeof(powers_of_ten) / sizeof(powers_of_ten[0])) - 1;
+
+    // 1mm = 10^6 nm, 1 inch = 254 * 10^5 nm
+
+    constexpr int nanometre_digits_mm = 6;
+    constexpr int nanometre_digits_inch = 5;
+    constexpr int64_t inch_factor = 254;
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    int64_t gerber_coordinate_decoder::power_of_ten(int n)
+    {
+        if(n < 0) {
+            return 1;
+        }
+        if(n > max_power_of_ten) {
+            n = max_power_of_ten;
+        }
+        return powers_of_ten[n];
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_coordinate_decoder::gerber_coordinate_decoder()
+    {
+        setup(0, 0, 0, 0, omit_zeros_leading);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_coordinate_decoder::setup(int integral_part_x, int decimal_part_x, int integral_part_y, int decimal_part_y, gerber_omit_zeros omit_zeros)
+    {
+        pad_trailing_zeros = omit_zeros == omit_zeros_trailing;
+
+        total_digits[axis_x] = integral_part_x + decimal_part_x;
+        total_digits[axis_y] = integral_part_y + decimal_part_y;
+
+        int decimal_parts[2] = { decimal_part_x, decimal_part_y };
+
+        for(int axis = 0; axis < 2; ++axis) {
+
+            // nm = value * factor * 10^(digits - decimal_part)
+
+            int exponent_inch = nanometre_digits_inch - decimal_parts[axis];
+            int exponent_mm = nanometre_digits_mm - decimal_parts[axis];
+
+            multiplier[axis][0] = inch_factor * power_of_ten(exponent_inch);
+            divisor[axis][0] = power_of_ten(-exponent_inch);
+
+            multiplier[axis][1] = power_of_ten(exponent_mm);
+            divisor[axis][1] = power_of_ten(-exponent_mm);
+        }
+    }
+
+}    // namespace gerber_lib
@@ -1,5 +1,7 @@
 //////////////////////////////////////////////////////////////////////
 
+#include <unordered_map>
+
 #include "gerber_enums.h"
 #include "gerber_aperture.h"
 #include "gerber_net.h"
@@ -12,25 +14,74 @@ namespace gerber_lib
 
     void gerber_image::cleanup()
     {
-        for(auto p : apertures) {
-            delete p.second;
+        for(auto p : apertures.table) {
+            delete p;
         }
         apertures.clear();
 
-        for(auto n : nets) {
-            delete n;
+        for(auto m : aperture_macros) {
+            delete m;
         }
+        aperture_macros.clear();
+
         nets.clear();
+        levels.clear();
+        net_states.clear();
+
+        net_pool.clear();
+        level_pool.clear();
+        net_state_pool.clear();
+
+        net_store.clear();
 
-        for(auto l : levels) {
-            delete l;
+        info = gerber_image_info{};
+        format = gerber_format{};
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // squash the nets into net_store and free them
+
+    void gerber_image::compact_nets()
+    {
+        std::unordered_map<gerber_level const *, int32_t> level_index;
+        for(size_t i = 0; i < levels.size(); ++i) {
+            level_index[levels[i]] = static_cast<int32_t>(i);
         }
-        levels.clear();
 
-        for(auto ns : net_states) {
-            delete ns;
+        std::unordered_map<gerber_net_state const *, int32_t> net_state_index;
+        for(size_t i = 0; i < net_states.size(); ++i) {
+            net_state_index[net_states[i]] = static_cast<int32_t>(i);
         }
-        net_states.clear();
+
+        // runs of nets mostly have the same level and net state so remember the last ones
+
+        gerber_level const *level = nullptr;
+        gerber_net_state const *net_state = nullptr;
+        int32_t level_id = -1;
+        int32_t net_state_id = -1;
+
+        net_store.clear();
+        net_store.reserve(nets.size());
+
+        for(gerber_net const *net : nets) {
+            if(net->level != level) {
+                level = net->level;
+                auto f = level_index.find(level);
+                level_id = (f != level_index.end()) ? f->second : -1;
+            }
+            if(net->net_state != net_state) {
+                net_state = net->net_state;
+                auto f = net_state_index.find(net_state);
+                net_state_id = (f != net_state_index.end()) ? f->second : -1;
+            }
+            net_store.add(*net, level_id, net_state_id);
+        }
+
+        net_store.index_regions();
+
+        nets.clear();
+        nets.shrink_to_fit();
+        net_pool.clear();
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -15,6 +15,7 @@ namespace gerber_lib
             gerber_level *previous = image->levels.back();
             name = previous->name;
             step_and_repeat = previous->step_and_repeat;
+            step_and_repeat.first_instance = false;
             polarity = previous->polarity;
             knockout = previous->knockout;    // YOINK!?
             knockout.first_instance = false;
@@ -19,6 +19,7 @@
 #include "gerber_aperture.h"
 #include "gerber_image.h"
 #include "gerber_reader.h"
+#include "gerber_flatten.h"
 
 LOG_CONTEXT("gerber_lib", verbose);
 
@@ -43,15 +44,143 @@ namespace
         ;
 
     //////////////////////////////////////////////////////////////////////
+    // macro primitives are clear if their exposure is 0
 
-    void add_trailing_zeros(int integer_part, int decimal_part, int length, int *coordinate)
+    gerber_polarity exposure_polarity(double exposure)
     {
-        // LOG_DEBUG("add_trailing_zeros({},{},{}) {}", integer_part, decimal_part, length, *coordinate);
+        return exposure < 0.01 ? polarity_clear : polarity_dark;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // rotate some elements about 0,0, anticlockwise
+
+    void rotate_elements(std::vector<gerber_draw_element> &elements, double degrees)
+    {
+        matrix mat = matrix::rotate(degrees);
+        for(gerber_draw_element &e : elements) {
+            if(e.draw_element_type == draw_element_line) {
+                e.line_start = transform_point(mat, e.line_start);
+                e.line_end = transform_point(mat, e.line_end);
+            } else {
+                e.arc_center = transform_point(mat, e.arc_center);
+                if(fabs(e.end_degrees - e.start_degrees) < 360) {
+                    e.start_degrees += degrees;
+                    e.end_degrees += degrees;
+                }
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // clockwise from the bottom left
+
+    void add_rectangle(std::vector<gerber_draw_element> &elements, vec2d const &bottom_left, vec2d const &top_right)
+    {
+        vec2d bottom_right{ top_right.x, bottom_left.y };
+        vec2d top_left{ bottom_left.x, top_right.y };
+        elements.emplace_back(bottom_left, top_left);
+        elements.emplace_back(top_left, top_right);
+        elements.emplace_back(top_right, bottom_right);
+        elements.emplace_back(bottom_right, bottom_left);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // a ring is one path, round the outside, across and back round the inside the other way
+
+    void add_ring(std::vector<gerber_draw_element> &elements, vec2d const &center, double outer_radius, double inner_radius)
+    {
+        elements.emplace_back(center, 0.0, 360.0, outer_radius);
+        if(inner_radius > 0) {
+            elements.emplace_back(center, 360.0, 0.0, inner_radius);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the clear primitives of a macro only cut holes in the ones before them, not in
+    // whatever the aperture gets flashed on, so combine them all into dark shapes with
+    // holes. Apertures without any clear shapes are left alone so arcs stay arcs
+
+    constexpr double aperture_arc_tolerance = 0.001;
+
+    gerber_error_code cut_clear_shapes(gerber_draw_list &list)
+    {
+        auto is_clear = [](gerber_draw_shape const &shape) { return shape.polarity == polarity_clear; };
+
+        if(std::ranges::none_of(list.shapes, is_clear)) {
+            return ok;
+        }
+
+        std::vector<clip_polygon> polygons;
+        std::vector<clip_path> result;
+        std::vector<clip_path> run;
+        bool run_dark = true;
+
+        auto flush = [&]() {
+            if(!run.empty()) {
+                CHECK(clip_polygons(result, run, run_dark ? clip_union : clip_difference, clip_non_zero, polygons));
+                result.clear();
+                append_polygon_paths(polygons, result);
+                run.clear();
+            }
+            return ok;
+        };
+
+        clip_path path;
+        std::vector<clip_path> shape_paths;
+        std::vector<clip_polygon> shape_polygons;
+
+        for(gerber_draw_shape const &shape : list.shapes) {
+            if(is_clear(shape) == run_dark) {
+                CHECK(flush());
+                run_dark = !is_clear(shape);
+            }
+            clip_path_from_elements(list.elements.data() + shape.first_element, shape.num_elements, aperture_arc_tolerance, path);
+            if(path.size() < 3) {
+                continue;
+            }
+
+            // each shape is filled on its own (a ring is one shape going round twice), sort it out before it meets the others
+            int turns = clip_path_turns(path);
+            if(turns == 1 || turns == -1) {
+                if(turns == -1) {
+                    std::reverse(path.begin(), path.end());
+                }
+                run.push_back(path);
+            } else {
+                shape_paths.assign(1, path);
+                CHECK(clip_polygons(shape_paths, {}, clip_union, clip_even_odd, shape_polygons));
+                append_polygon_paths(shape_polygons, run);
+            }
+        }
+        CHECK(flush());
+
+        // each polygon is one shape, the outside then the holes
+        int entity_id = list.shapes.front().entity_id;
+        list.shapes.clear();
+        list.elements.clear();
 
-        int omitted_value = (integer_part + decimal_part) - length;
-        for(int x = 0; x < omitted_value; x++) {
-            *coordinate *= 10;
+        std::vector<gerber_draw_element> elements;
+        auto add_path = [&](clip_path const &p) {
+            for(size_t i = 0; i < p.size(); ++i) {
+                elements.emplace_back(mm_from_clip_point(p[i]), mm_from_clip_point(p[(i + 1) % p.size()]));
+            }
+        };
+        for(clip_polygon const &polygon : polygons) {
+            elements.clear();
+            add_path(polygon.outer);
+            for(clip_path const &hole : polygon.holes) {
+                add_path(hole);
+            }
+            list.fill_elements(elements.data(), elements.size(), polarity_dark, entity_id);
         }
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    vec2d millimetres_from_nanometres(int64_t x, int64_t y)
+    {
+        return { x / gerber_coordinate_decoder::nanometres_per_millimetre, y / gerber_coordinate_decoder::nanometres_per_millimetre };
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -229,6 +358,36 @@ namespace
         }
     }
 
+    //////////////////////////////////////////////////////////////////////
+    // just counts what draw() makes so gerber_draw_list can reserve it all up front
+
+    struct draw_counter : gerber_draw_interface
+    {
+        size_t num_shapes{};
+        size_t num_elements{};
+
+        void set_gerber(gerber *) override
+        {
+        }
+
+        void fill_elements(gerber_draw_element const *, size_t count, gerber_polarity, int) override
+        {
+            num_shapes += 1;
+            num_elements += count;
+        }
+
+        // the draw list only keeps one copy of each repeat and each aperture
+        bool draws_repeats() const override
+        {
+            return true;
+        }
+
+        bool draws_flashes() const override
+        {
+            return true;
+        }
+    };
+
 }    // namespace
 
 namespace gerber_lib
@@ -241,6 +400,27 @@ namespace gerber_lib
         filename = std::string{};
         image.cleanup();
         stats.cleanup();
+        entities.clear();
+
+        // after the entities, they point into the pool
+        attributes.reset();
+        attributes_changed = false;
+        string_pool = std::make_shared<gerber_string_pool>();
+
+        aperture_transform_valid = false;
+
+        {
+            std::lock_guard lock(draw_list_mutex);
+            recorded_draw_list.reset();
+        }
+
+        {
+            std::lock_guard lock(flash_shapes_mutex);
+            aperture_flash_shapes.reset();
+        }
+
+        state = gerber_state{};
+        knockout_measure = false;
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -253,7 +433,7 @@ namespace gerber_lib
 
         image.gerber = this;
 
-        gerber_net *current_net = new gerber_net(&image);
+        gerber_net *current_net = image.net_pool.create(&image);
 
         state.level = image.levels[0];
         state.net_state = image.net_states[0];
@@ -265,11 +445,16 @@ namespace gerber_lib
 
         image.gerber = this;
 
-        CHECK(parse_gerber_segment(current_net));
+        gerber_error_code err = parse_gerber_segment(current_net);
+
+        image.compact_nets();
+        state.region_start_node = nullptr;
+
+        CHECK(err);
 
         filename = std::string{ file_path };
 
-        LOG_VERBOSE("Parsing complete after {} lines, found {} entities", reader.line_number, entities.size());
+        LOG_VERBOSE("Parsing complete after {} lines, found {} entities", gerber_source_line{ &reader, reader.file_data.size() }, entities.size());
 
         return ok;
     }
@@ -313,7 +498,7 @@ namespace gerber_lib
             stats.g4 += 1;
             std::string comment;
             CHECK(reader.read_until(&comment, '*'));
-            LOG_VERBOSE("Comment({}): {}", reader.line_number, comment);
+            LOG_VERBOSE("Comment({}): {}", reader.line(), comment);
         } break;
 
         // Turn on Region Fill
@@ -434,7 +619,7 @@ namespace gerber_lib
         // Aperture id in use.
         default:
             if(code >= 10 && code <= max_num_apertures) {
-                LOG_DEBUG("Using aperture {} at line {}", code, reader.line_number);
+                LOG_DEBUG("Using aperture {} at line {}", code, reader.line());
                 state.current_aperture = code;
             } else {
                 stats.error(reader, error_bad_aperture_number, "D{} out of bounds", code);
@@ -480,6 +665,49 @@ namespace gerber_lib
         }
     }
 
+    //////////////////////////////////////////////////////////////////////
+    // X, Y, I or J, prescan_chunks uses this too so it tracks the position the same way
+
+    gerber_error_code gerber::parse_coordinate(char axis)
+    {
+        int64_t coordinate;
+        size_t length = 0;
+        CHECK(reader.get_int(&coordinate, &length));
+
+        int decoder_axis = (axis == 'X' || axis == 'I') ? gerber_coordinate_decoder::axis_x : gerber_coordinate_decoder::axis_y;
+        coordinate = image.format.decoder.decode(coordinate, length, decoder_axis, state.net_state->unit);
+
+        auto move_to = [&](int64_t &position) {
+            if(image.format.coordinate == coordinate_incremental) {
+                if(coordinate != 0) {
+                    position += coordinate;
+                    state.changed_state = true;
+                }
+            } else if(position != coordinate) {
+                position = coordinate;
+                state.changed_state = true;
+            }
+        };
+
+        switch(axis) {
+        case 'X':
+            move_to(state.current_x);
+            break;
+        case 'Y':
+            move_to(state.current_y);
+            break;
+        case 'I':
+            state.center_x = coordinate;
+            state.changed_state = true;
+            break;
+        case 'J':
+            state.center_y = coordinate;
+            state.changed_state = true;
+            break;
+        }
+        return ok;
+    }
+
     //////////////////////////////////////////////////////////////////////
     // !!! Always returns after it eats the final %
     // SO....
@@ -534,14 +762,13 @@ namespace gerber_lib
 
                     aperture->unit = state.net_state->unit;
 
-                    if(image.apertures.find(aperture_number) != image.apertures.end()) {
+                    gerber_aperture *previous = image.apertures.set(aperture_number, aperture.release());
+
+                    if(previous != nullptr) {
                         stats.error(reader, error_duplicate_aperture_number, "aperture {} already defined, overwriting", aperture_number);
-                        delete image.apertures[aperture_number];
-                        // image.apertures.erase(aperture_number);
+                        delete previous;
                     }
 
-                    image.apertures[aperture_number] = aperture.release();
-
                     // stats.add_aperture(-1, aperture_number, aperture->aperture_type, aperture->parameters);
                     stats.add_new_d_list(aperture_number);
 
@@ -564,7 +791,7 @@ namespace gerber_lib
 
         case 'AS': {
 
-            state.net_state = new gerber_net_state(&image);
+            state.net_state = image.net_state_pool.create(&image);
 
             CHECK(reader.read_short(&command, 4));
 
@@ -595,8 +822,12 @@ namespace gerber_lib
             } else {
                 std::string s = join(std::span(tokens).subspan(1), ",");
                 LOG_DEBUG("TOKEN ATTR[{}] = {}", tokens[0], s);
-                dictionary[tokens[0]] = s;
-             }
+                auto f = dictionary.find(tokens[0]);
+                if(f == dictionary.end() || f->second != s) {
+                    dictionary[tokens[0]] = s;
+                    attributes_changed = true;
+                }
+            }
         } break;
 
         case 'TD': {
@@ -604,14 +835,18 @@ namespace gerber_lib
             reader.read_until(&attribute_to_clear, '*');
             if(attribute_to_clear.empty()) {
                 LOG_DEBUG("Clear attribute dictionary");
-                dictionary.clear();
+                if(!dictionary.empty()) {
+                    dictionary.clear();
+                    attributes_changed = true;
+                }
             } else {
                 LOG_DEBUG("Delete attribute: \"{}\"", attribute_to_clear);
                 auto f = dictionary.find(attribute_to_clear);
                 if(f == dictionary.end()) {
                     stats.error(reader, error_missing_attribute, "Can't find {}", attribute_to_clear);
                 } else {
-                    dictionary.erase(attribute_to_clear);
+                    dictionary.erase(f);
+                    attributes_changed = true;
                 }
             }
         } break;
@@ -749,6 +984,9 @@ namespace gerber_lib
                 CHECK(reader.read_char(&c));
             }
             reader.rewind(1);
+
+            image.format.decoder.setup(image.format.integral_part_x, image.format.decimal_part_x, image.format.integral_part_y, image.format.decimal_part_y,
+                                       image.format.omit_zeros);
         } break;
 
             //////////////////////////////////////////////////////////////////////
@@ -756,7 +994,7 @@ namespace gerber_lib
 
         case 'MI': {
 
-            state.net_state = new gerber_net_state(&image);
+            state.net_state = image.net_state_pool.create(&image);
 
             char c;
             CHECK(reader.read_char(&c));
@@ -823,7 +1061,7 @@ namespace gerber_lib
             }
 
             if(unit != unit_unspecified) {
-                state.net_state = new gerber_net_state(&image);
+                state.net_state = image.net_state_pool.create(&image);
                 state.net_state->unit = unit;
             }
             LOG_DEBUG("Units: {}", unit);
@@ -1056,7 +1294,7 @@ namespace gerber_lib
         case 'LN': {
             std::string name;
             CHECK(reader.read_until(&name, '*'));
-            state.level = new gerber_level(&image);
+            state.level = image.level_pool.create(&image);
             state.level->name = name;
             LOG_DEBUG("Level name: {}", state.level->name);
         } break;
@@ -1071,12 +1309,12 @@ namespace gerber_lib
             switch(c) {
 
             case 'D':
-                state.level = new gerber_level(&image);
+                state.level = image.level_pool.create(&image);
                 state.level->polarity = polarity_dark;
                 break;
 
             case 'C':
-                state.level = new gerber_level(&image);
+                state.level = image.level_pool.create(&image);
                 state.level->polarity = polarity_clear;
                 break;
 
@@ -1091,7 +1329,7 @@ namespace gerber_lib
 
         case 'KO': {
 
-            state.level = new gerber_level(&image);
+            state.level = image.level_pool.create(&image);
 
             update_knockout_measurements();
 
@@ -1175,16 +1413,21 @@ namespace gerber_lib
 
         case 'SR': {
 
-            state.level = new gerber_level(&image);
+            state.level = image.level_pool.create(&image);
 
+            state.level->step_and_repeat.first_instance = true;
             state.level->step_and_repeat.pos = { 1.0, 1.0 };
             state.level->step_and_repeat.distance = { 0.0, 0.0 };
 
+            // leave the * for the end of the command to find
+
             char c;
-            CHECK(reader.read_char(&c));
+            CHECK(reader.peek(&c));
 
             while(c != '*') {
 
+                reader.skip(1);
+
                 int i;
                 double d;
 
@@ -1192,7 +1435,7 @@ namespace gerber_lib
 
                 case 'X':
                     CHECK(reader.get_int(&i));
-                    if(i == 0) {
+                    if(i <= 0) {
                         i = 1;
                     }
                     state.level->step_and_repeat.pos.x = static_cast<double>(i);
@@ -1200,7 +1443,7 @@ namespace gerber_lib
 
                 case 'Y':
                     CHECK(reader.get_int(&i));
-                    if(i == 0) {
+                    if(i <= 0) {
                         i = 1;
                     }
                     state.level->step_and_repeat.pos.y = static_cast<double>(i);
@@ -1208,18 +1451,18 @@ namespace gerber_lib
 
                 case 'I':
                     CHECK(reader.get_double(&d));
-                    state.level->step_and_repeat.distance.x = d;
+                    state.level->step_and_repeat.distance.x = d * unit_scale;
                     break;
 
                 case 'J':
                     CHECK(reader.get_double(&d));
-                    state.level->step_and_repeat.distance.y = d;
+                    state.level->step_and_repeat.distance.y = d * unit_scale;
                     break;
 
                 default:
                     return stats.error(reader, error_invalid_step_and_repeat, "expected [X|Y|I|J], got {}", string_from_char(c));
                 }
-                CHECK(reader.read_char(&c));
+                CHECK(reader.peek(&c));
             }
             LOG_DEBUG("Step and repeat: POS: {},{}, DISTANCE: {},{}", state.level->step_and_repeat.pos.x, state.level->step_and_repeat.pos.y,
                       state.level->step_and_repeat.distance.x, state.level->step_and_repeat.distance.y);
@@ -1382,6 +1625,7 @@ namespace gerber_lib
             std::vector<std::string> parameters;
             tokenize(tokens[token_index], parameters, "Xx", tokenize_remove_empty);
             for(std::string const &s : parameters) {
+                errno = 0;
                 double value = strtod(s.c_str(), nullptr);
                 if(errno != 0) {
                     LOG_ERROR("Invalid number in aperture parameters: {}", s);
@@ -1607,18 +1851,93 @@ namespace gerber_lib
         return ok;
     }
 
+    //////////////////////////////////////////////////////////////////////
+    // the transform which gets applied to apertures when working out the bounds
+
+    gerber_2d::matrix const &gerber::get_aperture_transform()
+    {
+        using namespace gerber_2d;
+
+        gerber_net_state const &ns = *state.net_state;
+
+        aperture_transform_inputs key;
+        key.offset_a = image.info.offset_a;
+        key.offset_b = image.info.offset_b;
+        key.image_rotation = image.info.image_rotation;
+        key.scale_x = ns.scale.x;
+        key.scale_y = ns.scale.y;
+        key.offset_x = ns.offset.x;
+        key.offset_y = ns.offset.y;
+        key.mirror_state = ns.mirror_state;
+        key.axis_select = ns.axis_select;
+
+        if(aperture_transform_valid && key == aperture_transform_key) {
+            return aperture_transform;
+        }
+
+        matrix m = matrix::identity();
+
+        m = matrix::multiply(matrix::translate({ image.info.offset_a, image.info.offset_b }), m);
+        m = matrix::multiply(matrix::rotate(image.info.image_rotation), m);
+        m = matrix::multiply(matrix::scale(ns.scale), m);
+        m = matrix::multiply(matrix::translate(ns.offset), m);
+
+        // Apply mirror.
+        switch(ns.mirror_state) {
+
+        case mirror_state_flip_a:
+            m = matrix::multiply(matrix::scale({ -1, 1 }), m);
+            break;
+
+        case mirror_state_flip_b:
+            m = matrix::multiply(matrix::scale({ 1, -1 }), m);
+            break;
+
+        case mirror_state_flip_ab:
+            m = matrix::multiply(matrix::scale({ -1, -1 }), m);
+            break;
+
+        default:
+            break;
+        }
+
+        // Apply axis select
+        if(ns.axis_select == axis_select_swap_ab) {
+
+            // do this by rotating 90 clockwise, then mirroring the Y axis.
+            m = matrix::multiply(matrix::rotate(90.0), m);
+            m = matrix::multiply(matrix::scale({ 1, -1 }), m);
+        }
+
+        aperture_transform = m;
+        aperture_transform_key = key;
+        aperture_transform_valid = true;
+        return aperture_transform;
+    }
+
     //////////////////////////////////////////////////////////////////////
 
-    gerber_entity &gerber::add_entity()
+    gerber_entity &gerber::add_entity(size_t source_offset)
     {
-        entities.emplace_back(reader.line_number, reader.line_number, image.nets.size());
+        entities.emplace_back(source_offset, reader.file_pos, image.nets.size());
         gerber_entity &e = entities.back();
-        e.attributes = dictionary;
+        e.attributes = current_attributes();
         return e;
     }
 
     //////////////////////////////////////////////////////////////////////
 
+    gerber_attribute_set const &gerber::current_attributes()
+    {
+        if(attributes_changed) {
+            attributes = make_attribute_set(*string_pool, dictionary);
+            attributes_changed = false;
+        }
+        return attributes;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     gerber_error_code gerber::parse_gerber_segment(gerber_net *net)
     {
         LOG_CONTEXT("parse_segment", info);
@@ -1627,26 +1946,18 @@ namespace gerber_lib
 
         rect bounding_box = whole_box;
 
-        double unit_scale;
-
-        int coordinate{};
-
-        vec2d scale;
         vec2d center;
 
         int region_points{};
 
         bool done{ false };
 
-        int entity_id = 0;
+        // where the current statement started, for entity source ranges
 
-        while(!reader.eof() && !done) {
+        size_t statement_offset = reader.file_pos;
+        bool new_statement = true;
 
-            if(state.net_state->unit == unit_millimeter) {
-                unit_scale = 1.0;
-            } else {
-                unit_scale = 1.0 / 25.4;
-            }
+        while(!reader.eof() && !done) {
 
             char c;
             gerber_error_code err = reader.read_char(&c);
@@ -1655,6 +1966,11 @@ namespace gerber_lib
             }
             CHECK(err);
 
+            if(new_statement) {
+                statement_offset = reader.file_pos - 1;
+            }
+            new_statement = c == '*' || c == '%';
+
             switch(c) {
 
             case 'G': {
@@ -1671,67 +1987,22 @@ namespace gerber_lib
 
             case 'X': {
                 stats.x_count += 1;
-                size_t length = 0;
-                CHECK(reader.get_int(&coordinate, &length));
-                if(image.format.omit_zeros == omit_zeros_trailing) {
-                    add_trailing_zeros(image.format.integral_part_x, image.format.decimal_part_x, (int)length, &coordinate);
-                }
-                if(image.format.coordinate == coordinate_incremental) {
-                    if(coordinate != 0) {
-                        state.current_x += coordinate;
-                        state.changed_state = true;
-                    }
-                } else {
-                    if(state.current_x != coordinate) {
-                        state.current_x = coordinate;
-                        state.changed_state = true;
-                    }
-                }
+                CHECK(parse_coordinate(c));
             } break;
 
             case 'Y': {
                 stats.y_count += 1;
-                size_t length = 0;
-                CHECK(reader.get_int(&coordinate, &length));
-                if(image.format.omit_zeros == omit_zeros_trailing) {
-                    add_trailing_zeros(image.format.integral_part_x, image.format.decimal_part_y, (int)length, &coordinate);
-                }
-                if(image.format.coordinate == coordinate_incremental) {
-                    if(coordinate != 0) {
-                        state.current_y += coordinate;
-                        state.changed_state = true;
-                    }
-                } else {
-                    if(state.current_y != coordinate) {
-                        state.current_y = coordinate;
-                        state.changed_state = true;
-                    }
-                }
-                // LOG_DEBUG("Y: X = {}, Y = {}", state.current_x, state.current_y);
+                CHECK(parse_coordinate(c));
             } break;
 
             case 'I': {
                 stats.i_count += 1;
-                size_t length = 0;
-                CHECK(reader.get_int(&coordinate, &length));
-                if(image.format.omit_zeros == omit_zeros_trailing) {
-                    add_trailing_zeros(image.format.integral_part_x, image.format.decimal_part_x, (int)length, &coordinate);
-                }
-                state.center_x = coordinate;
-                // LOG_DEBUG("CX = {}", state.center_x);
-                state.changed_state = true;
+                CHECK(parse_coordinate(c));
             } break;
 
             case 'J': {
                 stats.j_count += 1;
-                size_t length = 0;
-                CHECK(reader.get_int(&coordinate, &length));
-                if(image.format.omit_zeros == omit_zeros_trailing) {
-                    add_trailing_zeros(image.format.integral_part_y, image.format.decimal_part_y, (int)length, &coordinate);
-                }
-                state.center_y = coordinate;
-                // LOG_DEBUG("CY = {}", state.center_y);
-                state.changed_state = true;
+                CHECK(parse_coordinate(c));
             } break;
 
             case '%': {
@@ -1740,7 +2011,7 @@ namespace gerber_lib
 
             case '*': {
 
-                // LOG_DEBUG("* at line {}", reader.line_number);
+                // LOG_DEBUG("* at line {}", reader.line());
 
                 stats.star_count += 1;
                 if(!state.changed_state) {
@@ -1759,26 +2030,19 @@ namespace gerber_lib
                     break;
                 }
 
-                // round to nearest N decimal places
-
-                auto round_to = [](double D, int N) {
-                    double m = pow(10.0, N);
-                    return round(D * m) / m;
-                };
-
                 // Entity detection
 
-                int current_entity_id = entity_id;
+                int current_entity_id = state.entity_id;
 
                 if(state.is_region_fill) {
                     if(state.interpolation == interpolation_region_end) {
                         if(entities.empty()) {
                             LOG_ERROR("Huh? Wheres the entity man?");
-                            add_entity();
+                            add_entity(statement_offset);
                         }
-                        entities.back().line_number_end = reader.line_number;
-                        entity_id += 1;
-                        LOG_VERBOSE("ENTITY {} ENDS: {}", entity_id, entities.back());
+                        entities.back().offset_end = reader.file_pos;
+                        state.entity_id += 1;
+                        LOG_VERBOSE("ENTITY {} ENDS: {}", state.entity_id, entities.back());
                     }
                 } else
                     switch(state.aperture_state) {
@@ -1790,13 +2054,13 @@ namespace gerber_lib
                         case interpolation_linear:
                         case interpolation_clockwise_circular:
                         case interpolation_counterclockwise_circular:
-                            add_entity();
-                            LOG_VERBOSE("ENTITY {} OCCURS: {}", entity_id, entities.back());
-                            entity_id += 1;
+                            add_entity(statement_offset);
+                            LOG_VERBOSE("ENTITY {} OCCURS: {}", state.entity_id, entities.back());
+                            state.entity_id += 1;
                             break;
                         case interpolation_region_start:
-                            add_entity();
-                            LOG_VERBOSE("ENTITY {} OCCURS: {}", entity_id, entities.back());
+                            add_entity(statement_offset);
+                            LOG_VERBOSE("ENTITY {} OCCURS: {}", state.entity_id, entities.back());
                             break;
                         case interpolation_region_end:
                             LOG_ERROR("Shouldn't get here...");
@@ -1805,31 +2069,18 @@ namespace gerber_lib
                         break;
 
                     case aperture_state_flash:
-                        add_entity();
-                        LOG_VERBOSE("ENTITY {} OCCURS: {}", entity_id, entities.back());
-                        entity_id += 1;
+                        add_entity(statement_offset);
+                        LOG_VERBOSE("ENTITY {} OCCURS: {}", state.entity_id, entities.back());
+                        state.entity_id += 1;
                         break;
                     }
 
-                net = new gerber_net(&image, net, state.level, state.net_state);
+                net = image.net_pool.create(&image, net, state.level, state.net_state);
                 net->entity_id = current_entity_id;
 
-                scale.x = pow(10.0, image.format.decimal_part_x) * unit_scale;
-                scale.y = pow(10.0, image.format.decimal_part_y) * unit_scale;
-
-                net->start.x = state.previous_x / scale.x;
-                net->start.y = state.previous_y / scale.y;
-                net->end.x = state.current_x / scale.x;
-                net->end.y = state.current_y / scale.y;
-                center.x = state.center_x / scale.x;
-                center.y = state.center_y / scale.y;
-
-                net->start.x = round_to(net->start.x, accuracy_decimal_places);
-                net->start.y = round_to(net->start.y, accuracy_decimal_places);
-                net->end.x = round_to(net->end.x, accuracy_decimal_places);
-                net->end.y = round_to(net->end.y, accuracy_decimal_places);
-                center.x = round_to(center.x, accuracy_decimal_places);
-                center.y = round_to(center.y, accuracy_decimal_places);
+                net->start = millimetres_from_nanometres(state.previous_x, state.previous_y);
+                net->end = millimetres_from_nanometres(state.current_x, state.current_y);
+                center = millimetres_from_nanometres(state.center_x, state.center_y);
 
                 if(!state.is_region_fill) {
                     bounding_box = whole_box;
@@ -1888,24 +2139,17 @@ namespace gerber_lib
                         net->interpolation_method = interpolation_region_end;
                         state.region_start_node->num_region_points = region_points;
 
-                        net = new gerber_net(&image, net, state.level, state.net_state);
+                        net = image.net_pool.create(&image, net, state.level, state.net_state);
                         net->entity_id = current_entity_id;
                         net->interpolation_method = interpolation_region_start;
                         state.region_start_node->bounding_box = bounding_box;
                         state.region_start_node = net;
                         region_points = 0;
 
-                        net = new gerber_net(&image, net, state.level, state.net_state);
+                        net = image.net_pool.create(&image, net, state.level, state.net_state);
                         net->entity_id = current_entity_id;
-                        net->start.x = state.previous_x / scale.x;
-                        net->start.y = state.previous_y / scale.y;
-                        net->end.x = state.current_x / scale.x;
-                        net->end.y = state.current_y / scale.y;
-
-                        net->start.x = round_to(net->start.x, accuracy_decimal_places);
-                        net->start.y = round_to(net->start.y, accuracy_decimal_places);
-                        net->end.x = round_to(net->end.x, accuracy_decimal_places);
-                        net->end.y = round_to(net->end.y, accuracy_decimal_places);
+                        net->start = millimetres_from_nanometres(state.previous_x, state.previous_y);
+                        net->end = millimetres_from_nanometres(state.current_x, state.current_y);
 
                     } else if(state.interpolation != interpolation_region_start) {
                         region_points += 1;
@@ -1919,7 +2163,7 @@ namespace gerber_lib
                 // should be the same as the start point, creating no line
 
                 if((state.interpolation == interpolation_clockwise_circular || state.interpolation == interpolation_counterclockwise_circular) &&
-                   state.center_x == 0.0 && state.center_y == 0.0) {
+                   state.center_x == 0 && state.center_y == 0) {
 
                     net->interpolation_method = interpolation_linear;
                 }
@@ -1962,7 +2206,7 @@ namespace gerber_lib
 
                         using namespace gerber_2d;
 
-                        gerber_error_code error = stats.increment_d_list_count(net->aperture, 1, reader.line_number);
+                        gerber_error_code error = stats.increment_d_list_count(net->aperture, 1, reader.file_pos);
 
                         if(error != ok) {
                             net->aperture_state = aperture_state_off;
@@ -1980,43 +2224,9 @@ namespace gerber_lib
                         repeat_offset.x = (state.level->step_and_repeat.pos.x - 1) * state.level->step_and_repeat.distance.x;
                         repeat_offset.y = (state.level->step_and_repeat.pos.y - 1) * state.level->step_and_repeat.distance.y;
 
-                        aperture_matrix = matrix::multiply(matrix::translate({ image.info.offset_a, image.info.offset_b }), aperture_matrix);
-                        aperture_matrix = matrix::multiply(matrix::rotate(image.info.image_rotation), aperture_matrix);
-                        aperture_matrix = matrix::multiply(matrix::scale(state.net_state->scale), aperture_matrix);
-                        aperture_matrix = matrix::multiply(matrix::translate(state.net_state->offset), aperture_matrix);
-
-                        // Apply mirror.
-                        switch(state.net_state->mirror_state) {
-
-                        case mirror_state_flip_a:
-                            aperture_matrix = matrix::multiply(matrix::scale({ -1, 1 }), aperture_matrix);
-                            break;
-
-                        case mirror_state_flip_b:
-                            aperture_matrix = matrix::multiply(matrix::scale({ 1, -1 }), aperture_matrix);
-                            break;
-
-                        case mirror_state_flip_ab:
-                            aperture_matrix = matrix::multiply(matrix::scale({ -1, -1 }), aperture_matrix);
-                            break;
-
-                        default:
-                            break;
-                        }
-
-                        // Apply axis select
-                        if(state.net_state->axis_select == axis_select_swap_ab) {
-
-                            // do this by rotating 90 clockwise, then mirroring the Y axis.
-                            aperture_matrix = matrix::multiply(matrix::rotate(90.0), aperture_matrix);
-                            aperture_matrix = matrix::multiply(matrix::scale({ 1, -1 }), aperture_matrix);
-                        }
+                        aperture_matrix = get_aperture_transform();
 
-                        gerber_aperture *a = nullptr;
-                        auto ap = image.apertures.find(net->aperture);
-                        if(ap != image.apertures.end()) {
-                            a = ap->second;
-                        }
+                        gerber_aperture *a = image.apertures.find(net->aperture);
 
                         if(a != nullptr && a->aperture_type == aperture_type_macro) {
                             bounding_box = whole_box;
@@ -2110,46 +2320,17 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::fill_region_path(gerber_draw_interface &drawer, size_t net_index, gerber_polarity polarity) const
+    gerber_error_code gerber::fill_region_path(gerber_draw_interface &drawer, gerber_region const &region, gerber_polarity polarity) const
     {
-        std::vector<gerber_draw_element> elements;
-
-        int entity_id = image.nets[net_index]->entity_id;
-
-        for(size_t last_index = net_index + 1; last_index < image.nets.size(); ++last_index) {
-
-            gerber_net *n = image.nets[last_index];
-
-            if(n->interpolation_method == interpolation_region_end) {
-                break;
-            }
-
-            if(n->aperture_state == aperture_state_on) {
-
-                switch(n->interpolation_method) {
+        gerber_net_store const &nets = image.net_store;
 
-                case interpolation_linear: {
-                    if(n->start.x != n->end.x || n->start.y != n->end.y) {
-                        elements.emplace_back(n->start, n->end);
-                        //} else {
-                        //    LOG_DEBUG("IGNORED empty edge at index {} (line {})", last_index, n->line_number);
-                    }
-                } break;
-
-                case interpolation_clockwise_circular:
-                case interpolation_counterclockwise_circular: {
-                    double a1 = n->circle_segment.start_angle;
-                    double a2 = n->circle_segment.end_angle;
-                    elements.emplace_back(n->circle_segment.pos, a1, a2, n->circle_segment.size.x / 2);
-                } break;
-
-                default:
-                    LOG_ERROR("Huh? Bogus interpolation method {} ({}) in outline", static_cast<int>(n->interpolation_method), n->interpolation_method);
-                    return error_invalid_interpolation;
-                }
-            }
+        if(region.bad_net != gerber_region::no_net) {
+            gerber_interpolation interpolation = nets.get_interpolation(region.bad_net);
+            LOG_ERROR("Huh? Bogus interpolation method {} ({}) in outline", static_cast<int>(interpolation), interpolation);
+            return error_invalid_interpolation;
         }
-        drawer.fill_elements(elements.data(), elements.size(), polarity, entity_id);
+
+        drawer.fill_elements(nets.region_outline(region), region.num_elements, polarity, nets.entity_id[region.first_net]);
         return ok;
     }
 
@@ -2166,111 +2347,157 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_macro(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *const macro_aperture) const
+    gerber_error_code gerber::draw_macro(gerber_draw_interface &drawer, gerber_aperture *const macro_aperture) const
     {
+        std::vector<gerber_draw_element> elements;
+
+        // primitives are rotated about the macro's origin, not their own centre
+        auto fill = [&](gerber_polarity polarity, double rotation) {
+            if(!elements.empty()) {
+                if(rotation != 0) {
+                    rotate_elements(elements, rotation);
+                }
+                drawer.fill_elements(elements.data(), elements.size(), polarity, 0);
+                elements.clear();
+            }
+        };
+
         for(auto m : macro_aperture->macro_parameters_list) {
 
+            std::vector<double> const &p = m->parameters;
+
             switch(m->aperture_type) {
 
             case aperture_type_macro_circle: {
-                FAIL_IF(m->parameters.size() < (circle_num_parameters - 1llu), error_bad_parameter_count);
-                double exposure = m->parameters[circle_exposure];
-                double diameter = m->parameters[circle_diameter];
-
+                FAIL_IF(p.size() < (circle_num_parameters - 1llu), error_bad_parameter_count);
                 double rotation = 0;
-                if(m->parameters.size() == circle_num_parameters) {
-                    rotation = m->parameters[circle_rotation];
-                }
-                gerber_polarity polarity{ polarity_dark };
-                if(exposure < 0.01) {
-                    polarity = polarity_clear;
+                if(p.size() == circle_num_parameters) {
+                    rotation = p[circle_rotation];
                 }
-                vec2d pos(m->parameters[circle_centre_x], m->parameters[circle_centre_y]);
-                matrix mat = matrix::rotate(rotation);
-                mat = matrix::multiply(mat, matrix::translate(net->end));
-                pos = transform_point(mat, pos);
-                gerber_draw_element e(pos, 0, 360, diameter / 2);
-                drawer.fill_elements(&e, 1, polarity, net->entity_id);
+                elements.emplace_back(vec2d{ p[circle_centre_x], p[circle_centre_y] }, 0.0, 360.0, p[circle_diameter] / 2);
+                fill(exposure_polarity(p[circle_exposure]), rotation);
             } break;
 
             case aperture_type_macro_moire: {
-                FAIL_IF(m->parameters.size() < moire_num_parameters, error_bad_parameter_count);
-                // moire
+                FAIL_IF(p.size() < moire_num_parameters, error_bad_parameter_count);
+                vec2d center{ p[moire_centre_x], p[moire_centre_y] };
+                double ring_width = p[moire_circle_line_width];
+                double diameter = p[moire_outside_diameter];
+                int num_rings = static_cast<int>(p[moire_number_of_circles]);
+                for(int i = 0; i < num_rings && diameter > 0 && ring_width > 0; ++i) {
+                    add_ring(elements, center, diameter / 2, diameter / 2 - ring_width);
+                    fill(polarity_dark, p[moire_rotation]);
+                    diameter -= (ring_width + p[moire_gap_width]) * 2;
+                }
+                double w2 = p[moire_crosshair_length] / 2;
+                double h2 = p[moire_crosshair_line_width] / 2;
+                if(w2 > 0 && h2 > 0) {
+                    add_rectangle(elements, { center.x - w2, center.y - h2 }, { center.x + w2, center.y + h2 });
+                    fill(polarity_dark, p[moire_rotation]);
+                    add_rectangle(elements, { center.x - h2, center.y - w2 }, { center.x + h2, center.y + w2 });
+                    fill(polarity_dark, p[moire_rotation]);
+                }
             } break;
 
             case aperture_type_macro_thermal: {
-                FAIL_IF(m->parameters.size() < thermal_num_parameters, error_bad_parameter_count);
-                // thermal
+                FAIL_IF(p.size() < thermal_num_parameters, error_bad_parameter_count);
+                vec2d center{ p[thermal_centre_x], p[thermal_centre_y] };
+                double outer = p[thermal_outside_diameter] / 2;
+                double inner = p[thermal_inside_diameter] / 2;
+                double gap = p[thermal_crosshair_line_width] / 2;
+
+                // four pieces of a ring with a cross cut out of it, the cross takes all of it if it's wide enough
+                if(outer > gap * M_SQRT2) {
+                    double outer_angle = rad_2_deg(asin(gap / outer));
+                    for(int quadrant = 0; quadrant < 4; ++quadrant) {
+                        double base = quadrant * 90.0;
+                        elements.emplace_back(center, base + outer_angle, base + 90 - outer_angle, outer);
+                        if(inner > gap * M_SQRT2) {
+                            double inner_angle = rad_2_deg(asin(gap / inner));
+                            elements.emplace_back(center, base + 90 - inner_angle, base + inner_angle, inner);
+                        } else {
+                            vec2d corner = transform_point(matrix::rotate(base), { gap, gap }).add(center);
+                            elements.emplace_back(corner, corner);
+                        }
+                        fill(polarity_dark, p[thermal_rotation]);
+                    }
+                }
             } break;
 
             case aperture_type_macro_outline: {
-                // FAIL_IF(m->parameters.size() < outline_num_parameters, error_bad_parameter_count);
+                FAIL_IF(p.size() < outline_num_parameters, error_bad_parameter_count);
+                size_t num_points = static_cast<size_t>(p[outline_number_of_points]) + 1;
+                FAIL_IF(p.size() != num_points * 2 + 3, error_bad_parameter_count);
+                for(size_t i = 0; i + 1 < num_points; ++i) {
+                    double const *v = p.data() + outline_first_x + i * 2;
+                    elements.emplace_back(vec2d{ v[0], v[1] }, vec2d{ v[2], v[3] });
+                }
+                fill(exposure_polarity(p[outline_exposure]), p.back());
             } break;
 
             case aperture_type_macro_polygon: {
-                FAIL_IF(m->parameters.size() < polygon_num_parameters, error_bad_parameter_count);
+                FAIL_IF(p.size() < polygon_num_parameters, error_bad_parameter_count);
+                int sides = static_cast<int>(p[polygon_number_of_sides]);
+                double radius = p[polygon_diameter] / 2;
+                if(sides >= 3 && radius > 0) {
+                    // the first corner is on the x axis (before it's rotated)
+                    vec2d center{ p[polygon_centre_x], p[polygon_centre_y] };
+                    auto corner = [&](int i) {
+                        double a = i * 2 * M_PI / sides;
+                        return vec2d{ center.x + cos(a) * radius, center.y + sin(a) * radius };
+                    };
+                    for(int i = 0; i < sides; ++i) {
+                        elements.emplace_back(corner(i), corner(i + 1));
+                    }
+                    fill(exposure_polarity(p[polygon_exposure]), p[polygon_rotation]);
+                }
             } break;
 
             case aperture_type_macro_line20: {
-                FAIL_IF(m->parameters.size() < line_20_num_parameters, error_bad_parameter_count);
-                vec2d start{ m->parameters[line_20_start_x], m->parameters[line_20_start_y] };
-                vec2d end{ m->parameters[line_20_end_x], m->parameters[line_20_end_y] };
-                double width = m->parameters[line_20_line_width];
-                if(width != 0) {
-                    double w2 = width / 2;
-                    double rotation = m->parameters[line_20_rotation];
-
-                    matrix mat = matrix::rotate(rotation);
-                    mat = matrix::multiply(mat, matrix::translate(net->end));
-                    // transform_points(mat, points);
-
-                    std::array<vec2d, 4> points = { vec2d{ start.x, start.y - w2, mat },    //
-                                                    vec2d{ end.x, start.y - w2, mat },      //
-                                                    vec2d{ end.x, start.y + w2, mat },      //
-                                                    vec2d{ start.x, start.y + w2, mat } };
-
-
-                    gerber_draw_element e[4];
-                    e[0] = gerber_draw_element(points[0], points[3]);
-                    e[1] = gerber_draw_element(points[3], points[2]);
-                    e[2] = gerber_draw_element(points[2], points[1]);
-                    e[3] = gerber_draw_element(points[1], points[0]);
-                    drawer.fill_elements(e, 4, polarity_dark, net->entity_id);
+                FAIL_IF(p.size() < line_20_num_parameters, error_bad_parameter_count);
+                vec2d start{ p[line_20_start_x], p[line_20_start_y] };
+                vec2d end{ p[line_20_end_x], p[line_20_end_y] };
+                double w2 = p[line_20_line_width] / 2;
+                double length = end.subtract(start).length();
+                if(w2 != 0 && length != 0) {
+
+                    // butt ends, square to the line
+                    vec2d side{ -(end.y - start.y) / length * w2, (end.x - start.x) / length * w2 };
+
+                    std::array<vec2d, 4> points = { start.subtract(side),    //
+                                                    end.subtract(side),      //
+                                                    end.add(side),           //
+                                                    start.add(side) };
+
+                    elements.emplace_back(points[0], points[3]);
+                    elements.emplace_back(points[3], points[2]);
+                    elements.emplace_back(points[2], points[1]);
+                    elements.emplace_back(points[1], points[0]);
+                    fill(exposure_polarity(p[line_20_exposure]), p[line_20_rotation]);
                 }
             } break;
 
-            case aperture_type_macro_line21: {
-                FAIL_IF(m->parameters.size() < line_21_num_parameters, error_bad_parameter_count);
-                double x = m->parameters[line_21_centre_x];
-                double y = m->parameters[line_21_centre_y];
-                double w = m->parameters[line_21_line_width];
-                double h = m->parameters[line_21_line_height];
+            case aperture_type_macro_line21:
+            case aperture_type_macro_line22: {
+                FAIL_IF(p.size() < line_21_num_parameters, error_bad_parameter_count);
+                double x = p[line_21_centre_x];
+                double y = p[line_21_centre_y];
+                double w = p[line_21_line_width];
+                double h = p[line_21_line_height];
                 if(w != 0 && h != 0) {
 
-                    double rotation = m->parameters[line_21_rotation];
-                    double w2 = w / 2;
-                    double h2 = h / 2;
-
-                    matrix mat = matrix::rotate(rotation);
-                    mat = matrix::multiply(mat, matrix::translate(net->end));
-
-                    std::array<vec2d, 4> points = { vec2d({ x - w2, y - h2 }, mat),      //
-                                                    vec2d({ x + w2, y - h2 }, mat),      //
-                                                    vec2d({ x + w2, y + h2 }, mat),      //
-                                                    vec2d({ x - w2, y + h2 }, mat) };    //
-
-                    gerber_draw_element e[4];
-                    e[0] = gerber_draw_element(points[0], points[3]);
-                    e[1] = gerber_draw_element(points[3], points[2]);
-                    e[2] = gerber_draw_element(points[2], points[1]);
-                    e[3] = gerber_draw_element(points[1], points[0]);
-                    drawer.fill_elements(e, 4, polarity_dark, net->entity_id);
+                    // line 22 is the same except x,y is the lower left corner
+                    if(m->aperture_type == aperture_type_macro_line21) {
+                        x -= w / 2;
+                        y -= h / 2;
+                    }
+                    add_rectangle(elements, { x, y }, { x + w, y + h });
+                    fill(exposure_polarity(p[line_21_exposure]), p[line_21_rotation]);
                 }
             } break;
 
-            case aperture_type_macro_line22: {
-                FAIL_IF(m->parameters.size() < line_22_num_parameters, error_bad_parameter_count);
-            } break;
+            default:
+                break;
             }
         }
         return ok;
@@ -2278,17 +2505,17 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_linear_circle(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *aperture) const
+    gerber_error_code gerber::draw_linear_circle(gerber_draw_interface &drawer, size_t net_index, gerber_aperture *aperture) const
     {
         double width = aperture->parameters[0];
 
-        vec2d start = net->start;
-        vec2d end = net->end;
+        vec2d start = image.net_store.start[net_index];
+        vec2d end = image.net_store.end[net_index];
 
         double thickness = width / 2;
 
         if(start.x == end.x && start.y == end.y) {
-            return draw_circle(drawer, net, net->start, thickness);
+            return draw_circle(drawer, net_index, start, thickness);
         }
 
         double dx = end.x - start.x;
@@ -2311,19 +2538,19 @@ namespace gerber_lib
                                      gerber_draw_element(p4, p3),                                     //
                                      gerber_draw_element(start, deg + 90, deg + 270, thickness) };    //
 
-        drawer.fill_elements(e, 4, net->level->polarity, net->entity_id);
+        drawer.fill_elements(e, 4, net_polarity(net_index), image.net_store.entity_id[net_index]);
         return ok;
     }
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_linear_rectangle(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *aperture) const
+    gerber_error_code gerber::draw_linear_rectangle(gerber_draw_interface &drawer, size_t net_index, gerber_aperture *aperture) const
     {
         double w = aperture->parameters[0] / 2;
         double h = aperture->parameters[1] / 2;
         vec2d size{ w, h };
-        vec2d start = net->start;
-        vec2d end = net->end;
+        vec2d start = image.net_store.start[net_index];
+        vec2d end = image.net_store.end[net_index];
         vec2d diff = end.subtract(start);
 
         auto draw_rectangle = [&](vec2d const &bottom_left, vec2d const &top_right) {
@@ -2332,7 +2559,7 @@ namespace gerber_lib
             el[1] = gerber_draw_element(el[0].line_end, top_right);
             el[2] = gerber_draw_element(el[1].line_end, { bottom_left.x, top_right.y });
             el[3] = gerber_draw_element(el[2].line_end, el[0].line_start);
-            drawer.fill_elements(el, 4, net->level->polarity, net->entity_id);
+            drawer.fill_elements(el, 4, net_polarity(net_index), image.net_store.entity_id[net_index]);
         };
 
         if(diff.length() < 1e-6) {
@@ -2353,14 +2580,14 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_linear_interpolation(gerber_draw_interface &drawer, gerber_net *net, gerber_aperture *aperture) const
+    gerber_error_code gerber::draw_linear_interpolation(gerber_draw_interface &drawer, size_t net_index, gerber_aperture *aperture) const
     {
         switch(aperture->aperture_type) {
         case aperture_type_circle:
-            draw_linear_circle(drawer, net, aperture);
+            draw_linear_circle(drawer, net_index, aperture);
             break;
         case aperture_type_rectangle:
-            draw_linear_rectangle(drawer, net, aperture);
+            draw_linear_rectangle(drawer, net_index, aperture);
             break;
         default:
             LOG_WARNING("linear interpolation for aperture {} not supported", aperture->aperture_type);
@@ -2371,18 +2598,18 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_circle(gerber_draw_interface &drawer, gerber_net *net, vec2d const &pos, double radius) const
+    gerber_error_code gerber::draw_circle(gerber_draw_interface &drawer, size_t net_index, vec2d const &pos, double radius) const
     {
         gerber_draw_element e(pos, 0.0, 360.0, radius);
-        drawer.fill_elements(&e, 1, net->level->polarity, net->entity_id);
+        drawer.fill_elements(&e, 1, net_polarity(net_index), image.net_store.entity_id[net_index]);
         return ok;
     }
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_arc(gerber_draw_interface &drawer, gerber_net *net, double thickness) const
+    gerber_error_code gerber::draw_arc(gerber_draw_interface &drawer, size_t net_index, double thickness) const
     {
-        gerber_arc const &arc = net->circle_segment;
+        gerber_arc const &arc = image.net_store.arc(net_index);
 
         vec2d const &pos = arc.pos;
         double start_angle = arc.start_angle;
@@ -2480,16 +2707,16 @@ namespace gerber_lib
             }
         }
         if(n != 0) {
-            drawer.fill_elements(draw_elements, n, net->level->polarity, net->entity_id);
+            drawer.fill_elements(draw_elements, n, net_polarity(net_index), image.net_store.entity_id[net_index]);
         }
         return ok;
     }
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_capsule(gerber_draw_interface &drawer, gerber_net *net, double width, double height) const
+    gerber_error_code gerber::draw_capsule(gerber_draw_interface &drawer, double width, double height) const
     {
-        vec2d const &center = net->end;
+        vec2d const center{ 0, 0 };
         gerber_draw_element el[4];
 
         double w2 = width / 2;
@@ -2499,7 +2726,8 @@ namespace gerber_lib
         vec2d br1{ center.x + w2, center.y + h2 };
 
         if(fabs(width - height) < 1e-6) {
-            draw_circle(drawer, net, center, w2);
+            el[0] = gerber_draw_element(center, 0.0, 360.0, w2);
+            drawer.fill_elements(el, 1, polarity_dark, 0);
         } else if(width > height) {
             vec2d tl2{ tl1.x + h2, tl1.y };
             vec2d br2{ br1.x - h2, br1.y };
@@ -2507,7 +2735,7 @@ namespace gerber_lib
             el[1] = gerber_draw_element(tl2, { br2.x, tl1.y });
             el[2] = gerber_draw_element({ br2.x, center.y }, 270, 450, h2);
             el[3] = gerber_draw_element(br2, { tl2.x, br1.y });
-            drawer.fill_elements(el, 4, net->level->polarity, net->entity_id);
+            drawer.fill_elements(el, 4, polarity_dark, 0);
         } else {
             vec2d tl2{ tl1.x, tl1.y + w2 };
             vec2d br2{ br1.x, br1.y - w2 };
@@ -2515,16 +2743,15 @@ namespace gerber_lib
             el[1] = gerber_draw_element({ br2.x, tl2.y }, br2);
             el[2] = gerber_draw_element({ center.x, br2.y }, 0, 180, w2);
             el[3] = gerber_draw_element({ tl2.x, br2.y }, tl2);
-            drawer.fill_elements(el, 4, net->level->polarity, net->entity_id);
+            drawer.fill_elements(el, 4, polarity_dark, 0);
         }
         return ok;
     }
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber::draw_rectangle(gerber_draw_interface &drawer, gerber_net *net, rect const &rc) const
+    gerber_error_code gerber::draw_rectangle(gerber_draw_interface &drawer, rect const &r) const
     {
-        rect r = { rc.min_pos.add(net->end), rc.max_pos.add(net->end) };
         vec2d bottom_right = vec2d{ r.max_pos.x, r.min_pos.y };
         vec2d top_left = vec2d{ r.min_pos.x, r.max_pos.y };
         gerber_draw_element el[4];
@@ -2532,32 +2759,246 @@ namespace gerber_lib
         el[1] = gerber_draw_element(bottom_right, r.max_pos);
         el[2] = gerber_draw_element(r.max_pos, top_left);
         el[3] = gerber_draw_element(top_left, r.min_pos);
-        drawer.fill_elements(el, 4, net->level->polarity, net->entity_id);
+        drawer.fill_elements(el, 4, polarity_dark, 0);
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the shapes of an aperture at 0,0, all dark except for clear parts of macros
+
+    gerber_error_code gerber::draw_aperture(gerber_draw_interface &drawer, gerber_aperture *aperture) const
+    {
+        switch(aperture->aperture_type) {
+
+        case aperture_type_circle: {
+            // FAIL_IF(aperture->parameters.size() < 3, error_bad_parameter_count);
+            double radius = (float)aperture->parameters[0] / 2;
+            gerber_draw_element e(vec2d{ 0, 0 }, 0.0, 360.0, radius);
+            drawer.fill_elements(&e, 1, polarity_dark, 0);
+            // DrawAperatureHole(path, p1, p2);
+        } break;
+
+        case aperture_type_rectangle: {
+            // FAIL_IF(aperture->parameters.size() < 4, error_bad_parameter_count);
+            double p0 = (float)aperture->parameters[0];
+            double p1 = (float)aperture->parameters[1];
+            rect aperture_rect(-(p0 / 2), -(p1 / 2), p0 / 2, p1 / 2);
+            CHECK(draw_rectangle(drawer, aperture_rect));
+            // path.AddRectangle(apertureRectangle);
+            // DrawAperatureHole(path, p2, p3);
+        } break;
+
+        case aperture_type_oval: {
+            // FAIL_IF(aperture->parameters.size() < 4, error_bad_parameter_count);
+            double w = (float)aperture->parameters[0];
+            double h = (float)aperture->parameters[1];
+            CHECK(draw_capsule(drawer, w, h));
+            // CreateOblongPath(path, p0, p1);
+            // DrawAperatureHole(path, p2, p3);
+        } break;
+
+        case aperture_type_polygon: {
+            FAIL_IF(aperture->parameters.size() < 5, error_bad_parameter_count);
+            double p0 = (float)aperture->parameters[0];
+            double p1 = (float)aperture->parameters[1];
+            double p2 = (float)aperture->parameters[2];
+            CHECK(fill_polygon(drawer, p0, static_cast<int>(p1), p2));
+            // DrawAperatureHole(path, p3, p4);
+        } break;
+
+        case aperture_type_macro: {
+            CHECK(draw_macro(drawer, aperture));
+        } break;
+
+        default:
+            break;
+        }
         return ok;
     }
 
     //////////////////////////////////////////////////////////////////////
 
+    std::vector<gerber_draw_list> const &gerber::flash_shapes() const
+    {
+        std::lock_guard lock(flash_shapes_mutex);
+
+        if(aperture_flash_shapes == nullptr) {
+
+            auto apertures = std::make_unique<std::vector<gerber_draw_list>>(image.apertures.table.size());
+            for(size_t i = 0; i < image.apertures.table.size(); ++i) {
+                gerber_aperture *aperture = image.apertures.table[i];
+                if(aperture != nullptr) {
+                    gerber_draw_list &shapes = (*apertures)[i];
+                    shapes.error = draw_aperture(shapes, aperture);
+                    if(shapes.error == ok) {
+                        shapes.error = cut_clear_shapes(shapes);
+                    }
+                }
+            }
+            aperture_flash_shapes = std::move(apertures);
+        }
+        return *aperture_flash_shapes;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_draw_list const &gerber::draw_list() const
+    {
+        std::lock_guard lock(draw_list_mutex);
+
+        if(recorded_draw_list == nullptr) {
+
+            // generating the geometry is cheap next to growing huge vectors, so count it first
+            draw_counter counter;
+            draw(counter);
+
+            auto list = std::make_unique<gerber_draw_list>();
+            list->shapes.reserve(counter.num_shapes);
+            list->elements.reserve(counter.num_elements);
+            list->error = draw(*list);
+            list->find_polarity_runs();
+            LOG_VERBOSE("Recorded {} shapes, {} elements ({} bytes)", list->shapes.size(), list->elements.size(), list->bytes_used());
+            recorded_draw_list = std::move(list);
+        }
+        return *recorded_draw_list;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber::flatten(std::vector<clip_polygon> &polygons, double arc_tolerance) const
+    {
+        gerber_flattener flattener;
+        flattener.arc_tolerance = arc_tolerance;
+
+        gerber_error_code result = draw_list().replay(flattener);
+        if(result == ok) {
+            result = flattener.error;
+        }
+
+        polygons = std::move(flattener.polygons);
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     gerber_error_code gerber::draw(gerber_draw_interface &drawer) const
+    {
+        return draw_nets(drawer, 0, image.net_store.size());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // which step and repeat blocks are in [begin_net, end_net)
+
+    void gerber::find_repeat_blocks(size_t begin_net, size_t end_net, std::vector<gerber_repeat_block> &blocks) const
+    {
+        blocks.clear();
+
+        // the level made by the SR command each level is under, if it makes more than one copy
+
+        std::vector<int> block_levels(image.levels.size(), -1);
+        int block_level = -1;
+        for(size_t i = 0; i < image.levels.size(); ++i) {
+            gerber_step_and_repeat const &step_and_repeat = image.levels[i]->step_and_repeat;
+            if(step_and_repeat.first_instance) {
+                block_level = step_and_repeat.num_copies() > 1 ? static_cast<int>(i) : -1;
+            }
+            block_levels[i] = block_level;
+        }
+
+        gerber_net_store const &nets = image.net_store;
+
+        for(size_t net_index = begin_net; net_index < end_net; ++net_index) {
+            int level = nets.level[net_index];
+            if(level < 0 || block_levels[level] < 0) {
+                continue;
+            }
+            gerber_step_and_repeat const *step_and_repeat = &image.levels[block_levels[level]]->step_and_repeat;
+            if(!blocks.empty() && blocks.back().end_net == net_index && blocks.back().step_and_repeat == step_and_repeat) {
+                blocks.back().end_net += 1;
+            } else {
+                blocks.push_back({ net_index, net_index + 1, step_and_repeat });
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // [begin_net, end_net) mustn't split a region block or a step and repeat block
+
+    gerber_error_code gerber::draw_nets(gerber_draw_interface &drawer, size_t begin_net, size_t end_net) const
+    {
+        std::vector<gerber_repeat_block> blocks;
+        find_repeat_blocks(begin_net, end_net, blocks);
+
+        std::vector<vec2d> offsets;
+
+        size_t net_index = begin_net;
+
+        for(gerber_repeat_block const &block : blocks) {
+
+            CHECK(draw_net_range(drawer, net_index, block.first_net, true));
+
+            offsets.clear();
+            for(size_t i = 0; i < block.step_and_repeat->num_copies(); ++i) {
+                offsets.push_back(block.step_and_repeat->copy_offset(i));
+            }
+
+            // the block is only drawn once, if the drawer can't do repeats it gets moved copies
+            // flashes in it go as shapes, flash_aperture is never inside a repeat
+
+            if(drawer.draws_repeats()) {
+                drawer.begin_repeat(offsets.data(), offsets.size());
+                gerber_error_code error = draw_net_range(drawer, block.first_net, block.end_net, false);
+                drawer.end_repeat();
+                CHECK(error);
+            } else {
+                gerber_draw_list copies;
+                copies.show_progress = drawer.show_progress;
+                copies.begin_repeat(offsets.data(), offsets.size());
+                CHECK(draw_net_range(copies, block.first_net, block.end_net, false));
+                copies.end_repeat();
+                copies.send_shapes(drawer);
+            }
+            net_index = block.end_net;
+        }
+        return draw_net_range(drawer, net_index, end_net, true);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // [begin_net, end_net) mustn't split a region block, step and repeat is ignored
+    // flashes are only sent as flashes if use_flashes and the drawer wants them
+
+    gerber_error_code gerber::draw_net_range(gerber_draw_interface &drawer, size_t begin_net, size_t end_net, bool use_flashes) const
     {
         auto should_hide = [=](gerber_hide_elements h) { return (static_cast<int>(h) & hide_elements) != 0; };
 
-        // to skip a region block
+        gerber_net_store const &nets = image.net_store;
 
-        auto next_net_index = [this](size_t cur_index) {
-            gerber_net *n = image.nets[cur_index];
-            if(n->interpolation_method == interpolation_region_start) {
-                while(cur_index < image.nets.size()) {
-                    if(image.nets[cur_index]->interpolation_method == interpolation_region_end) {
-                        break;
-                    }
-                    cur_index += 1;
+        std::vector<gerber_draw_list> const &apertures = flash_shapes();
+
+        // consecutive flashes of the same aperture with the same polarity go to the drawer together
+
+        bool batch_flashes = use_flashes && drawer.draws_flashes();
+        std::vector<gerber_flash> batch;
+        int batch_aperture{};
+        gerber_polarity batch_polarity{};
+        std::vector<uint8_t> defined(apertures.size());
+
+        auto flush_flashes = [&]() {
+            if(!batch.empty()) {
+                if(!defined[batch_aperture]) {
+                    gerber_draw_list const &shapes = apertures[batch_aperture];
+                    drawer.define_aperture(batch_aperture, shapes.elements.data(), shapes.shapes.data(), shapes.shapes.size());
+                    defined[batch_aperture] = true;
                 }
+                drawer.flash_aperture(batch_aperture, batch_polarity, batch.data(), batch.size());
+                batch.clear();
             }
-            return cur_index + 1;
         };
 
-        size_t num_nets = image.nets.size();
+        // whatever's batched up gets drawn when it returns, even if it bails out
+        auto flush_on_exit = gerber_util::util::deferrer << [&]() { flush_flashes(); };
+
+        size_t num_nets = nets.size();
         double percent = 0;
 
         gerber_timer timer;
@@ -2569,7 +3010,19 @@ namespace gerber_lib
             interim_timer.reset();
         }
 
-        for(size_t net_index = 0; net_index < image.nets.size(); net_index = next_net_index(net_index)) {
+        size_t next_net_index = begin_net;
+
+        for(size_t net_index = begin_net; net_index < end_net; net_index = next_net_index) {
+
+            // skip over the whole region block
+            gerber_region const *region = nullptr;
+            next_net_index = net_index + 1;
+            if(nets.get_interpolation(net_index) == interpolation_region_start) {
+                region = nets.find_region(net_index);
+                if(region != nullptr) {
+                    next_net_index = region->last_net + 1;
+                }
+            }
 
             if(drawer.show_progress) {
                 double new_percent = net_index * 100.0 / num_nets;
@@ -2580,33 +3033,36 @@ namespace gerber_lib
                 }
             }
 
-            gerber_net *net = image.nets[net_index];
-
-            if(net->level == nullptr) {
+            if(nets.level[net_index] < 0) {
                 LOG_ERROR("NO LEVEL for net at index {}!?", net_index);
                 continue;
             }
 
-            if(net->hidden) {
+            if(nets.hidden[net_index]) {
                 continue;
             }
 
-            if(net->aperture_state == aperture_state_off) {
+            gerber_aperture_state aperture_state = nets.get_aperture_state(net_index);
+
+            if(aperture_state == aperture_state_off) {
                 continue;
             }
 
-            gerber_aperture *aperture{ nullptr };
-            map_get_if_found(image.apertures, net->aperture, &aperture);
+            gerber_aperture *aperture = image.apertures.find(nets.aperture[net_index]);
 
-            // LOG_DEBUG("Interpolation: {}", n->interpolation_method);
+            gerber_interpolation interpolation = nets.get_interpolation(net_index);
 
-            switch(net->interpolation_method) {
+            if(aperture_state != aperture_state_flash || interpolation == interpolation_region_start) {
+                flush_flashes();
+            }
+
+            switch(interpolation) {
 
             // draw the region
             case interpolation_region_start: {
 
-                if(!should_hide(hide_element_outlines)) {
-                    CHECK(fill_region_path(drawer, net_index, net->level->polarity));
+                if(region != nullptr && !should_hide(hide_element_outlines)) {
+                    CHECK(fill_region_path(drawer, *region, net_polarity(net_index)));
                 }
 
             } break;
@@ -2615,9 +3071,7 @@ namespace gerber_lib
 
                 if(aperture != nullptr) {
 
-                    // LOG_DEBUG("Aperture type: {}, aperture state: {}", aperture->aperture_type, n->aperture_state);
-
-                    switch(net->aperture_state) {
+                    switch(aperture_state) {
 
                     case aperture_state_off:
                         break;
@@ -2625,71 +3079,54 @@ namespace gerber_lib
                     // flash the aperture
                     case aperture_state_flash: {
 
+                        gerber_hide_elements hide = hide_element_none;
                         switch(aperture->aperture_type) {
+                        case aperture_type_circle:
+                            hide = hide_element_circles;
+                            break;
+                        case aperture_type_rectangle:
+                            hide = hide_element_rectangles;
+                            break;
+                        case aperture_type_oval:
+                            hide = hide_element_ovals;
+                            break;
+                        case aperture_type_polygon:
+                            hide = hide_element_polygons;
+                            break;
+                        case aperture_type_macro:
+                            hide = hide_element_macros;
+                            break;
+                        default:
+                            break;
+                        }
+                        if(hide != hide_element_none && should_hide(hide)) {
+                            break;
+                        }
 
-                        case aperture_type_circle: {
-
-                            if(!should_hide(hide_element_circles)) {
-                                // FAIL_IF(aperture->parameters.size() < 3, error_bad_parameter_count);
-                                double radius = (float)aperture->parameters[0] / 2;
-                                CHECK(draw_circle(drawer, net, net->end, radius));
-                                // DrawAperatureHole(path, p1, p2);
-                            }
-                        } break;
-
-                        case aperture_type_rectangle: {
-
-                            if(!should_hide(hide_element_rectangles)) {
-                                // FAIL_IF(aperture->parameters.size() < 4, error_bad_parameter_count);
-                                double p0 = (float)aperture->parameters[0];
-                                double p1 = (float)aperture->parameters[1];
-                                rect aperture_rect(-(p0 / 2), -(p1 / 2), p0 / 2, p1 / 2);
-                                CHECK(draw_rectangle(drawer, net, aperture_rect));
-                                // path.AddRectangle(apertureRectangle);
-                                // DrawAperatureHole(path, p2, p3);
-                            }
-                        } break;
-
-                        case aperture_type_oval: {
-
-                            if(!should_hide(hide_element_ovals)) {
-                                // FAIL_IF(aperture->parameters.size() < 4, error_bad_parameter_count);
-                                double w = (float)aperture->parameters[0];
-                                double h = (float)aperture->parameters[1];
-                                CHECK(draw_capsule(drawer, net, w, h));
-                                // CreateOblongPath(path, p0, p1);
-                                // DrawAperatureHole(path, p2, p3);
-                            }
-                        } break;
-
-                        case aperture_type_polygon: {
-
-                            if(!should_hide(hide_element_polygons)) {
-                                FAIL_IF(aperture->parameters.size() < 5, error_bad_parameter_count);
-                                double p0 = (float)aperture->parameters[0];
-                                double p1 = (float)aperture->parameters[1];
-                                double p2 = (float)aperture->parameters[2];
-                                CHECK(fill_polygon(drawer, p0, static_cast<int>(p1), p2));
-                                // DrawAperatureHole(path, p3, p4);
-                            }
-                        } break;
-
-                        case aperture_type_macro: {
+                        gerber_polarity polarity = net_polarity(net_index);
+                        int aperture_id = nets.aperture[net_index];
+                        gerber_draw_list const &shapes = apertures[aperture_id];
+                        gerber_flash flash{ nets.end[net_index], nets.entity_id[net_index] };
 
-                            if(!should_hide(hide_element_macros)) {
-                                CHECK(draw_macro(drawer, net, aperture));
+                        if(batch_flashes && shapes.error == ok) {
+                            if(!shapes.shapes.empty()) {
+                                if(!batch.empty() && (batch_aperture != aperture_id || batch_polarity != polarity)) {
+                                    flush_flashes();
+                                }
+                                batch_aperture = aperture_id;
+                                batch_polarity = polarity;
+                                batch.push_back(flash);
                             }
-                        } break;
-
-                        default:
-                            break;
+                        } else {
+                            shapes.send_flash(drawer, flash, polarity);
+                            CHECK(shapes.error);
                         }
                     } break;
 
                     // interpolate the aperture
                     case aperture_state_on:
 
-                        switch(net->interpolation_method) {
+                        switch(interpolation) {
 
                         // straight line
                         case interpolation_linear:
@@ -2700,7 +3137,7 @@ namespace gerber_lib
                                     if(aperture->aperture_type != aperture_type_circle) {
                                         LOG_DEBUG("{}", aperture->aperture_type);
                                     }
-                                    CHECK(draw_linear_interpolation(drawer, net, aperture));
+                                    CHECK(draw_linear_interpolation(drawer, net_index, aperture));
                                 }
                             }
                             break;
@@ -2713,7 +3150,7 @@ namespace gerber_lib
                                 LOG_ERROR("Missing parameters for arc!?");
                             } else {
                                 if(!should_hide(hide_element_arcs)) {
-                                    CHECK(draw_arc(drawer, net, aperture->parameters[0]));
+                                    CHECK(draw_arc(drawer, net_index, aperture->parameters[0]));
                                 }
                             }
                             break;
@@ -1,5 +1,10 @@
 //////////////////////////////////////////////////////////////////////
 
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+
 #include "gerber_error.h"
 
 //////////////////////////////////////////////////////////////////////
@@ -40,6 +45,29 @@ namespace
         return log_level_names[l];
     }
 
+    //////////////////////////////////////////////////////////////////////
+    // a function so it's there for contexts constructed before this file's statics
+
+    struct log_context_list
+    {
+        std::mutex mutex;
+        gerber_lib::gerber_log_context *head{ nullptr };
+        std::map<std::string, gerber_lib::gerber_log_level> levels;
+    };
+
+    log_context_list &log_contexts()
+    {
+        static log_context_list contexts;
+        return contexts;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void update_threshold(gerber_lib::gerber_log_context *context)
+    {
+        context->threshold.store(std::max(context->max_level, gerber_lib::log_level), std::memory_order_relaxed);
+    }
+
 }    // namespace
 
 //////////////////////////////////////////////////////////////////////
@@ -52,6 +80,48 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
+    gerber_log_context::gerber_log_context(char const *name, gerber_log_level level) : context(name), max_level(level)
+    {
+        log_context_list &contexts = log_contexts();
+        std::lock_guard lock(contexts.mutex);
+        auto found = contexts.levels.find(name);
+        if(found != contexts.levels.end()) {
+            max_level = found->second;
+        }
+        update_threshold(this);
+        next = contexts.head;
+        contexts.head = this;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void log_set_level(gerber_log_level level)
+    {
+        log_context_list &contexts = log_contexts();
+        std::lock_guard lock(contexts.mutex);
+        log_level = level;
+        for(gerber_log_context *c = contexts.head; c != nullptr; c = c->next) {
+            update_threshold(c);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void log_set_context_level(char const *context, gerber_log_level level)
+    {
+        log_context_list &contexts = log_contexts();
+        std::lock_guard lock(contexts.mutex);
+        contexts.levels[context] = level;
+        for(gerber_log_context *c = contexts.head; c != nullptr; c = c->next) {
+            if(strcmp(c->context, context) == 0) {
+                c->max_level = level;
+                update_threshold(c);
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     void gerber_log(gerber_log_level level, char const *context, char const *fmt, std::format_args const &fmt_args)
     {
         time_point<system_clock> now = system_clock::now();
@@ -54,8 +54,8 @@ namespace gerber_lib
 
     gerber_net::gerber_net(gerber_image *img) : gerber_net()
     {
-        level = new gerber_level(img);
-        net_state = new gerber_net_state(img);
+        level = img->level_pool.create(img);
+        net_state = img->net_state_pool.create(img);
         img->nets.push_back(this);
     }
 
@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "gerber_net_store.h"
+#include "gerber_net.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_net_store::reserve(size_t num_nets)
+    {
+        aperture_state.reserve(num_nets);
+        interpolation_method.reserve(num_nets);
+        hidden.reserve(num_nets);
+        aperture.reserve(num_nets);
+        level.reserve(num_nets);
+        entity_id.reserve(num_nets);
+        start.reserve(num_nets);
+        end.reserve(num_nets);
+        bounding_box.reserve(num_nets);
+        net_state.reserve(num_nets);
+        extra.reserve(num_nets);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_net_store::add(gerber_net const &net, int32_t level_index, int32_t net_state_index)
+    {
+        size_t net_index = size();
+
+        aperture_state.push_back(static_cast<uint8_t>(net.aperture_state));
+        interpolation_method.push_back(static_cast<uint8_t>(net.interpolation_method));
+        hidden.push_back(net.hidden ? 1 : 0);
+        aperture.push_back(net.aperture);
+        level.push_back(level_index);
+        entity_id.push_back(net.entity_id);
+        start.push_back(net.start);
+        end.push_back(net.end);
+
+        bounding_box.push_back(net.bounding_box);
+        net_state.push_back(net_state_index);
+
+        uint32_t x = no_extra;
+        if(is_arc(net_index)) {
+            x = static_cast<uint32_t>(arcs.size());
+            arcs.push_back(net.circle_segment);
+        } else if(net.interpolation_method == interpolation_region_start) {
+            x = static_cast<uint32_t>(net.num_region_points);
+        }
+        extra.push_back(x);
+
+        if(!net.label.empty()) {
+            labels[net_index] = net.label;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // walk the nets the same way draw() does, a region runs from its region_start
+    // to the next region_end and anything in between is part of the outline
+
+    void gerber_net_store::index_regions()
+    {
+        regions.clear();
+        region_elements.clear();
+
+        size_t num_nets = size();
+
+        for(size_t net_index = 0; net_index < num_nets; ++net_index) {
+
+            if(get_interpolation(net_index) != interpolation_region_start) {
+                continue;
+            }
+
+            gerber_region &region = regions.emplace_back();
+            region.first_net = net_index;
+            region.first_element = region_elements.size();
+
+            bool in_contour = false;
+
+            size_t last_index = net_index + 1;
+
+            for(; last_index < num_nets; ++last_index) {
+
+                gerber_interpolation interpolation = get_interpolation(last_index);
+
+                if(interpolation == interpolation_region_end) {
+                    break;
+                }
+
+                if(get_aperture_state(last_index) != aperture_state_on) {
+                    in_contour = false;
+                    continue;
+                }
+
+                if(region.bad_net != gerber_region::no_net) {
+                    continue;
+                }
+
+                switch(interpolation) {
+
+                case interpolation_linear: {
+                    gerber_2d::vec2d const &s = start[last_index];
+                    gerber_2d::vec2d const &e = end[last_index];
+                    if(s.x != e.x || s.y != e.y) {
+                        region_elements.emplace_back(s, e);
+                        region.bounds.add_point(s);
+                        region.bounds.add_point(e);
+                    }
+                } break;
+
+                case interpolation_clockwise_circular:
+                case interpolation_counterclockwise_circular: {
+                    gerber_arc const &a = arc(last_index);
+                    double radius = a.size.x / 2;
+                    region_elements.emplace_back(a.pos, a.start_angle, a.end_angle, radius);
+                    region.bounds.add_point({ a.pos.x - radius, a.pos.y - radius });
+                    region.bounds.add_point({ a.pos.x + radius, a.pos.y + radius });
+                } break;
+
+                default:
+                    region.bad_net = last_index;
+                    continue;
+                }
+
+                if(!in_contour) {
+                    region.num_contours += 1;
+                    in_contour = true;
+                }
+            }
+
+            region.last_net = last_index;
+            region.num_elements = region_elements.size() - region.first_element;
+
+            net_index = last_index;
+        }
+
+        regions.shrink_to_fit();
+        region_elements.shrink_to_fit();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_region const *gerber_net_store::find_region(size_t net_index) const
+    {
+        auto f = std::lower_bound(regions.begin(), regions.end(), net_index, [](gerber_region const &r, size_t n) { return r.first_net < n; });
+        if(f == regions.end() || f->first_net != net_index) {
+            return nullptr;
+        }
+        return &*f;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_net_store::clear()
+    {
+        *this = gerber_net_store{};
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    size_t gerber_net_store::bytes_used() const
+    {
+        auto column_bytes = [](auto const &v) { return v.capacity() * sizeof(v[0]); };
+
+        return column_bytes(aperture_state) + column_bytes(interpolation_method) + column_bytes(hidden) + column_bytes(aperture) +
+               column_bytes(level) + column_bytes(entity_id) + column_bytes(start) + column_bytes(end) + column_bytes(bounding_box) +
+               column_bytes(net_state) + column_bytes(extra) + column_bytes(arcs) +
+               column_bytes(regions) + column_bytes(region_elements);
+    }
+
+}    // namespace gerber_lib
@@ -0,0 +1,475 @@
+//////////////////////////////////////////////////////////////////////
+// Parse a single file on multiple threads
+//
+// prescan_chunks makes one quick pass over the file on the calling thread. It only
+// tracks the modal state (position, aperture, interpolation, region mode, format)
+// and runs the % commands which create shared things (apertures, levels, net states)
+// so they end up in this->image just like they would with parse_file.
+//
+// The file is cut after a '*' (outside a region) every chunk_size bytes and at each
+// of those % commands, and the modal state is saved at each cut. The chunks are then
+// parsed by parse_gerber_segment into temporary gerber objects on worker threads and
+// stitched back together in order, so the result is the same as parse_file.
+//
+// If the prescan sees anything it can't split around safely (any G70/G71, KO, a %command
+// inside a region, an aperture being redefined), anything goes wrong or a worker doesn't
+// finish its chunk in the state the prescan started the next one with, it falls back
+// to parse_file.
+
+#include <thread>
+#include <atomic>
+#include <optional>
+#include <algorithm>
+
+#include "gerber_lib.h"
+#include "gerber_net.h"
+#include "gerber_aperture.h"
+#include "gerber_image.h"
+
+LOG_CONTEXT("parallel", info);
+
+namespace
+{
+    // don't bother with threads for less than this much per chunk
+
+    constexpr size_t min_parallel_chunk_size = 1024 * 1024;
+
+    // parse_rs274x stores the aperture number in the current net when it sees %AD%
+
+    constexpr int no_aperture = -1;
+
+    //////////////////////////////////////////////////////////////////////
+    // % commands which only change the image info, format or attribute dictionary
+    // can be parsed by the workers because they get their own copies of those
+
+    bool worker_can_parse(uint32_t command)
+    {
+        switch(command) {
+        case 'TO':
+        case 'TD':
+        case 'TA':
+        case 'TF':
+        case 'FS':
+        case 'IN':
+        case 'PF':
+        case 'IP':
+        case 'IJ':
+        case 'IO':
+        case 'IR':
+            return true;
+        }
+        return false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the parts of the state which carry over from one chunk to the next
+
+    bool same_modal_state(gerber_lib::gerber_state const &a, gerber_lib::gerber_state const &b)
+    {
+        return a.current_x == b.current_x && a.current_y == b.current_y && a.previous_x == b.previous_x && a.previous_y == b.previous_y &&
+               a.center_x == b.center_x && a.center_y == b.center_y && a.current_aperture == b.current_aperture && a.changed_state == b.changed_state &&
+               a.aperture_state == b.aperture_state && a.interpolation == b.interpolation && a.previous_interpolation == b.previous_interpolation &&
+               a.is_region_fill == b.is_region_fill && a.is_multi_quadrant == b.is_multi_quadrant && a.level == b.level && a.net_state == b.net_state;
+    }
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // everything a worker needs to carry on from where the previous chunk left off
+
+    struct gerber_parse_chunk
+    {
+        size_t begin{};
+        size_t end{};
+
+        gerber_state state;
+        gerber_format format;
+        gerber_image_info info;
+        std::map<std::string, std::string> dictionary;
+        gerber_attribute_set attributes;
+        gerber_aperture_table apertures;
+        std::vector<gerber_aperture_info> d_codes;
+
+        // an %AD% which came before this chunk sets the aperture of the previous net
+        std::optional<int> previous_net_aperture;
+
+        // what the prescan had at the end of the chunk, the worker should finish with the same
+        gerber_state end_state;
+        gerber_coordinate end_coordinate{ coordinate_absolute };
+
+        std::unique_ptr<gerber> result;
+        gerber_error_code error{ ok };
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber::parse_file_parallel(char const *file_path, int num_threads, size_t chunk_size)
+    {
+        if(num_threads <= 0) {
+            num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+
+        cleanup();
+
+        image.file_type = file_type_rs274x;
+
+        image.gerber = this;
+
+        gerber_net *current_net = image.net_pool.create(&image);
+
+        state.level = image.levels[0];
+        state.net_state = image.net_states[0];
+
+        current_net->level = state.level;
+        current_net->net_state = state.net_state;
+
+        CHECK(reader.open(file_path));
+
+        size_t file_size = reader.file_data.size();
+
+        if(chunk_size == 0) {
+            chunk_size = std::max(min_parallel_chunk_size, file_size / (num_threads * 4));
+        }
+
+        if(num_threads == 1 || file_size < chunk_size * 2) {
+            return parse_file(file_path);
+        }
+
+        std::vector<gerber_parse_chunk> chunks;
+
+        // the prescan counts things as it goes, the workers count them again
+        gerber_stats counted;
+        counted.accumulate(stats);
+
+        gerber_error_code prescan_error = prescan_chunks(chunks, chunk_size);
+
+        stats.reset_counters();
+        stats.accumulate(counted);
+
+        if(prescan_error != ok || chunks.size() < 2) {
+            LOG_VERBOSE("Parsing {} serially", file_path);
+            return parse_file(file_path);
+        }
+
+        LOG_VERBOSE("Parsing {} in {} chunks on {} threads", file_path, chunks.size(), num_threads);
+
+        std::atomic<size_t> next_chunk{ 0 };
+
+        auto worker = [&]() {
+            for(size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+                gerber_parse_chunk &chunk = chunks[i];
+                chunk.result = std::make_unique<gerber>();
+                chunk.error = chunk.result->parse_chunk(*this, chunk);
+                // the apertures belong to this->image
+                chunk.result->image.apertures.clear();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(size_t i = 1; i < std::min(static_cast<size_t>(num_threads), chunks.size()); ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for(auto &t : threads) {
+            t.join();
+        }
+
+        for(auto const &chunk : chunks) {
+            if(chunk.error != ok) {
+                LOG_VERBOSE("Chunk at {} failed, parsing {} serially", chunk.begin, file_path);
+                return parse_file(file_path);
+            }
+            if(!same_modal_state(chunk.result->state, chunk.end_state) || chunk.result->image.format.coordinate != chunk.end_coordinate) {
+                LOG_ERROR("Prescan state doesn't match at {}, parsing {} serially", chunk.end, file_path);
+                return parse_file(file_path);
+            }
+        }
+
+        for(auto &chunk : chunks) {
+            if(chunk.previous_net_aperture.has_value()) {
+                image.nets.back()->aperture = *chunk.previous_net_aperture;
+            }
+            stitch_chunk(*chunk.result);
+        }
+
+        image.compact_nets();
+        state.region_start_node = nullptr;
+
+        filename = std::string{ file_path };
+
+        LOG_VERBOSE("Parsing complete after {} lines, found {} entities", gerber_source_line{ &reader, reader.file_data.size() }, entities.size());
+
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // G, D, M and coordinates go through the same functions parse_gerber_segment uses, the
+    // end of statement handling is copied from it so parse_file_parallel checks the state
+    // at every cut against what the worker ended up with
+
+    gerber_error_code gerber::prescan_chunks(std::vector<gerber_parse_chunk> &chunks, size_t chunk_size)
+    {
+        bool done{ false };
+        bool chunk_open{ false };
+
+        std::optional<int> pending_aperture;
+
+        auto begin_chunk = [&](size_t offset) {
+            gerber_parse_chunk &chunk = chunks.emplace_back();
+            chunk.begin = offset;
+            chunk.state = state;
+            chunk.format = image.format;
+            chunk.info = image.info;
+            chunk.dictionary = dictionary;
+            chunk.attributes = current_attributes();
+            chunk.apertures = image.apertures;
+            for(gerber_aperture_info const *d : stats.d_codes) {
+                chunk.d_codes.push_back(*d);
+            }
+            chunk.previous_net_aperture = pending_aperture;
+            pending_aperture.reset();
+            chunk_open = true;
+        };
+
+        auto end_chunk = [&](size_t offset) {
+            if(chunk_open) {
+                chunks.back().end = offset;
+                chunks.back().end_state = state;
+                chunks.back().end_coordinate = image.format.coordinate;
+                chunk_open = false;
+            }
+        };
+
+        auto forget_errors = [&](size_t count) {
+            while(stats.errors.size() > count) {
+                stats.errors.pop_back();
+            }
+        };
+
+        while(!reader.eof() && !done) {
+
+            char c;
+            gerber_error_code err = reader.read_char(&c);
+            if(err == error_end_of_file) {
+                break;
+            }
+            CHECK(err);
+
+            size_t offset = reader.file_pos - 1;
+
+            if(c == '%') {
+
+                size_t pos = reader.file_pos;
+                uint32_t command;
+                CHECK(reader.read_short(&command, 2));
+                reader.file_pos = pos;
+
+                if(worker_can_parse(command)) {
+
+                    // the worker will parse it (and report any errors), just keep this->image up to date
+                    if(!chunk_open) {
+                        begin_chunk(offset);
+                    }
+                    size_t error_count = stats.errors.size();
+                    CHECK(parse_rs274x(nullptr));
+                    forget_errors(error_count);
+                    continue;
+                }
+
+                if(state.is_region_fill || command == 'KO') {
+                    return error_not_supported;
+                }
+
+                end_chunk(offset);
+
+                gerber_net scratch_net;
+                scratch_net.aperture = no_aperture;
+                size_t aperture_count = image.apertures.size();
+
+                CHECK(parse_rs274x(&scratch_net));
+
+                if(scratch_net.aperture != no_aperture) {
+                    if(image.apertures.size() == aperture_count) {
+                        return error_not_supported;
+                    }
+                    pending_aperture = scratch_net.aperture;
+                }
+                continue;
+            }
+
+            if(!chunk_open) {
+                begin_chunk(offset);
+            }
+
+            // the workers report any errors in their chunks
+            size_t error_count = stats.errors.size();
+
+            switch(c) {
+
+            case 'G': {
+                // the workers share the net states so the units can't change under them
+                size_t pos = reader.file_pos;
+                int code;
+                CHECK(reader.get_int(&code));
+                if(code == 70 || code == 71) {
+                    return error_not_supported;
+                }
+                reader.file_pos = pos;
+                CHECK(parse_g_code());
+            } break;
+
+            case 'D': {
+                CHECK(parse_d_code());
+            } break;
+
+            case 'M': {
+                done = parse_m_code();
+            } break;
+
+            case 'X':
+            case 'Y':
+            case 'I':
+            case 'J': {
+                CHECK(parse_coordinate(c));
+            } break;
+
+            case '*': {
+
+                if(state.changed_state) {
+
+                    state.changed_state = false;
+
+                    if(state.aperture_state == aperture_state_off && !state.is_region_fill && state.interpolation != interpolation_region_start) {
+
+                        state.previous_x = state.current_x;
+                        state.previous_y = state.current_y;
+
+                    } else {
+
+                        switch(state.interpolation) {
+                        case interpolation_region_start:
+                            state.aperture_state = aperture_state_on;
+                            state.is_region_fill = true;
+                            state.current_aperture = 0;
+                            break;
+                        case interpolation_region_end:
+                            state.is_region_fill = false;
+                            break;
+                        default:
+                            break;
+                        }
+
+                        if(state.interpolation == interpolation_region_start || state.interpolation == interpolation_region_end) {
+                            state.interpolation = state.previous_interpolation;
+                        }
+
+                        state.center_x = 0;
+                        state.center_y = 0;
+
+                        state.previous_x = state.current_x;
+                        state.previous_y = state.current_y;
+                    }
+                }
+
+                if(!state.is_region_fill && reader.file_pos - chunks.back().begin >= chunk_size) {
+                    end_chunk(reader.file_pos);
+                }
+            } break;
+            }
+
+            forget_errors(error_count);
+        }
+
+        end_chunk(reader.file_data.size());
+
+        // an %AD% right at the end still sets the aperture of the last net
+        if(pending_aperture.has_value()) {
+            if(chunks.empty()) {
+                return error_not_supported;
+            }
+            begin_chunk(reader.file_data.size());
+            end_chunk(reader.file_data.size());
+        }
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // runs on a worker thread, source is only read from
+
+    gerber_error_code gerber::parse_chunk(gerber const &source, gerber_parse_chunk &chunk)
+    {
+        image.gerber = this;
+        image.format = chunk.format;
+        image.info = chunk.info;
+        image.apertures = chunk.apertures;
+
+        state = chunk.state;
+        state.entity_id = 0;
+
+        dictionary = chunk.dictionary;
+
+        // the strings go in the main pool so the attribute sets outlive this worker
+        string_pool = source.string_pool;
+        attributes = chunk.attributes;
+        attributes_changed = false;
+
+        for(gerber_aperture_info &d : chunk.d_codes) {
+            stats.insert_d_code(&d);
+        }
+
+        reader.open_view(source.reader, chunk.begin, chunk.end);
+
+        return parse_gerber_segment(nullptr);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // append the results from a worker
+
+    void gerber::stitch_chunk(gerber &worker)
+    {
+        size_t net_base = image.nets.size();
+
+        for(gerber_net *net : worker.image.nets) {
+            net->entity_id += state.entity_id;
+            image.nets.push_back(net);
+        }
+        worker.image.nets.clear();
+
+        // the nets live in the worker's pool, take it over so they outlive the worker
+        image.net_pool.adopt(worker.image.net_pool);
+
+        for(gerber_entity &entity : worker.entities) {
+            entity.net_index += net_base;
+            entities.push_back(std::move(entity));
+        }
+        worker.entities.clear();
+
+        state.entity_id += worker.state.entity_id;
+
+        gerber_2d::rect const &chunk_extent = worker.image.info.extent;
+        gerber_2d::rect &extent = image.info.extent;
+
+        if(chunk_extent.min_pos.x < extent.min_pos.x) {
+            extent.min_pos.x = chunk_extent.min_pos.x;
+        }
+        if(chunk_extent.max_pos.x > extent.max_pos.x) {
+            extent.max_pos.x = chunk_extent.max_pos.x;
+        }
+        if(chunk_extent.min_pos.y < extent.min_pos.y) {
+            extent.min_pos.y = chunk_extent.min_pos.y;
+        }
+        if(chunk_extent.max_pos.y > extent.max_pos.y) {
+            extent.max_pos.y = chunk_extent.max_pos.y;
+        }
+
+        stats.accumulate(worker.stats);
+        stats.errors.merge(worker.stats.errors, [](gerber_error const &a, gerber_error const &b) { return a.file_offset < b.file_offset; });
+
+        // these point into the chunk
+        worker.stats.d_codes.clear();
+        worker.stats.d_code_table.clear();
+    }
+
+}    // namespace gerber_lib
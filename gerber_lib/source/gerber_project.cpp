@@ -0,0 +1,213 @@
+//////////////////////////////////////////////////////////////////////
+// Load all the layers of a job concurrently
+
+#include <filesystem>
+#include <algorithm>
+#include <cfloat>
+#include <cctype>
+
+#include "gerber_log.h"
+#include "gerber_project.h"
+
+LOG_CONTEXT("project", info);
+
+namespace
+{
+    //////////////////////////////////////////////////////////////////////
+    // extensions which CAD packages commonly use for gerber layers
+
+    char const *gerber_extensions[] = { ".gbr", ".ger", ".pho", ".art", ".gtl", ".gbl", ".gts", ".gbs", ".gto", ".gbo",
+                                        ".gtp", ".gbp", ".gko", ".gml", ".gm1", ".gm2", ".gm3", ".gpt", ".gpb" };
+
+}    // namespace
+
+namespace gerber_lib
+{
+    namespace gerber_enum_names
+    {
+        std::map<gerber_layer_status, char const *> gerber_layer_status_names_map = {
+            { layer_status_pending, "pending" },
+            { layer_status_loading, "loading" },
+            { layer_status_loaded, "loaded" },
+            { layer_status_failed, "failed" },
+        };
+
+    }    // namespace gerber_enum_names
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_project::~gerber_project()
+    {
+        cleanup();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_project::cleanup()
+    {
+        // let anything in flight finish, nobody else owns the layers
+        next_layer = layers.size();
+        for(auto &t : threads) {
+            if(t.joinable()) {
+                t.join();
+            }
+        }
+        threads.clear();
+        layers.clear();
+        next_layer = 0;
+        layers_finished = 0;
+        threads_per_layer = 1;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool gerber_project::is_gerber_filename(std::string const &filename)
+    {
+        std::string ext = std::filesystem::path(filename).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+        for(char const *e : gerber_extensions) {
+            if(ext == e) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_project::load_directory(char const *path, int num_threads)
+    {
+        std::error_code ec;
+        std::vector<std::string> filenames;
+        for(auto const &entry : std::filesystem::directory_iterator(path, ec)) {
+            if(entry.is_regular_file(ec) && is_gerber_filename(entry.path().string())) {
+                filenames.push_back(entry.path().string());
+            }
+        }
+        if(ec) {
+            LOG_ERROR("Can't read folder {} ({})", path, ec.message());
+            return error_cant_open_file;
+        }
+
+        // directory order isn't defined, keep the layers in a predictable order
+        std::sort(filenames.begin(), filenames.end());
+
+        return load_files(filenames, num_threads);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_project::load_files(std::vector<std::string> const &filenames, int num_threads)
+    {
+        cleanup();
+
+        for(auto const &filename : filenames) {
+            auto layer = std::make_unique<gerber_project_layer>();
+            layer->filename = filename;
+            layers.push_back(std::move(layer));
+        }
+
+        if(layers.empty()) {
+            return ok;
+        }
+
+        int num_cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        if(num_threads <= 0) {
+            num_threads = num_cores;
+        }
+        num_threads = std::min(num_threads, static_cast<int>(layers.size()));
+
+        // if there are more cores than layers, the spare ones help with the big layers
+        threads_per_layer = std::max(1, num_cores / static_cast<int>(layers.size()));
+
+        LOG_INFO("Loading {} layers on {} threads ({} per layer)", layers.size(), num_threads, threads_per_layer);
+
+        for(int i = 0; i < num_threads; ++i) {
+            threads.emplace_back([this]() { worker(); });
+        }
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_project::worker()
+    {
+        while(true) {
+            size_t index = next_layer.fetch_add(1);
+            if(index >= layers.size()) {
+                return;
+            }
+            gerber_project_layer &layer = *layers[index];
+            layer.status = layer_status_loading;
+
+            auto g = std::make_unique<gerber>();
+            gerber_error_code err;
+            if(cache_folder.empty()) {
+                err = g->parse_file_parallel(layer.filename.c_str(), threads_per_layer);
+            } else {
+                err = g->parse_file_cached(layer.filename.c_str(), cache_folder.c_str(), threads_per_layer);
+            }
+
+            if(err != ok) {
+                LOG_ERROR("Error loading {}: {}", layer.filename, err);
+            }
+            layer.layer = std::move(g);
+            layer.status = (err == ok) ? layer_status_loaded : layer_status_failed;
+            layers_finished += 1;
+            layer.promise.set_value(err);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_project::wait()
+    {
+        gerber_error_code first_error = ok;
+        for(auto &layer : layers) {
+            gerber_error_code err = layer->result.get();
+            if(first_error == ok) {
+                first_error = err;
+            }
+        }
+        return first_error;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    double gerber_project::progress() const
+    {
+        if(layers.empty()) {
+            return 1.0;
+        }
+        return static_cast<double>(layers_finished) / static_cast<double>(layers.size());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool gerber_project::finished() const
+    {
+        return layers_finished == layers.size();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_2d::rect gerber_project::extent() const
+    {
+        gerber_2d::rect total{ DBL_MAX, DBL_MAX, -DBL_MAX, -DBL_MAX };
+        for(auto const &layer : layers) {
+            if(layer->status != layer_status_loaded) {
+                continue;
+            }
+            gerber_2d::rect const &e = layer->layer->image.info.extent;
+            if(e.min_pos.x > e.max_pos.x || e.min_pos.y > e.max_pos.y) {
+                continue;
+            }
+            total.min_pos.x = std::min(total.min_pos.x, e.min_pos.x);
+            total.min_pos.y = std::min(total.min_pos.y, e.min_pos.y);
+            total.max_pos.x = std::max(total.max_pos.x, e.max_pos.x);
+            total.max_pos.y = std::max(total.max_pos.y, e.max_pos.y);
+        }
+        return total;
+    }
+
+}    // namespace gerber_lib
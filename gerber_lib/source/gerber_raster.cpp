@@ -0,0 +1,811 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cfloat>
+#include <array>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <condition_variable>
+
+#include "gerber_log.h"
+#include "gerber_raster.h"
+
+LOG_CONTEXT("raster", info);
+
+namespace
+{
+    using namespace gerber_lib;
+
+    //////////////////////////////////////////////////////////////////////
+    // each row of pixels is sampled along this many lines
+
+    constexpr int sub_scanlines = 16;
+
+    //////////////////////////////////////////////////////////////////////
+    // The edges of a run of shapes in one tile. Each sub scanline gets a list of
+    // where the edges cross it, sorting those and adding up the windings gives
+    // the spans which are inside (non-zero), and the exact length of each span in
+    // each pixel is added to that pixel's coverage. Shapes which overlap or touch
+    // come out right because it's the total winding that matters, not the shapes
+
+    struct tile_scanlines
+    {
+        struct crossing
+        {
+            float x;
+            int winding;
+        };
+
+        int width{};
+        int height{};
+
+        // where the edges cross each sub scanline
+        std::vector<std::vector<crossing>> lines;
+
+        // per row: coverage of pixels partly covered, and the start/end of fully covered pixels
+        std::vector<float> partial;
+        std::vector<float> full;
+        std::vector<uint8_t> row_used;
+
+        // everything is left empty after fill() so it only needs clearing when it grows
+
+        void set_size(int tile_width, int tile_height)
+        {
+            width = tile_width;
+            height = tile_height;
+            size_t const cells = static_cast<size_t>(width + 1) * height;
+            if(cells > full.size()) {
+                partial.assign(cells, 0.0f);
+                full.assign(cells, 0.0f);
+            }
+            if(static_cast<size_t>(height) > row_used.size()) {
+                row_used.assign(height, 0);
+            }
+            if(static_cast<size_t>(height) * sub_scanlines > lines.size()) {
+                lines.resize(static_cast<size_t>(height) * sub_scanlines);
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // coordinates are pixels from the top left of the tile, x can be anywhere
+
+        void add_line(float x0, float y0, float x1, float y1)
+        {
+            if(y0 == y1) {
+                return;
+            }
+            int winding = 1;
+            if(y0 > y1) {
+                std::swap(x0, x1);
+                std::swap(y0, y1);
+                winding = -1;
+            }
+
+            // the sub scanlines at (n + 0.5) / sub_scanlines where y0 <= y < y1
+
+            int first = std::max(0, static_cast<int>(ceilf(y0 * sub_scanlines - 0.5f)));
+            int last = std::min(height * sub_scanlines, static_cast<int>(ceilf(y1 * sub_scanlines - 0.5f)));
+
+            float dxdy = (x1 - x0) / (y1 - y0);
+            for(int n = first; n < last; ++n) {
+                float y = (static_cast<float>(n) + 0.5f) / sub_scanlines;
+                lines[n].push_back({ x0 + (y - y0) * dxdy, winding });
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void add_span(int row, float xa, float xb)
+        {
+            xa = std::max(xa, 0.0f);
+            xb = std::min(xb, static_cast<float>(width));
+            if(xa >= xb) {
+                return;
+            }
+            float const weight = 1.0f / sub_scanlines;
+            float *row_partial = partial.data() + static_cast<size_t>(row) * width;
+            float *row_full = full.data() + static_cast<size_t>(row) * (width + 1);
+            int a = static_cast<int>(xa);
+            int b = static_cast<int>(xb);
+            row_used[row] = 1;
+            if(a == b) {
+                row_partial[a] += (xb - xa) * weight;
+                return;
+            }
+            row_partial[a] += (static_cast<float>(a + 1) - xa) * weight;
+            row_full[a + 1] += weight;
+            row_full[b] -= weight;
+            if(b < width) {
+                row_partial[b] += (xb - static_cast<float>(b)) * weight;
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // work out the coverage and composite it onto out (width x height), leaves everything empty
+
+        void fill(float *out, bool dark)
+        {
+            for(int n = 0; n < height * sub_scanlines; ++n) {
+                std::vector<crossing> &line = lines[n];
+                if(line.empty()) {
+                    continue;
+                }
+                std::sort(line.begin(), line.end(), [](crossing const &a, crossing const &b) { return a.x < b.x; });
+                int winding = 0;
+                float span_start = 0;
+                for(crossing const &c : line) {
+                    int previous = winding;
+                    winding += c.winding;
+                    if(previous == 0 && winding != 0) {
+                        span_start = c.x;
+                    } else if(previous != 0 && winding == 0) {
+                        add_span(n / sub_scanlines, span_start, c.x);
+                    }
+                }
+                line.clear();
+            }
+
+            for(int y = 0; y < height; ++y) {
+                if(row_used[y] == 0) {
+                    continue;
+                }
+                float *row_partial = partial.data() + static_cast<size_t>(y) * width;
+                float *row_full = full.data() + static_cast<size_t>(y) * (width + 1);
+                float *row_out = out + static_cast<size_t>(y) * width;
+                float full_coverage = 0;
+                for(int x = 0; x < width; ++x) {
+                    full_coverage += row_full[x];
+                    float c = std::min(row_partial[x] + full_coverage, 1.0f);
+                    row_partial[x] = 0;
+                    row_full[x] = 0;
+                    if(c > 0) {
+                        row_out[x] = dark ? row_out[x] + c * (1 - row_out[x]) : row_out[x] * (1 - c);
+                    }
+                }
+                row_full[width] = 0;
+                row_used[y] = 0;
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // binary pgm or greyscale png with stored (uncompressed) deflate blocks, both
+    // written a few rows at a time
+
+    struct image_writer
+    {
+        std::ofstream file;
+        bool png{ false };
+
+        // png: zlib stream for the next IDAT chunk and raw data for the next stored block
+        std::vector<uint8_t> idat;
+        std::vector<uint8_t> block;
+        uint64_t raw_bytes_left{};
+        uint32_t adler_a{ 1 };
+        uint32_t adler_b{ 0 };
+
+        static constexpr size_t max_block_size = 65535;
+
+        //////////////////////////////////////////////////////////////////////
+
+        static uint32_t crc32(uint32_t crc, uint8_t const *data, size_t size)
+        {
+            static std::array<uint32_t, 256> const table = [] {
+                std::array<uint32_t, 256> t{};
+                for(uint32_t n = 0; n < 256; ++n) {
+                    uint32_t c = n;
+                    for(int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    t[n] = c;
+                }
+                return t;
+            }();
+            crc = ~crc;
+            for(size_t i = 0; i < size; ++i) {
+                crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        static void put_be32(std::vector<uint8_t> &v, uint32_t n)
+        {
+            v.insert(v.end(), { static_cast<uint8_t>(n >> 24), static_cast<uint8_t>(n >> 16), static_cast<uint8_t>(n >> 8), static_cast<uint8_t>(n) });
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void write_chunk(char const *type, std::vector<uint8_t> const &data)
+        {
+            std::vector<uint8_t> header;
+            put_be32(header, static_cast<uint32_t>(data.size()));
+            header.insert(header.end(), type, type + 4);
+            uint32_t crc = crc32(crc32(0, header.data() + 4, 4), data.data(), data.size());
+            std::vector<uint8_t> trailer;
+            put_be32(trailer, crc);
+            file.write(reinterpret_cast<char const *>(header.data()), header.size());
+            file.write(reinterpret_cast<char const *>(data.data()), data.size());
+            file.write(reinterpret_cast<char const *>(trailer.data()), trailer.size());
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void end_block()
+        {
+            uint16_t size = static_cast<uint16_t>(block.size());
+            idat.push_back(raw_bytes_left == 0 ? 1 : 0);
+            idat.insert(idat.end(), { static_cast<uint8_t>(size), static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(~size), static_cast<uint8_t>(~size >> 8) });
+            idat.insert(idat.end(), block.begin(), block.end());
+            block.clear();
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void put_raw(uint8_t const *data, size_t size)
+        {
+            // adler32, taking the modulo every 5552 bytes is as late as it can be left
+            for(size_t done = 0; done < size;) {
+                size_t n = std::min(size - done, size_t{ 5552 });
+                for(size_t i = 0; i < n; ++i) {
+                    adler_a += data[done + i];
+                    adler_b += adler_a;
+                }
+                adler_a %= 65521;
+                adler_b %= 65521;
+                done += n;
+            }
+            while(size != 0) {
+                size_t n = std::min(size, max_block_size - block.size());
+                block.insert(block.end(), data, data + n);
+                data += n;
+                size -= n;
+                raw_bytes_left -= n;
+                if(block.size() == max_block_size || raw_bytes_left == 0) {
+                    end_block();
+                }
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        bool open(char const *file_path, int width, int height)
+        {
+            std::string extension = std::filesystem::path(file_path).extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+            png = extension == ".png";
+
+            file.open(file_path, std::ios::binary | std::ios::trunc);
+            if(!file) {
+                return false;
+            }
+
+            if(!png) {
+                file << std::format("P5\n{} {}\n255\n", width, height);
+                return file.good();
+            }
+
+            static uint8_t const signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+            file.write(reinterpret_cast<char const *>(signature), sizeof(signature));
+
+            std::vector<uint8_t> header;
+            put_be32(header, static_cast<uint32_t>(width));
+            put_be32(header, static_cast<uint32_t>(height));
+            header.insert(header.end(), { 8, 0, 0, 0, 0 });    // 8 bit greyscale
+            write_chunk("IHDR", header);
+
+            raw_bytes_left = static_cast<uint64_t>(width + 1) * height;
+            idat = { 0x78, 0x01 };
+            return file.good();
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void write_row(uint8_t const *row, int width)
+        {
+            if(!png) {
+                file.write(reinterpret_cast<char const *>(row), width);
+                return;
+            }
+            uint8_t const no_filter = 0;
+            put_raw(&no_filter, 1);
+            put_raw(row, width);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // after each band
+
+        bool flush()
+        {
+            if(png && !idat.empty()) {
+                if(raw_bytes_left == 0) {
+                    put_be32(idat, (adler_b << 16) | adler_a);
+                }
+                write_chunk("IDAT", idat);
+                idat.clear();
+            }
+            return file.good();
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        bool close()
+        {
+            flush();
+            if(png) {
+                write_chunk("IEND", {});
+            }
+            file.close();
+            return !file.fail();
+        }
+    };
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::set_gerber(gerber *g)
+    {
+        (void)g;
+        clear();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::clear()
+    {
+        points.clear();
+        shapes.clear();
+        groups.clear();
+        instances.clear();
+        apertures.clear();
+        flash_shapes.clear();
+        group_open = false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::begin_layer(size_t num_shapes, size_t num_elements)
+    {
+        shapes.reserve(shapes.size() + num_shapes);
+        points.reserve(points.size() + num_elements * 2);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::fill_elements(gerber_draw_element const *elements, size_t num_elements, gerber_polarity polarity, int entity_id)
+    {
+        (void)entity_id;
+
+        if(!group_open) {
+            raster_point none{ 0, 0 };
+            add_group(&none, 1);
+        }
+        uint32_t first_shape = static_cast<uint32_t>(shapes.size());
+        add_outline(elements, num_elements, polarity == polarity_dark || polarity == polarity_positive);
+        add_to_group(groups.back(), first_shape);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::add_outline(gerber_draw_element const *elements, size_t num_elements, bool dark)
+    {
+        // chords cut the corners off arcs, keep them well within a pixel so small circles don't come out thin
+        clip_path_from_elements(elements, num_elements, 25.4 / dpi / 16, shape_path);
+
+        if(shape_path.size() < 3) {
+            return;
+        }
+
+        int turns = clip_path_turns(shape_path);
+
+        if(turns == 1 || turns == -1) {
+            if(turns == -1) {
+                std::reverse(shape_path.begin(), shape_path.end());
+            }
+            add_path(shape_path, dark);
+            return;
+        }
+
+        // if it can't be sorted out, fill it as it is, parts of it might come out wrong
+
+        shape_paths.clear();
+        shape_paths.push_back(shape_path);
+        if(clip_polygons(shape_paths, {}, clip_union, clip_even_odd, shape_polygons) != ok) {
+            add_path(shape_path, dark);
+            return;
+        }
+        for(clip_polygon const &polygon : shape_polygons) {
+            add_path(polygon.outer, dark);
+            for(clip_path const &hole : polygon.holes) {
+                add_path(hole, dark);
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool gerber_rasterizer::draws_repeats() const
+    {
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::begin_repeat(vec2d const *offsets, size_t num_offsets)
+    {
+        std::vector<raster_point> copies;
+        copies.reserve(num_offsets);
+        for(size_t i = 0; i < num_offsets; ++i) {
+            copies.push_back({ static_cast<float>(offsets[i].x), static_cast<float>(offsets[i].y) });
+        }
+        add_group(copies.data(), copies.size());
+        group_open = true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::end_repeat()
+    {
+        group_open = false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool gerber_rasterizer::draws_flashes() const
+    {
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::define_aperture(int aperture_id, gerber_draw_element const *elements, gerber_draw_shape const *draw_shapes, size_t num_shapes)
+    {
+        if(apertures.contains(aperture_id)) {
+            return;
+        }
+        gerber_draw_list &aperture = apertures[aperture_id];
+        for(size_t i = 0; i < num_shapes; ++i) {
+            gerber_draw_shape const &shape = draw_shapes[i];
+            aperture.fill_elements(elements + shape.first_element, shape.num_elements, shape.polarity, shape.entity_id);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the aperture's outlines are only made the first time it's flashed with each polarity
+
+    void gerber_rasterizer::flash_aperture(int aperture_id, gerber_polarity polarity, gerber_flash const *flashes, size_t num_flashes)
+    {
+        auto aperture = apertures.find(aperture_id);
+        if(aperture == apertures.end()) {
+            return;
+        }
+
+        bool dark = polarity == polarity_dark || polarity == polarity_positive;
+
+        auto found = flash_shapes.find({ aperture_id, dark });
+        if(found == flash_shapes.end()) {
+            raster_group outlines{ static_cast<uint32_t>(shapes.size()), 0, 0, 0, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for(gerber_draw_shape const &shape : aperture->second.shapes) {
+                bool shape_dark = shape.polarity == polarity_clear ? !dark : dark;
+                add_outline(aperture->second.elements.data() + shape.first_element, shape.num_elements, shape_dark);
+            }
+            add_to_group(outlines, outlines.first_shape);
+            found = flash_shapes.emplace(std::pair{ aperture_id, dark }, outlines).first;
+        }
+
+        raster_group group = found->second;
+        if(group.num_shapes == 0) {
+            return;
+        }
+        group.first_instance = static_cast<uint32_t>(instances.size());
+        group.num_instances = static_cast<uint32_t>(num_flashes);
+        for(size_t i = 0; i < num_flashes; ++i) {
+            instances.push_back({ static_cast<float>(flashes[i].pos.x), static_cast<float>(flashes[i].pos.y) });
+        }
+        groups.push_back(group);
+
+        // the outlines came after whatever fill_elements was adding to
+        group_open = false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::add_group(raster_point const *offsets, size_t num_offsets)
+    {
+        groups.push_back({ static_cast<uint32_t>(shapes.size()), 0, static_cast<uint32_t>(instances.size()), static_cast<uint32_t>(num_offsets), FLT_MAX, FLT_MAX,
+                           -FLT_MAX, -FLT_MAX });
+        instances.insert(instances.end(), offsets, offsets + num_offsets);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // shapes from first_shape to the end go on the end of a group
+
+    void gerber_rasterizer::add_to_group(raster_group &group, uint32_t first_shape) const
+    {
+        for(uint32_t n = first_shape; n < static_cast<uint32_t>(shapes.size()); ++n) {
+            raster_shape const &shape = shapes[n];
+            group.num_shapes += 1;
+            group.min_x = std::min(group.min_x, shape.min_x);
+            group.min_y = std::min(group.min_y, shape.min_y);
+            group.max_x = std::max(group.max_x, shape.max_x);
+            group.max_y = std::max(group.max_y, shape.max_y);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::add_path(clip_path const &path, bool dark)
+    {
+        raster_shape &shape = shapes.emplace_back();
+        shape.first_point = static_cast<uint32_t>(points.size());
+        shape.num_points = static_cast<uint32_t>(path.size());
+        shape.dark = dark;
+        shape.min_x = shape.min_y = FLT_MAX;
+        shape.max_x = shape.max_y = -FLT_MAX;
+
+        for(clip_point const &p : path) {
+            vec2d v = mm_from_clip_point(p);
+            points.push_back({ static_cast<float>(v.x), static_cast<float>(v.y) });
+            raster_point const &r = points.back();
+            shape.min_x = std::min(shape.min_x, r.x);
+            shape.min_y = std::min(shape.min_y, r.y);
+            shape.max_x = std::max(shape.max_x, r.x);
+            shape.max_y = std::max(shape.max_y, r.y);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    rect gerber_rasterizer::bounds() const
+    {
+        rect r(DBL_MAX, DBL_MAX, -DBL_MAX, -DBL_MAX);
+        for(raster_group const &group : groups) {
+            if(group.num_shapes == 0) {
+                continue;
+            }
+            for(uint32_t i = group.first_instance; i < group.first_instance + group.num_instances; ++i) {
+                raster_point const &offset = instances[i];
+                r.min_pos.x = std::min(r.min_pos.x, static_cast<double>(group.min_x + offset.x));
+                r.min_pos.y = std::min(r.min_pos.y, static_cast<double>(group.min_y + offset.y));
+                r.max_pos.x = std::max(r.max_pos.x, static_cast<double>(group.max_x + offset.x));
+                r.max_pos.y = std::max(r.max_pos.y, static_cast<double>(group.max_y + offset.y));
+            }
+        }
+        if(r.min_pos.x > r.max_pos.x) {
+            return {};
+        }
+        return r;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_rasterizer::render(raster_item const *items, size_t num_items, double left, double top, double scale, int width, int height, uint8_t *pixels,
+                                   size_t stride) const
+    {
+        // each thread keeps its scratch space so it isn't allocated for every block
+
+        thread_local tile_scanlines scanlines;
+        thread_local std::vector<float> coverage;
+
+        scanlines.set_size(width, height);
+        coverage.assign(static_cast<size_t>(width) * height, 0.0f);
+
+        auto pixel_x = [&](float x) { return static_cast<float>((x - left) * scale); };
+        auto pixel_y = [&](float y) { return static_cast<float>((top - y) * scale); };
+
+        // add up each run of shapes with the same polarity, then fill it
+
+        for(size_t i = 0; i < num_items; ++i) {
+
+            raster_shape const &shape = shapes[items[i].shape];
+            raster_point const &offset = instances[items[i].instance];
+
+            raster_point const *p = points.data() + shape.first_point;
+            raster_point const *prev = p + shape.num_points - 1;
+            for(uint32_t n = 0; n < shape.num_points; ++n) {
+                scanlines.add_line(pixel_x(prev->x + offset.x), pixel_y(prev->y + offset.y), pixel_x(p->x + offset.x), pixel_y(p->y + offset.y));
+                prev = p++;
+            }
+
+            if(i + 1 == num_items || shapes[items[i + 1].shape].dark != shape.dark) {
+                scanlines.fill(coverage.data(), shape.dark);
+            }
+        }
+
+        for(int y = 0; y < height; ++y) {
+            float const *src = coverage.data() + static_cast<size_t>(y) * width;
+            uint8_t *dst = pixels + static_cast<size_t>(y) * stride;
+            for(int x = 0; x < width; ++x) {
+                dst[x] = static_cast<uint8_t>(std::clamp(lroundf(src[x] * 255), 0l, 255l));
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_rasterizer::save(char const *file_path, int num_threads) const
+    {
+        FAIL_IF(dpi <= 0 || tile_size <= 0, error_internal_bad_argument);
+
+        double const scale = dpi / 25.4;
+
+        // image covers everything plus the border, pixel 0,0 is top left
+
+        rect extent = bounds();
+
+        double const left = extent.min_pos.x - border;
+        double const right = extent.max_pos.x + border;
+        double const bottom = extent.min_pos.y - border;
+        double const top = extent.max_pos.y + border;
+
+        double const image_width = ceil((right - left) * scale);
+        double const image_height = ceil((top - bottom) * scale);
+
+        FAIL_IF(image_width > 1 << 20 || image_height > 1 << 20, error_out_of_range);
+
+        int const width = std::max(1, static_cast<int>(image_width));
+        int const height = std::max(1, static_cast<int>(image_height));
+
+        int const tiles_across = (width + tile_size - 1) / tile_size;
+        int const tiles_down = (height + tile_size - 1) / tile_size;
+        size_t const num_tiles = static_cast<size_t>(tiles_across) * tiles_down;
+
+        // which shapes are in each tile, in the order they were drawn
+
+        struct tile_span
+        {
+            int x0, y0, x1, y1;
+        };
+
+        auto for_each_item = [&](auto fn) {
+            auto tile_x = [&](float x) { return std::clamp(static_cast<int>(floor((x - left) * scale)) / tile_size, 0, tiles_across - 1); };
+            auto tile_y = [&](float y) { return std::clamp(static_cast<int>(floor((top - y) * scale)) / tile_size, 0, tiles_down - 1); };
+            for(raster_group const &group : groups) {
+                for(uint32_t i = group.first_instance; i < group.first_instance + group.num_instances; ++i) {
+                    raster_point const &offset = instances[i];
+                    for(uint32_t n = group.first_shape; n < group.first_shape + group.num_shapes; ++n) {
+                        raster_shape const &s = shapes[n];
+                        fn(raster_item{ i, n }, tile_span{ tile_x(s.min_x + offset.x), tile_y(s.max_y + offset.y), tile_x(s.max_x + offset.x),
+                                                           tile_y(s.min_y + offset.y) });
+                    }
+                }
+            }
+        };
+
+        std::vector<size_t> tile_offsets(num_tiles + 1, 0);
+        for_each_item([&](raster_item const &, tile_span const &t) {
+            for(int y = t.y0; y <= t.y1; ++y) {
+                for(int x = t.x0; x <= t.x1; ++x) {
+                    tile_offsets[static_cast<size_t>(y) * tiles_across + x + 1] += 1;
+                }
+            }
+        });
+        for(size_t i = 0; i < num_tiles; ++i) {
+            tile_offsets[i + 1] += tile_offsets[i];
+        }
+        std::vector<raster_item> tile_items(tile_offsets.back());
+        {
+            std::vector<size_t> fill(tile_offsets.begin(), tile_offsets.end() - 1);
+            for_each_item([&](raster_item const &item, tile_span const &t) {
+                for(int y = t.y0; y <= t.y1; ++y) {
+                    for(int x = t.x0; x <= t.x1; ++x) {
+                        tile_items[fill[static_cast<size_t>(y) * tiles_across + x]++] = item;
+                    }
+                }
+            });
+        }
+
+        if(num_threads <= 0) {
+            num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+
+        // enough bands on the go to keep all the threads busy, that's what bounds the memory
+
+        int const bands_in_flight = std::max(2, num_threads / tiles_across + 2);
+
+        LOG_VERBOSE("Rendering {}x{} pixels at {} dpi, {} tiles, {} threads, {} bands of {} bytes", width, height, dpi, num_tiles, num_threads, bands_in_flight,
+                    static_cast<size_t>(width) * tile_size);
+
+        image_writer writer;
+        if(!writer.open(file_path, width, height)) {
+            LOG_ERROR("Can't open {}", file_path);
+            return error_cant_open_file;
+        }
+
+        std::vector<std::vector<uint8_t>> bands(bands_in_flight, std::vector<uint8_t>(static_cast<size_t>(width) * tile_size));
+        std::vector<int> tiles_finished(bands_in_flight, 0);
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        size_t next_tile = 0;
+        int bands_written = 0;
+        bool stop = false;
+
+        auto worker = [&]() {
+
+            while(true) {
+
+                size_t tile;
+                {
+                    std::unique_lock lock(mutex);
+                    changed.wait(lock, [&] {
+                        return stop || next_tile == num_tiles || static_cast<int>(next_tile / tiles_across) < bands_written + bands_in_flight;
+                    });
+                    if(stop || next_tile == num_tiles) {
+                        return;
+                    }
+                    tile = next_tile++;
+                }
+
+                int const band = static_cast<int>(tile / tiles_across);
+                int const tile_x = static_cast<int>(tile % tiles_across) * tile_size;
+                int const tile_y = band * tile_size;
+
+                render(tile_items.data() + tile_offsets[tile], tile_offsets[tile + 1] - tile_offsets[tile], left + tile_x / scale, top - tile_y / scale, scale,
+                       std::min(tile_size, width - tile_x), std::min(tile_size, height - tile_y), bands[band % bands_in_flight].data() + tile_x, width);
+
+                {
+                    std::lock_guard lock(mutex);
+                    tiles_finished[band % bands_in_flight] += 1;
+                }
+                changed.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(size_t i = 0; i < std::min(static_cast<size_t>(num_threads), num_tiles); ++i) {
+            threads.emplace_back(worker);
+        }
+
+        // write the bands out in order as they get finished
+
+        gerber_error_code result = ok;
+
+        for(int band = 0; band < tiles_down; ++band) {
+
+            int const slot = band % bands_in_flight;
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&] { return tiles_finished[slot] == tiles_across; });
+            }
+
+            int const rows = std::min(tile_size, height - band * tile_size);
+            for(int y = 0; y < rows; ++y) {
+                writer.write_row(bands[slot].data() + static_cast<size_t>(y) * width, width);
+            }
+
+            bool written = writer.flush();
+            {
+                std::lock_guard lock(mutex);
+                tiles_finished[slot] = 0;
+                bands_written += 1;
+                stop = !written;
+            }
+            changed.notify_all();
+
+            if(!written) {
+                LOG_ERROR("Error writing {}", file_path);
+                result = error_cant_open_file;
+                break;
+            }
+        }
+
+        for(auto &t : threads) {
+            t.join();
+        }
+
+        if(result == ok && !writer.close()) {
+            LOG_ERROR("Error writing {}", file_path);
+            result = error_cant_open_file;
+        }
+        return result;
+    }
+
+}    // namespace gerber_lib
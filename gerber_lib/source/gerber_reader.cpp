@@ -1,12 +1,63 @@
 //////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <bit>
 #include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define GERBER_READER_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GERBER_READER_SSE2
+#include <emmintrin.h>
+#endif
 
 #include "gerber_error.h"
 #include "gerber_reader.h"
 
 LOG_CONTEXT("line_reader", debug);
 
+namespace
+{
+    //////////////////////////////////////////////////////////////////////
+    // byte class lookup, saves a switch or an isdigit() per byte
+
+    enum char_class_bits : uint8_t
+    {
+        char_class_whitespace = 1,
+        char_class_digit = 2
+    };
+
+    struct char_class_table
+    {
+        uint8_t classes[256]{};
+
+        constexpr char_class_table()
+        {
+            for(char c : { ' ', '\n', '\r', '\f', '\t', '\v' }) {
+                classes[static_cast<uint8_t>(c)] = char_class_whitespace;
+            }
+            for(char c = '0'; c <= '9'; ++c) {
+                classes[static_cast<uint8_t>(c)] = char_class_digit;
+            }
+        }
+    };
+
+    constexpr char_class_table char_classes;
+
+    inline uint8_t char_class(char c)
+    {
+        return char_classes.classes[static_cast<uint8_t>(c)];
+    }
+
+}    // namespace
+
 namespace gerber_lib
 {
     //////////////////////////////////////////////////////////////////////
@@ -17,6 +68,8 @@ namespace gerber_lib
             return error_internal_bad_pointer;
         }
 
+        close();
+
         if(!std::filesystem::exists(file_path)) {
             return error_file_not_found;
         }
@@ -31,6 +84,58 @@ namespace gerber_lib
             return error_empty_file;
         }
 
+        if(map_file(file_path, file_size) != ok) {
+            CHECK(load_file(file_path, file_size));
+        }
+
+        filename.assign(file_path);
+        LOG_VERBOSE("Opened file {}, {} bytes available ({})", filename, file_size, mapped_address != nullptr ? "mapped" : "loaded");
+        file_pos = 0;
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // map the file read-only, no copy and the pages are shared with
+    // anything else which has the same file open
+
+    gerber_error_code gerber_reader::map_file(char const *file_path, size_t file_size)
+    {
+#if defined(GERBER_READER_MMAP)
+        int fd = ::open(file_path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1) {
+            LOG_WARNING("Can't open {} for mapping: {}", file_path, std::generic_category().message(errno));
+            return error_cant_open_file;
+        }
+
+        void *address = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // the mapping holds its own reference to the file
+        ::close(fd);
+
+        if(address == MAP_FAILED) {
+            LOG_WARNING("Can't map {}: {}", file_path, std::generic_category().message(errno));
+            return error_cant_open_file;
+        }
+
+        // the parser only ever goes forwards (apart from the odd rewind(1))
+        madvise(address, file_size, MADV_SEQUENTIAL);
+
+        mapped_address = address;
+        mapped_size = file_size;
+        file_data = std::span<char const>(static_cast<char const *>(address), file_size);
+        return ok;
+#else
+        (void)file_path;
+        (void)file_size;
+        return error_not_supported;
+#endif
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // fallback, read the whole thing into file_contents
+
+    gerber_error_code gerber_reader::load_file(char const *file_path, size_t file_size)
+    {
         std::ifstream in_stream(file_path, std::ios::binary);
 
         if(!in_stream.is_open()) {
@@ -40,14 +145,11 @@ namespace gerber_lib
             return error_cant_open_file;
         }
 
-        file_contents.clear();
-        file_contents.reserve(file_size);
-        file_contents.assign(std::istreambuf_iterator<char>(in_stream), std::istreambuf_iterator<char>());
+        file_contents.resize(file_size);
+        in_stream.read(file_contents.data(), static_cast<std::streamsize>(file_size));
+        file_contents.resize(static_cast<size_t>(in_stream.gcount()));
 
-        filename.assign(file_path);
-        LOG_VERBOSE("Opened file {}, {} bytes available", filename, file_size);
-        file_pos = 0;
-        line_number = 1;
+        file_data = std::span<char const>(file_contents);
         return ok;
     }
 
@@ -55,14 +157,43 @@ namespace gerber_lib
 
     void gerber_reader::close()
     {
+#if defined(GERBER_READER_MMAP)
+        if(mapped_address != nullptr) {
+            munmap(mapped_address, mapped_size);
+        }
+#endif
+        mapped_address = nullptr;
+        mapped_size = 0;
+        file_data = {};
         file_contents.clear();
+        file_pos = 0;
+        newline_offsets.clear();
+        line_index_built = false;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the source must stay open for as long as the view is being used
+
+    void gerber_reader::open_view(gerber_reader const &source, size_t begin, size_t end)
+    {
+        close();
+        filename = source.filename;
+        file_data = source.file_data.first(std::min(end, source.file_data.size()));
+        file_pos = begin;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_reader::~gerber_reader()
+    {
+        close();
     }
 
     //////////////////////////////////////////////////////////////////////
 
     bool gerber_reader::eof() const
     {
-        return file_pos >= file_contents.size();
+        return file_pos >= file_data.size();
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -98,7 +229,7 @@ namespace gerber_lib
         if(eof()) {
             return error_end_of_file;
         }
-        *c = file_contents[file_pos];
+        *c = file_data[file_pos];
         return ok;
     }
 
@@ -113,9 +244,7 @@ namespace gerber_lib
         if(eof()) {
             return error_end_of_file;
         }
-        if(c != nullptr) {
-            *c = file_contents[file_pos];
-        }
+        *c = file_data[file_pos];
         file_pos += 1;
         return ok;
     }
@@ -143,24 +272,17 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
     // skip_whitespace is not locale-aware because neither is the spec
+    // nearly always called when there's no whitespace at all so check that first
 
     void gerber_reader::skip_whitespace()
     {
-        while(!eof()) {
-            char c = file_contents[file_pos];
-            switch(c) {
-            case '\n':
-                line_number += 1;
-            case ' ':
-            case '\r':
-            case '\f':
-            case '\t':
-            case '\v':
-                file_pos += 1;
-                continue;
-            }
-            break;
+        size_t const size = file_data.size();
+        char const *data = file_data.data();
+        size_t pos = file_pos;
+        while(pos < size && (char_class(data[pos]) & char_class_whitespace) != 0) {
+            pos += 1;
         }
+        file_pos = pos;
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -168,20 +290,8 @@ namespace gerber_lib
 
     void gerber_reader::skip_whitespace_reverse()
     {
-        while(file_pos != 0) {
-            char c = file_contents[file_pos];
-            switch(c) {
-            case '\n':
-                line_number -= 1;
-            case ' ':
-            case '\r':
-            case '\f':
-            case '\t':
-            case '\v':
-                file_pos -= 1;
-                continue;
-            }
-            break;
+        while(file_pos != 0 && (char_class(file_data[file_pos]) & char_class_whitespace) != 0) {
+            file_pos -= 1;
         }
     }
 
@@ -190,32 +300,100 @@ namespace gerber_lib
 
     gerber_error_code gerber_reader::read_until(std::string *s, char value)
     {
-        std::string result;
-        while(!eof()) {
-            char c = file_contents[file_pos];
-            if(c == value) {
-                if(s != nullptr) {
-                    *s = result;
-                }
-                return ok;
+        size_t remaining = file_data.size() - std::min(file_pos, file_data.size());
+        char const *start = file_data.data() + file_pos;
+        char const *found = find_char(start, remaining, value);
+        if(found == nullptr) {
+            file_pos += remaining;
+            return error_missing_terminator;
+        }
+        size_t length = found - start;
+        if(s != nullptr) {
+            s->assign(start, length);
+        }
+        file_pos += length;
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // find the first occurrence of value in [p, p + length), 16 bytes
+    // at a time where we can get away with it
+
+    char const *gerber_reader::find_char(char const *p, size_t length, char value)
+    {
+        char const *end = p + length;
+
+#if defined(GERBER_READER_SSE2)
+        __m128i const needle = _mm_set1_epi8(value);
+        while(end - p >= 16) {
+            __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+            if(mask != 0) {
+                return p + std::countr_zero(static_cast<unsigned>(mask));
+            }
+            p += 16;
+        }
+#endif
+        for(; p < end; ++p) {
+            if(*p == value) {
+                return p;
             }
-            file_pos += 1;
-            result.push_back(c);
         }
-        return error_missing_terminator;
+        return nullptr;
     }
 
     //////////////////////////////////////////////////////////////////////
+    // one pass to find all the newlines, only happens if someone asks for a line number
 
-    gerber_error_code gerber_reader::get_int(int *value, size_t *length)
+    void gerber_reader::build_line_index() const
+    {
+        if(line_index_built) {
+            return;
+        }
+        newline_offsets.clear();
+        char const *start = file_data.data();
+        char const *end = start + file_data.size();
+        for(char const *p = start; (p = find_char(p, end - p, '\n')) != nullptr; ++p) {
+            newline_offsets.push_back(p - start);
+        }
+        line_index_built = true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // 1 based line number of the line containing offset
+
+    int gerber_reader::line_number_at(size_t offset) const
+    {
+        build_line_index();
+        auto newlines_before = std::lower_bound(newline_offsets.begin(), newline_offsets.end(), offset) - newline_offsets.begin();
+        return static_cast<int>(newlines_before) + 1;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_source_line gerber_reader::line() const
+    {
+        return gerber_source_line{ this, file_pos };
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::string gerber_source_line::to_string() const
+    {
+        return std::format("{}", reader->line_number_at(offset));
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // get_int and get_double scan the buffer directly rather than going
+    // through read_char/rewind for each digit, whitespace between digits
+    // is still allowed (and skipped) as it always was
+
+    template <typename T> gerber_error_code gerber_reader::get_integer(T *value, size_t *length)
     {
         if(value == nullptr) {
             return error_internal_bad_pointer;
         }
 
-        size_t len = 0;
-        int number = 0;
-
         char c;
         CHECK(peek(&c));
         bool negate = c == '-';
@@ -224,18 +402,30 @@ namespace gerber_lib
             skip(1);
         }
 
-        while(!eof()) {
-            CHECK(read_char(&c));
-            if(!isdigit(c)) {
-                rewind(1);
+        size_t const size = file_data.size();
+        char const *data = file_data.data();
+
+        size_t len = 0;
+        T number = 0;
+
+        while(file_pos < size) {
+            uint8_t cls = char_class(data[file_pos]);
+            if(cls & char_class_digit) {
+                number = number * 10 + (data[file_pos] - '0');
+                file_pos += 1;
+                len += 1;
+                continue;
+            }
+            if((cls & char_class_whitespace) == 0) {
                 break;
             }
-            number *= 10;
-            number += c - '0';
-            len += 1;
+            skip_whitespace();
+            if(eof()) {
+                return error_end_of_file;
+            }
         }
         if(len == 0) {
-            LOG_ERROR("Missing int at line {}", line_number);
+            LOG_ERROR("Missing int at line {}", line());
             return error_missing_integer_value;
         }
         if(negate) {
@@ -250,6 +440,20 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
+    gerber_error_code gerber_reader::get_int(int *value, size_t *length)
+    {
+        return get_integer(value, length);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_reader::get_int(int64_t *value, size_t *length)
+    {
+        return get_integer(value, length);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     gerber_error_code gerber_reader::get_double(double *value, size_t *length)
     {
         if(value == nullptr) {
@@ -273,9 +477,21 @@ namespace gerber_lib
             skip(1);
         }
 
-        while(!eof()) {
-            CHECK(read_char(&c));
+        size_t const size = file_data.size();
+        char const *data = file_data.data();
+
+        while(file_pos < size) {
+            c = data[file_pos];
+            uint8_t cls = char_class(c);
+            if(cls & char_class_whitespace) {
+                skip_whitespace();
+                if(eof()) {
+                    return error_end_of_file;
+                }
+                continue;
+            }
             if(c == '.') {
+                file_pos += 1;
                 if(found_decimal_point) {
                     break;
                 }
@@ -283,10 +499,10 @@ namespace gerber_lib
                 len += 1;
                 continue;
             }
-            if(!isdigit(c)) {
-                rewind(1);
+            if((cls & char_class_digit) == 0) {
                 break;
             }
+            file_pos += 1;
             num_digits += 1;
             double digit = static_cast<double>(c - '0');
             if(found_decimal_point) {
@@ -299,7 +515,7 @@ namespace gerber_lib
             len += 1;
         }
         if(num_digits == 0) {
-            LOG_ERROR("Missing real number at line {}", line_number);
+            LOG_ERROR("Missing real number at line {}", line());
             return error_missing_real_number_value;
         }
         if(length != nullptr) {
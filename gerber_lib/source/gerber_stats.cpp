@@ -14,6 +14,30 @@ namespace gerber_lib
         errors.clear();
         apertures.clear();
         d_codes.clear();
+        d_code_table.clear();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_aperture_info *gerber_stats::find_d_code(int number) const
+    {
+        if(number < 0 || static_cast<size_t>(number) >= d_code_table.size()) {
+            return nullptr;
+        }
+        return d_code_table[number];
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_stats::insert_d_code(gerber_aperture_info *d)
+    {
+        d_codes.push_back(d);
+        if(d->number >= 0) {
+            if(static_cast<size_t>(d->number) >= d_code_table.size()) {
+                d_code_table.resize(d->number + 1, nullptr);
+            }
+            d_code_table[d->number] = d;
+        }
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -43,50 +67,130 @@ namespace gerber_lib
 
     void gerber_stats::add_to_d_list(int number)
     {
-        for(auto const d : d_codes) {
-            if(d->number == number) {
-                return;
-            }
+        if(find_d_code(number) != nullptr) {
+            return;
         }
         gerber_aperture_info *d = new gerber_aperture_info();
-        d_codes.emplace_back(d);
 
         // This aperture number is unique, add it to the list.
         // Debug.WriteLine("    Adding code {0} to D List", number);
         d->number = number;
         d->count = 0;
+        insert_d_code(d);
     }
 
     //////////////////////////////////////////////////////////////////////
 
-    gerber_error_code gerber_stats::increment_d_list_count(int number, int count, int line)
+    gerber_error_code gerber_stats::increment_d_list_count(int number, int count, size_t file_offset)
     {
         (void)count;
-        (void)line;
+        (void)file_offset;
 
-        for(auto d : d_codes) {
-            if(d->number == number) {
-                d->count += 1;
-                return ok;
-            }
+        gerber_aperture_info *d = find_d_code(number);
+        if(d == nullptr) {
+            return error_undefined_d_code;
         }
-        return error_undefined_d_code;
+        d->count += 1;
+        return ok;
     }
 
     //////////////////////////////////////////////////////////////////////
 
     void gerber_stats::add_new_d_list(int number)
     {
-        for(gerber_aperture_info *info : d_codes) {
-            if(info->number == number) {
-                LOG_DEBUG("Code {} already exists in D list", number);
-                return;
-            }
+        if(find_d_code(number) != nullptr) {
+            LOG_DEBUG("Code {} already exists in D list", number);
+            return;
         }
         gerber_aperture_info *new_d_code = new gerber_aperture_info{};
         new_d_code->number = number;
         new_d_code->count = 0;
-        d_codes.push_back(new_d_code);
+        insert_d_code(new_d_code);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_stats::accumulate(gerber_stats const &other)
+    {
+        level_count += other.level_count;
+        g0 += other.g0;
+        g1 += other.g1;
+        g2 += other.g2;
+        g3 += other.g3;
+        g4 += other.g4;
+        g36 += other.g36;
+        g37 += other.g37;
+        g54 += other.g54;
+        g55 += other.g55;
+        g70 += other.g70;
+        g71 += other.g71;
+        g74 += other.g74;
+        g75 += other.g75;
+        g90 += other.g90;
+        g91 += other.g91;
+        d1 += other.d1;
+        d2 += other.d2;
+        d3 += other.d3;
+        m0 += other.m0;
+        m1 += other.m1;
+        m2 += other.m2;
+        unknown_g_codes += other.unknown_g_codes;
+        unknown_d_codes += other.unknown_d_codes;
+        unknown_m_codes += other.unknown_m_codes;
+        d_code_errors += other.d_code_errors;
+        x_count += other.x_count;
+        y_count += other.y_count;
+        i_count += other.i_count;
+        j_count += other.j_count;
+        star_count += other.star_count;
+        unknown_count += other.unknown_count;
+
+        for(gerber_aperture_info const *d : other.d_codes) {
+            if(d->count != 0) {
+                gerber_aperture_info *info = find_d_code(d->number);
+                if(info != nullptr) {
+                    info->count += d->count;
+                }
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_stats::reset_counters()
+    {
+        level_count = 0;
+        g0 = 0;
+        g1 = 0;
+        g2 = 0;
+        g3 = 0;
+        g4 = 0;
+        g36 = 0;
+        g37 = 0;
+        g54 = 0;
+        g55 = 0;
+        g70 = 0;
+        g71 = 0;
+        g74 = 0;
+        g75 = 0;
+        g90 = 0;
+        g91 = 0;
+        d1 = 0;
+        d2 = 0;
+        d3 = 0;
+        m0 = 0;
+        m1 = 0;
+        m2 = 0;
+        unknown_g_codes = 0;
+        unknown_d_codes = 0;
+        unknown_m_codes = 0;
+        d_code_errors = 0;
+        x_count = 0;
+        y_count = 0;
+        i_count = 0;
+        j_count = 0;
+        star_count = 0;
+        unknown_count = 0;
     }
 
-}    // namespace gerber_lib
\ No newline at end of file
+}    // namespace gerber_lib
@@ -0,0 +1,404 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <array>
+#include <algorithm>
+
+#include "gerber_log.h"
+#include "gerber_lib.h"
+#include "gerber_tiles.h"
+
+LOG_CONTEXT("tiles", info);
+
+namespace
+{
+    // at most this many grid cells across for finding the shapes in a tile
+    constexpr int max_grid_cells_across = 1024;
+
+    // groups with this many shapes or fewer don't bother with the grid
+    constexpr uint32_t max_shapes_without_grid = 16;
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_tile_pyramid::~gerber_tile_pyramid()
+    {
+        close();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    gerber_error_code gerber_tile_pyramid::open(gerber const &g, size_t budget, int num_threads)
+    {
+        close();
+
+        FAIL_IF(tile_size <= 0 || max_dpi <= 0, error_internal_bad_argument);
+
+        rasterizer.clear();
+        rasterizer.dpi = max_dpi;
+        CHECK(g.draw_list().replay(rasterizer));
+
+        // level 0 is a square around the whole thing
+
+        rect extent = rasterizer.bounds();
+        double border = rasterizer.border;
+        size = std::max(extent.width(), extent.height()) + border * 2;
+        left = (extent.min_pos.x + extent.max_pos.x - size) / 2;
+        top = (extent.min_pos.y + extent.max_pos.y + size) / 2;
+
+        double max_pixels = size * max_dpi / 25.4;
+        max_level = std::clamp(static_cast<int>(ceil(log2(max_pixels / tile_size))), 0, 24);
+
+        // grid of shapes, a few shapes per cell
+
+        std::vector<gerber_rasterizer::raster_shape> const &shapes = rasterizer.shapes;
+
+        grid_cells_across = std::clamp(static_cast<int>(sqrt(static_cast<double>(shapes.size()) / 4)), 1, max_grid_cells_across);
+
+        auto cell_x = [&](double x) { return std::clamp(static_cast<int>((x - left) / size * grid_cells_across), 0, grid_cells_across - 1); };
+        auto cell_y = [&](double y) { return std::clamp(static_cast<int>((top - y) / size * grid_cells_across), 0, grid_cells_across - 1); };
+
+        auto for_each_cell = [&](gerber_rasterizer::raster_shape const &s, auto fn) {
+            for(int y = cell_y(s.max_y); y <= cell_y(s.min_y); ++y) {
+                for(int x = cell_x(s.min_x); x <= cell_x(s.max_x); ++x) {
+                    fn(static_cast<size_t>(y) * grid_cells_across + x);
+                }
+            }
+        };
+
+        size_t num_cells = static_cast<size_t>(grid_cells_across) * grid_cells_across;
+        grid_offsets.assign(num_cells + 1, 0);
+        for(auto const &s : shapes) {
+            for_each_cell(s, [&](size_t cell) { grid_offsets[cell + 1] += 1; });
+        }
+        for(size_t i = 0; i < num_cells; ++i) {
+            grid_offsets[i + 1] += grid_offsets[i];
+        }
+        grid_shapes.resize(grid_offsets.back());
+        std::vector<size_t> fill(grid_offsets.begin(), grid_offsets.end() - 1);
+        for(uint32_t n = 0; n < shapes.size(); ++n) {
+            for_each_cell(shapes[n], [&](size_t cell) { grid_shapes[fill[cell]++] = n; });
+        }
+
+        memory_budget = budget;
+        memory_used = 0;
+        stopping = false;
+
+        if(num_threads <= 0) {
+            num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        for(int i = 0; i < num_threads; ++i) {
+            workers.emplace_back(&gerber_tile_pyramid::worker, this);
+        }
+
+        LOG_VERBOSE("{} shapes, {:.1f}mm square, levels 0..{}, {}x{} grid, {} threads", shapes.size(), size, max_level, grid_cells_across, grid_cells_across,
+                    num_threads);
+        return ok;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_tile_pyramid::close()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for(auto &t : workers) {
+            t.join();
+        }
+        workers.clear();
+        queue.clear();
+        queued.clear();
+        rendering.clear();
+        cache.clear();
+        lru.clear();
+        memory_used = 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    int gerber_tile_pyramid::level_for_pixel_size(double pixel_size) const
+    {
+        if(pixel_size <= 0) {
+            return max_level;
+        }
+        return std::clamp(static_cast<int>(ceil(log2(size / tile_size / pixel_size))), 0, max_level);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    rect gerber_tile_pyramid::tile_rect(gerber_tile_key const &key) const
+    {
+        double side = size / (1 << key.level);
+        double x = left + key.x * side;
+        double y = top - (key.y + 1) * side;
+        return rect(x, y, x + side, y + side);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // the shapes which might touch an area, in the order they were drawn
+
+    void gerber_tile_pyramid::items_in(rect const &area, std::vector<gerber_rasterizer::raster_item> &items) const
+    {
+        items.clear();
+
+        auto cell = [&](double v) { return static_cast<int>(floor(v / size * grid_cells_across)); };
+
+        for(gerber_rasterizer::raster_group const &group : rasterizer.groups) {
+
+            for(uint32_t i = group.first_instance; i < group.first_instance + group.num_instances; ++i) {
+
+                gerber_rasterizer::raster_point const &offset = rasterizer.instances[i];
+
+                // the area moved back over the first copy
+
+                double min_x = area.min_pos.x - offset.x;
+                double min_y = area.min_pos.y - offset.y;
+                double max_x = area.max_pos.x - offset.x;
+                double max_y = area.max_pos.y - offset.y;
+
+                if(group.num_shapes == 0 || group.max_x < min_x || group.min_x > max_x || group.max_y < min_y || group.min_y > max_y) {
+                    continue;
+                }
+
+                auto add_if_touching = [&](uint32_t shape_index) {
+                    gerber_rasterizer::raster_shape const &s = rasterizer.shapes[shape_index];
+                    if(s.max_x >= min_x && s.min_x <= max_x && s.max_y >= min_y && s.min_y <= max_y) {
+                        items.push_back({ i, shape_index });
+                    }
+                };
+
+                // flashes are a few shapes (somewhere around 0,0), quicker to check them all than use the grid
+
+                if(group.num_shapes <= max_shapes_without_grid) {
+                    for(uint32_t n = group.first_shape; n < group.first_shape + group.num_shapes; ++n) {
+                        add_if_touching(n);
+                    }
+                    continue;
+                }
+
+                // clamped like the shapes were when they went in, big apertures off the edge are in the edge cells
+                auto clamp_cell = [&](double v) { return std::clamp(cell(v), 0, grid_cells_across - 1); };
+                int x0 = clamp_cell(min_x - left);
+                int x1 = clamp_cell(max_x - left);
+                int y0 = clamp_cell(top - max_y);
+                int y1 = clamp_cell(top - min_y);
+
+                for(int y = y0; y <= y1; ++y) {
+                    for(int x = x0; x <= x1; ++x) {
+                        size_t c = static_cast<size_t>(y) * grid_cells_across + x;
+                        for(size_t n = grid_offsets[c]; n < grid_offsets[c + 1]; ++n) {
+                            uint32_t shape_index = grid_shapes[n];
+                            if(shape_index >= group.first_shape && shape_index < group.first_shape + group.num_shapes) {
+                                add_if_touching(shape_index);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // big shapes are in lots of cells
+        std::sort(items.begin(), items.end());
+        items.erase(std::unique(items.begin(), items.end()), items.end());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::shared_ptr<gerber_tile const> gerber_tile_pyramid::render_tile(gerber_tile_key const &key) const
+    {
+        auto tile = std::make_shared<gerber_tile>();
+        tile->key = key;
+        tile->pixels.resize(static_cast<size_t>(tile_size) * tile_size);
+
+        rect area = tile_rect(key);
+
+        std::vector<gerber_rasterizer::raster_item> items;
+        items_in(area, items);
+
+        rasterizer.render(items.data(), items.size(), area.min_pos.x, area.max_pos.y, tile_size / area.width(), tile_size, tile_size, tile->pixels.data(), tile_size);
+        return tile;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_tile_pyramid::add_to_cache(std::shared_ptr<gerber_tile const> const &tile)
+    {
+        if(cache.contains(tile->key)) {
+            return;
+        }
+        lru.push_front(tile);
+        cache[tile->key] = lru.begin();
+        memory_used += tile->pixels.size() + sizeof(gerber_tile);
+
+        // throw out the oldest until it fits, tiles still in use live on until they're let go
+        while(memory_used > memory_budget && lru.size() > 1) {
+            std::shared_ptr<gerber_tile const> const &oldest = lru.back();
+            memory_used -= oldest->pixels.size() + sizeof(gerber_tile);
+            cache.erase(oldest->key);
+            lru.pop_back();
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_tile_pyramid::enqueue(gerber_tile_key const &key, bool urgent)
+    {
+        int across = 1 << key.level;
+        if(key.level < 0 || key.level > max_level || key.x < 0 || key.y < 0 || key.x >= across || key.y >= across) {
+            return;
+        }
+        if(cache.contains(key) || rendering.contains(key) || queued.contains(key)) {
+            return;
+        }
+        queued.insert(key);
+        if(urgent) {
+            queue.push_front(key);
+        } else {
+            queue.push_back(key);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::shared_ptr<gerber_tile const> gerber_tile_pyramid::find_tile(gerber_tile_key const &key)
+    {
+        {
+            std::lock_guard lock(mutex);
+            auto found = cache.find(key);
+            if(found != cache.end()) {
+                lru.splice(lru.begin(), lru, found->second);
+                return *found->second;
+            }
+            enqueue(key, true);
+        }
+        work_available.notify_one();
+        return nullptr;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::shared_ptr<gerber_tile const> gerber_tile_pyramid::get_tile(gerber_tile_key const &key)
+    {
+        {
+            std::lock_guard lock(mutex);
+            auto found = cache.find(key);
+            if(found != cache.end()) {
+                lru.splice(lru.begin(), lru, found->second);
+                return *found->second;
+            }
+        }
+        std::shared_ptr<gerber_tile const> tile = render_tile(key);
+        std::lock_guard lock(mutex);
+        add_to_cache(tile);
+        return tile;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_tile_pyramid::set_view(rect const &view, int level)
+    {
+        level = std::clamp(level, 0, max_level);
+
+        auto tiles_in = [&](int l, rect const &r, int margin) {
+            double side = size / (1 << l);
+            int x0 = static_cast<int>(floor((r.min_pos.x - left) / side)) - margin;
+            int x1 = static_cast<int>(floor((r.max_pos.x - left) / side)) + margin;
+            int y0 = static_cast<int>(floor((top - r.max_pos.y) / side)) - margin;
+            int y1 = static_cast<int>(floor((top - r.min_pos.y) / side)) + margin;
+            return std::array<int, 4>{ x0, y0, x1, y1 };
+        };
+
+        {
+            std::lock_guard lock(mutex);
+
+            queue.clear();
+            queued.clear();
+
+            // what's in view, middle first
+
+            auto [x0, y0, x1, y1] = tiles_in(level, view, 0);
+            std::vector<gerber_tile_key> visible;
+            for(int y = y0; y <= y1; ++y) {
+                for(int x = x0; x <= x1; ++x) {
+                    visible.push_back({ level, x, y });
+                }
+            }
+            double cx = (x0 + x1) / 2.0;
+            double cy = (y0 + y1) / 2.0;
+            std::sort(visible.begin(), visible.end(), [&](gerber_tile_key const &a, gerber_tile_key const &b) {
+                return std::hypot(a.x - cx, a.y - cy) < std::hypot(b.x - cx, b.y - cy);
+            });
+            for(gerber_tile_key const &key : visible) {
+                enqueue(key, false);
+            }
+
+            // then a ring around it for panning
+
+            for(int y = y0 - 1; y <= y1 + 1; ++y) {
+                for(int x = x0 - 1; x <= x1 + 1; ++x) {
+                    if(x < x0 || x > x1 || y < y0 || y > y1) {
+                        enqueue({ level, x, y }, false);
+                    }
+                }
+            }
+
+            // then the level above for zooming out
+
+            if(level > 0) {
+                auto [px0, py0, px1, py1] = tiles_in(level - 1, view, 1);
+                for(int y = py0; y <= py1; ++y) {
+                    for(int x = px0; x <= px1; ++x) {
+                        enqueue({ level - 1, x, y }, false);
+                    }
+                }
+            }
+        }
+        work_available.notify_all();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gerber_tile_pyramid::worker()
+    {
+        std::unique_lock lock(mutex);
+
+        while(true) {
+
+            work_available.wait(lock, [&] { return stopping || !queue.empty(); });
+
+            if(stopping) {
+                return;
+            }
+
+            gerber_tile_key key = queue.front();
+            queue.pop_front();
+            queued.erase(key);
+
+            if(cache.contains(key)) {
+                continue;
+            }
+
+            rendering.insert(key);
+            lock.unlock();
+
+            std::shared_ptr<gerber_tile const> tile = render_tile(key);
+
+            lock.lock();
+            rendering.erase(key);
+            add_to_cache(tile);
+
+            if(tile_ready) {
+                lock.unlock();
+                tile_ready(key);
+                lock.lock();
+            }
+        }
+    }
+
+}    // namespace gerber_lib